@@ -0,0 +1,194 @@
+/*
+  Functions to write the binary activity log, see actlog.h
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "actlog.h"
+#include "asynclog.h"
+#include "hashtable.h"
+#include "log.h"
+
+#define NAME_RECORDS \
+        (1 + (ACTLOG_NAME_MAX + ACTLOG_RECORD - 1) / ACTLOG_RECORD)
+#define DEFAULT_NAMES 16
+
+/* the names logged so far, name -> id + 1, and the next id to intern */
+static struct hashtable_t names;
+static int namesReady;
+static uint32_t nextId;
+static pthread_mutex_t namesLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+  Fill the header record into buf.
+*/
+static void headerRecord(uint8_t *buf);
+
+/*
+  Fill the name record of id and the len bytes of name after it into buf,
+  which holds NAME_RECORDS records.
+
+  return the length of the records
+*/
+static size_t nameRecords(uint8_t *buf, uint32_t id, const char *name,
+                          size_t len);
+
+/*
+  Log name as id with the names lock held.
+
+  return 0 on success, 1 on failure
+*/
+static int logName(FILE *log, uint32_t id, const char *name);
+
+/*
+  Start a rotated file with the header and every name logged so far.
+*/
+static void restart(FILE *file);
+
+int actlogStart(FILE *log)
+{
+        uint8_t header[ACTLOG_RECORD];
+
+        pthread_mutex_lock(&namesLock);
+        if (!namesReady && ht_init(&names, DEFAULT_NAMES)) {
+                pthread_mutex_unlock(&namesLock);
+                return EXIT_FAILURE;
+        }
+        namesReady = 1;
+        nextId = 0;
+        pthread_mutex_unlock(&namesLock);
+
+        asyncLogOnRotate(restart);
+
+        headerRecord(header);
+        log_record(log, header, sizeof(header));
+        return EXIT_SUCCESS;
+}
+
+int actlogName(FILE *log, uint32_t id, const char *name)
+{
+        int ret;
+
+        pthread_mutex_lock(&namesLock);
+        ret = logName(log, id, name);
+        pthread_mutex_unlock(&namesLock);
+
+        return ret;
+}
+
+uint32_t actlogIntern(FILE *log, const char *name)
+{
+        void **slot;
+        uint32_t id;
+        size_t len;
+
+        len = strlen(name);
+        if (len > ACTLOG_NAME_MAX)
+                len = ACTLOG_NAME_MAX;
+
+        pthread_mutex_lock(&namesLock);
+        if (namesReady && (slot = ht_find(&names, name, len))) {
+                id = (uintptr_t) *slot - 1;
+        } else {
+                id = nextId;
+                if (logName(log, id, name))
+                        id = UINT32_MAX;
+        }
+        pthread_mutex_unlock(&namesLock);
+
+        return id;
+}
+
+void actlogWrite(FILE *log, const void *record)
+{
+        log_record(log, record, ACTLOG_RECORD);
+}
+
+void actlogFree(void)
+{
+        pthread_mutex_lock(&namesLock);
+        if (namesReady)
+                ht_free(&names);
+        namesReady = 0;
+        pthread_mutex_unlock(&namesLock);
+}
+
+static void headerRecord(uint8_t *buf)
+{
+        struct actlog_header_t header;
+
+        memset(&header, 0, sizeof(header));
+        header.type = ACTLOG_HEADER;
+        header.version = ACTLOG_VERSION;
+        header.order = ACTLOG_ORDER;
+        memcpy(header.magic, ACTLOG_MAGIC, sizeof(header.magic));
+        memcpy(buf, &header, sizeof(header));
+}
+
+static size_t nameRecords(uint8_t *buf, uint32_t id, const char *name,
+                          size_t len)
+{
+        struct actlog_name_t record;
+        size_t size;
+
+        memset(&record, 0, sizeof(record));
+        record.type = ACTLOG_NAME;
+        record.len = len;
+        record.id = id;
+
+        size = ACTLOG_RECORD * (1 + (len + ACTLOG_RECORD - 1) /
+                                ACTLOG_RECORD);
+        memset(buf, 0, size);
+        memcpy(buf, &record, sizeof(record));
+        memcpy(buf + ACTLOG_RECORD, name, len);
+        return size;
+}
+
+static int logName(FILE *log, uint32_t id, const char *name)
+{
+        uint8_t buf[NAME_RECORDS * ACTLOG_RECORD];
+        void **slot;
+        size_t len;
+        int created;
+
+        len = strlen(name);
+        if (len > ACTLOG_NAME_MAX)
+                len = ACTLOG_NAME_MAX;
+
+        if (!namesReady || !len ||
+            !(slot = ht_insert(&names, name, len, &created)))
+                return EXIT_FAILURE;
+
+        *slot = (void *) ((uintptr_t) id + 1);
+        if (id >= nextId)
+                nextId = id + 1;
+
+        /* the record and the name in one piece, so they stay together */
+        log_record(log, buf, nameRecords(buf, id, name, len));
+        return EXIT_SUCCESS;
+}
+
+static void restart(FILE *file)
+{
+        uint8_t buf[NAME_RECORDS * ACTLOG_RECORD];
+        const struct ht_entry_t *entry;
+        size_t i;
+
+        headerRecord(buf);
+        fwrite(buf, 1, ACTLOG_RECORD, file);
+
+        pthread_mutex_lock(&namesLock);
+        for (i = 0; namesReady && i < names.capacity; i++) {
+                entry = &(names.entries[i]);
+                if (!entry->keyLen)
+                        continue;
+
+                fwrite(buf, 1, nameRecords(buf,
+                                           (uintptr_t) entry->value - 1,
+                                           names.keys + entry->keyOff,
+                                           entry->keyLen), file);
+        }
+        pthread_mutex_unlock(&namesLock);
+}
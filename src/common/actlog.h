@@ -0,0 +1,130 @@
+#pragma once
+/*
+  Binary activity log.
+
+  In place of the printf-formatted activity lines, the proxy and the
+  nameserver can log fixed-width records of ACTLOG_RECORD bytes, so that
+  logging an event is filling a struct and copying it.  Strings are interned:
+  server IPs and zone names are logged once in name records, and the other
+  records carry their ids.  Chunk names are carried as their bitrate, segment
+  and fragment numbers.
+
+  A log starts with a header record.  A name record is followed by its name
+  in as many records as it takes, and may come after the records that use
+  its id.  A rotated asynchronous log starts again with the header and every
+  name logged so far.  Numbers are in the byte order of the machine that
+  wrote the log, the header tells which.  logconv turns a binary log back
+  into the text lines.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/* proxy log format string (all on one line):
+
+   <time> current time in seconds since epoch
+   <duration> number of seconds it took to download from svr to proxy
+   <tput> throughput for current chunk in Kbps
+   <avg-tput> current EWMA throughput estimate in Kbps
+   <bitrate> bitrate proxy requested for this chunk in Kbps
+   <server-ip> the IP address of the server
+   <chunkname> the name of the file proxy requested from the server
+   (modified file name)
+*/
+#define LOG_FMT "%lu %f %d %d %d %s %s\n"
+
+/* nameserver log format string */
+#define ACTIVITY_FMT "%f %s %s %s\n" /* time client-ip query-name
+                                         response-ip */
+
+#define ACTLOG_RECORD 40
+#define ACTLOG_MAGIC "VCDNACT" /* with its terminating zero */
+#define ACTLOG_VERSION 1
+#define ACTLOG_ORDER 0x01020304 /* as written by the machine */
+#define ACTLOG_NAME_MAX 255 /* longest name logged, longer ones are cut */
+
+enum actlog_type_t {
+        ACTLOG_HEADER = 1,
+        ACTLOG_NAME = 2,
+        ACTLOG_CHUNK = 3, /* proxy fragment, LOG_FMT */
+        ACTLOG_QUERY = 4 /* nameserver answer, ACTIVITY_FMT */
+};
+
+struct actlog_header_t {
+        uint16_t type;
+        uint16_t version;
+        uint32_t order;
+        char magic[8];
+        uint8_t pad[24];
+};
+
+/* followed by the len bytes of the name, padded to whole records */
+struct actlog_name_t {
+        uint16_t type;
+        uint16_t len;
+        uint32_t id;
+        uint8_t pad[32];
+};
+
+struct actlog_chunk_t {
+        uint16_t type;
+        uint16_t pad;
+        uint32_t server; /* name id of the server ip */
+        uint64_t time; /* microseconds since epoch */
+        uint32_t duration; /* microseconds of the download */
+        int32_t tput; /* Kbps of the fragment */
+        int32_t avgTput; /* Kbps of the moving average */
+        int32_t bitrate; /* Kbps requested */
+        int32_t seg, frag;
+};
+
+struct actlog_query_t {
+        uint16_t type;
+        uint16_t family; /* of the client address, AF_INET or AF_INET6 */
+        uint32_t zone; /* name id of the zone */
+        uint64_t time; /* microseconds since epoch */
+        uint8_t client[16]; /* address in network byte order */
+        uint32_t server; /* name id of the server ip */
+        uint32_t pad;
+};
+
+_Static_assert(sizeof(struct actlog_header_t) == ACTLOG_RECORD,
+               "header record size");
+_Static_assert(sizeof(struct actlog_name_t) == ACTLOG_RECORD,
+               "name record size");
+_Static_assert(sizeof(struct actlog_chunk_t) == ACTLOG_RECORD,
+               "chunk record size");
+_Static_assert(sizeof(struct actlog_query_t) == ACTLOG_RECORD,
+               "query record size");
+
+/*
+  Start the binary activity log log with its header, after logAsync if it is
+  to be asynchronous.
+
+  returns EXIT_SUCCESS if successful, EXIT_FAILURE otherwise
+*/
+int actlogStart(FILE *log);
+
+/*
+  Log the name of id, and keep it to log it again in every rotated file.
+
+  returns EXIT_SUCCESS if successful, EXIT_FAILURE otherwise
+*/
+int actlogName(FILE *log, uint32_t id, const char *name);
+
+/*
+  Return the id of name, logging it with the next unused id the first time.
+
+  returns the id, UINT32_MAX if it could not be logged
+*/
+uint32_t actlogIntern(FILE *log, const char *name);
+
+/*
+  Log the record of ACTLOG_RECORD bytes.
+*/
+void actlogWrite(FILE *log, const void *record);
+
+/*
+  Forget the names, once log is closed.
+*/
+void actlogFree(void);
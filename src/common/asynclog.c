@@ -0,0 +1,405 @@
+/*
+  Asynchronous backend for a log file, see asynclog.h
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "asynclog.h"
+#include "log.h"
+#include "mytime.h"
+
+#define RING_MASK (ASYNC_LOG_RING - 1)
+#define MEGABYTE (1UL << 20)
+
+/*
+  The lines a thread logged that were not written yet.  Only the thread
+  moves head and only the background thread moves tail, the bytes between
+  them being the lines.
+*/
+struct log_ring_t {
+        char data[ASYNC_LOG_RING];
+        atomic_size_t head, tail;
+        struct log_ring_t *next;
+};
+
+/*
+  The asynchronous log of the process
+*/
+struct async_log_t {
+        FILE *file; /* NULL while there is none */
+        const char *filename;
+        struct log_rotate_t rotate;
+        char *writeBuf; /* stdio buffer of file */
+        int failed; /* the file could not be started again, lines are
+                       thrown away */
+        void (*onRotate)(FILE *file); /* called on every rotated in file */
+
+        _Atomic(struct log_ring_t *) rings; /* of every thread that logged */
+        atomic_ulong dropped;
+        unsigned long reported; /* dropped lines last logged */
+
+        unsigned long written; /* bytes since the file was started */
+        mytime_t started;
+
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+        int stop;
+};
+
+static struct async_log_t async;
+
+/* the ring of the calling thread, allocated on its first line */
+static _Thread_local struct log_ring_t *threadRing;
+
+/*
+  Return the ring of the calling thread, registering a new one on its first
+  line.
+
+  return NULL if there is no memory for it
+*/
+static struct log_ring_t *ownRing(void);
+
+/*
+  Copy the len bytes of buf into the ring of the calling thread, or drop
+  them if they do not fit.
+*/
+static void ringPush(const void *buf, size_t len);
+
+/*
+  Background thread: write out the rings every ASYNC_LOG_INTERVAL until the
+  log is closed.
+*/
+static void *flushLoop(void *arg);
+
+/*
+  Write out the lines of every ring, and rotate the file when it is due.
+*/
+static void flushRings(void);
+
+/*
+  Rename the file to "<file>.1" and start a new one in its place.
+
+  return 0 on success, 1 on failure
+*/
+static int rotateFile(void);
+
+int logParseRotate(const char *arg, struct log_rotate_t *rotate)
+{
+        char *end;
+        unsigned long size, seconds;
+
+        errno = 0;
+        size = strtoul(arg, &end, 10);
+        if (errno || end == arg || (*end && *end != ',') ||
+            size > ULONG_MAX / MEGABYTE)
+                return EXIT_FAILURE;
+
+        seconds = 0;
+        if (*end == ',') {
+                arg = end + 1;
+                seconds = strtoul(arg, &end, 10);
+                if (errno || end == arg || *end)
+                        return EXIT_FAILURE;
+        }
+
+        rotate->size = size * MEGABYTE;
+        rotate->seconds = seconds;
+        return EXIT_SUCCESS;
+}
+
+int logAsync(FILE *log, const char *filename,
+             const struct log_rotate_t *rotate)
+{
+        if (!log || !filename || async.file)
+                return EXIT_FAILURE;
+
+        if (!(async.writeBuf = malloc(ASYNC_LOG_WRITE)))
+                return EXIT_FAILURE;
+
+        /* nothing was written to the fresh log yet, so the buffer can be
+           set */
+        if (setvbuf(log, async.writeBuf, _IOFBF, ASYNC_LOG_WRITE)) {
+                free(async.writeBuf);
+                async.writeBuf = NULL;
+                return EXIT_FAILURE;
+        }
+
+        async.filename = filename;
+        async.rotate = *rotate;
+        async.written = 0;
+        async.started = microtime(NULL);
+        async.stop = 0;
+        async.failed = 0;
+        atomic_init(&(async.rings), NULL);
+        atomic_init(&(async.dropped), 0);
+        async.reported = 0;
+        pthread_mutex_init(&(async.lock), NULL);
+        pthread_cond_init(&(async.wake), NULL);
+
+        /* the lines go to the rings from now on */
+        async.file = log;
+        if (pthread_create(&(async.thread), NULL, flushLoop, NULL)) {
+                /* the buffer stays with the stream until it is closed */
+                log(DEFAULT_LOG, "failed to start log thread.\n");
+                async.file = NULL;
+                pthread_mutex_destroy(&(async.lock));
+                pthread_cond_destroy(&(async.wake));
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
+
+int asyncLogPrintf(FILE *stream, const char *func, const int line,
+                   const char *format, va_list args)
+{
+        char buf[ASYNC_LOG_LINE];
+        size_t len;
+        int n, prefix;
+
+        if (!async.file || stream != async.file)
+                return 0;
+
+        prefix = 0;
+        if (func != NULL)
+                prefix = snprintf(buf, sizeof(buf), "[%s (%d)]\t", func,
+                                  line);
+        if (prefix < 0 || (size_t) prefix >= sizeof(buf))
+                prefix = 0;
+
+        n = vsnprintf(buf + prefix, sizeof(buf) - prefix, format, args);
+        if (n < 0)
+                return 1;
+
+        /* a line that was cut keeps what fits, and still ends one */
+        len = prefix + n;
+        if (len >= sizeof(buf)) {
+                len = sizeof(buf) - 1;
+                buf[len - 1] = '\n';
+        }
+
+        ringPush(buf, len);
+        return 1;
+}
+
+int asyncLogWrite(FILE *stream, const void *record, size_t len)
+{
+        if (!async.file || stream != async.file)
+                return 0;
+
+        ringPush(record, len);
+        return 1;
+}
+
+void asyncLogOnRotate(void (*started)(FILE *file))
+{
+        async.onRotate = started;
+}
+
+static void ringPush(const void *buf, size_t len)
+{
+        struct log_ring_t *ring;
+        size_t head, tail, first;
+
+        if (!(ring = ownRing()) || len > ASYNC_LOG_RING) {
+                atomic_fetch_add(&(async.dropped), 1);
+                return;
+        }
+
+        head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+        tail = atomic_load_explicit(&(ring->tail), memory_order_acquire);
+        if (ASYNC_LOG_RING - (head - tail) < len) {
+                atomic_fetch_add(&(async.dropped), 1);
+                return;
+        }
+
+        first = ASYNC_LOG_RING - (head & RING_MASK);
+        if (first > len)
+                first = len;
+        memcpy(ring->data + (head & RING_MASK), buf, first);
+        memcpy(ring->data, (const char *) buf + first, len - first);
+
+        atomic_store_explicit(&(ring->head), head + len,
+                              memory_order_release);
+
+        /* a ring filling up is written out before its interval is over */
+        if (head - tail < ASYNC_LOG_RING / 2 &&
+            head + len - tail >= ASYNC_LOG_RING / 2)
+                pthread_cond_signal(&(async.wake));
+}
+
+int asyncLogClose(FILE *log)
+{
+        struct log_ring_t *ring, *next;
+
+        if (!async.file || log != async.file)
+                return 0;
+
+        pthread_mutex_lock(&(async.lock));
+        async.stop = 1;
+        pthread_cond_signal(&(async.wake));
+        pthread_mutex_unlock(&(async.lock));
+        pthread_join(async.thread, NULL);
+
+        /* what was logged while the thread stopped */
+        flushRings();
+        if (!async.failed)
+                fclose(async.file);
+        free(async.writeBuf);
+        async.writeBuf = NULL;
+
+        if (asyncLogDropped())
+                log_printf(DEFAULT_LOG, __func__, __LINE__,
+                           "log dropped %lu lines.\n", asyncLogDropped());
+
+        for (ring = atomic_load(&(async.rings)); ring; ring = next) {
+                next = ring->next;
+                free(ring);
+        }
+        atomic_store(&(async.rings), NULL);
+        threadRing = NULL;
+
+        pthread_mutex_destroy(&(async.lock));
+        pthread_cond_destroy(&(async.wake));
+        async.file = NULL;
+        return 1;
+}
+
+unsigned long asyncLogDropped(void)
+{
+        return atomic_load(&(async.dropped));
+}
+
+static struct log_ring_t *ownRing(void)
+{
+        struct log_ring_t *ring;
+
+        if (threadRing)
+                return threadRing;
+
+        if (!(ring = malloc(sizeof(*ring))))
+                return NULL;
+
+        atomic_init(&(ring->head), 0);
+        atomic_init(&(ring->tail), 0);
+
+        /* pushed for good, the rings only go away with the log */
+        ring->next = atomic_load(&(async.rings));
+        while (!atomic_compare_exchange_weak(&(async.rings), &(ring->next),
+                                             ring))
+                ;
+
+        threadRing = ring;
+        return ring;
+}
+
+static void *flushLoop(void *arg)
+{
+        struct timespec until;
+        mytime_t wake;
+
+        /* gcc compilation unused variable */
+        arg = arg;
+
+        pthread_mutex_lock(&(async.lock));
+        while (!async.stop) {
+                wake = microtime(NULL) + ASYNC_LOG_INTERVAL;
+                until.tv_sec = wake / 1000000;
+                until.tv_nsec = (wake % 1000000) * 1000;
+                pthread_cond_timedwait(&(async.wake), &(async.lock), &until);
+
+                /* the lines are written without holding up logClose */
+                pthread_mutex_unlock(&(async.lock));
+                flushRings();
+                pthread_mutex_lock(&(async.lock));
+        }
+        pthread_mutex_unlock(&(async.lock));
+
+        return NULL;
+}
+
+static void flushRings(void)
+{
+        struct log_ring_t *ring;
+        size_t head, tail, len;
+        unsigned long dropped;
+        mytime_t now;
+
+        for (ring = atomic_load(&(async.rings)); ring; ring = ring->next) {
+                head = atomic_load_explicit(&(ring->head),
+                                            memory_order_acquire);
+                tail = atomic_load_explicit(&(ring->tail),
+                                            memory_order_relaxed);
+
+                /* at most two writes, before and after the end of the
+                   ring */
+                while (tail != head) {
+                        len = ASYNC_LOG_RING - (tail & RING_MASK);
+                        if (len > head - tail)
+                                len = head - tail;
+
+                        if (!async.failed)
+                                fwrite(ring->data + (tail & RING_MASK), 1,
+                                       len, async.file);
+                        async.written += len;
+                        tail += len;
+                }
+
+                atomic_store_explicit(&(ring->tail), tail,
+                                      memory_order_release);
+        }
+
+        if (!async.failed && fflush(async.file))
+                log(DEFAULT_LOG, "log write failed.\n");
+
+        dropped = asyncLogDropped();
+        if (dropped != async.reported) {
+                log_printf(DEFAULT_LOG, __func__, __LINE__,
+                           "log dropped %lu lines so far.\n", dropped);
+                async.reported = dropped;
+        }
+
+        now = microtime(NULL);
+        if (async.failed)
+                return;
+
+        if ((async.rotate.size && async.written >= async.rotate.size) ||
+            (async.rotate.seconds &&
+             now - async.started >= async.rotate.seconds * 1000000))
+                rotateFile();
+}
+
+static int rotateFile(void)
+{
+        char rotated[FILENAME_MAX];
+
+        snprintf(rotated, sizeof(rotated), "%s.1", async.filename);
+        if (rename(async.filename, rotated)) {
+                perror("rename");
+                log(DEFAULT_LOG, "rotate log failed.\n");
+        }
+
+        async.written = 0;
+        async.started = microtime(NULL);
+
+        /* the same FILE, so that the callers keep logging to it */
+        if (!freopen(async.filename, "w+", async.file) ||
+            setvbuf(async.file, async.writeBuf, _IOFBF, ASYNC_LOG_WRITE)) {
+                perror("freopen");
+                log(DEFAULT_LOG, "log lost, lines are thrown away.\n");
+                async.failed = 1;
+                return EXIT_FAILURE;
+        }
+
+        if (async.onRotate)
+                async.onRotate(async.file);
+
+        return EXIT_SUCCESS;
+}
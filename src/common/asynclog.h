@@ -0,0 +1,89 @@
+#pragma once
+/*
+  Asynchronous backend for a log file.
+
+  Once a log is made asynchronous, log_printf on it only formats the line
+  into a ring of the calling thread.  A background thread writes the rings
+  out to the file in large writes every ASYNC_LOG_INTERVAL, or as soon as a
+  ring is half full.  Disk stalls then hold up the background thread and not
+  the event loop or the query threads.  Lines of a thread stay in order, but
+  lines of different threads may be written out of order.
+
+  Memory is bounded: every thread has one ring of ASYNC_LOG_RING bytes, and a
+  line that does not fit in it is dropped and counted.  The count is reported
+  on DEFAULT_LOG whenever it grows.  The file can be rotated by size or age,
+  the current file being renamed to "<file>.1" and a new one started.
+
+  A process has at most one asynchronous log.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#define ASYNC_LOG_RING (1 << 18) /* bytes of lines buffered per thread */
+#define ASYNC_LOG_LINE 1024 /* longest line, longer ones are cut */
+#define ASYNC_LOG_WRITE (1 << 16) /* bytes of a write to the file */
+#define ASYNC_LOG_INTERVAL 100000 /* microseconds between writes */
+
+/*
+  When an asynchronous log is rotated, 0 for never
+*/
+struct log_rotate_t {
+        unsigned long size; /* bytes written to the file */
+        unsigned long seconds; /* since the file was started */
+};
+
+/*
+  Parse the rotation "<megabytes>[,<seconds>]" of an asynchronous log.
+
+  returns EXIT_SUCCESS if successful, EXIT_FAILURE otherwise
+*/
+int logParseRotate(const char *arg, struct log_rotate_t *rotate);
+
+/*
+  Make log, opened by logSetup from filename, asynchronous and rotate it by
+  rotate.  logClose writes out what is left and stops the background thread.
+
+  returns EXIT_SUCCESS if successful, EXIT_FAILURE otherwise, the log staying
+  synchronous
+*/
+int logAsync(FILE *log, const char *filename,
+             const struct log_rotate_t *rotate);
+
+/*
+  Format a line into the ring of the calling thread if stream is the
+  asynchronous log.
+
+  returns 1 if the line was taken, even when dropped, 0 if stream is not
+  asynchronous
+*/
+int asyncLogPrintf(FILE *stream, const char *func, const int line,
+                   const char *format, va_list args);
+
+/*
+  Copy the len bytes of record into the ring of the calling thread if stream
+  is the asynchronous log.  A record is never split between two writes.
+
+  returns 1 if the record was taken, even when dropped, 0 if stream is not
+  asynchronous
+*/
+int asyncLogWrite(FILE *stream, const void *record, size_t len);
+
+/*
+  Have started called on the new file every time the asynchronous log is
+  rotated, before any line is written to it, from the background thread.
+*/
+void asyncLogOnRotate(void (*started)(FILE *file));
+
+/*
+  Stop the background thread, write out the rings and close log if it is the
+  asynchronous log.
+
+  returns 1 if it was, 0 otherwise
+*/
+int asyncLogClose(FILE *log);
+
+/*
+  Returns the number of lines dropped so far because a ring was full.
+*/
+unsigned long asyncLogDropped(void);
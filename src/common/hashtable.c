@@ -0,0 +1,197 @@
+/*!
+  \file hashtable.c
+  \brief The generic hash table data structure
+*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "hashtable.h"
+
+#define MIN_CAPACITY 16
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+/* grow when the table would be more than 3/4 full */
+#define OVERLOADED(t, n) ((n) * 4 > (t)->capacity * 3)
+
+/*
+  Return the slot where key is stored, or the empty slot where it would be
+  inserted.
+*/
+static struct ht_entry_t *probe(const struct hashtable_t *table,
+                                const void *key, size_t len, uint32_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    struct ht_entry_t *entry;
+
+    for (;; i = (i + 1) & mask) {
+        entry = &(table->entries[i]);
+
+        if (!entry->keyLen)
+            return entry;
+
+        if (entry->hash == hash && entry->keyLen == len &&
+            !memcmp(table->keys + entry->keyOff, key, len))
+            return entry;
+    }
+}
+
+/*
+  Double the capacity of the table and rehash every entry.
+
+  return 0 on success, 1 otherwise
+*/
+static int grow(struct hashtable_t *table) {
+    struct ht_entry_t *old = table->entries;
+    size_t oldCapacity = table->capacity;
+    size_t i;
+
+    table->capacity = oldCapacity * 2;
+    if (!(table->entries = calloc(table->capacity, sizeof(*old)))) {
+        table->entries = old;
+        table->capacity = oldCapacity;
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].keyLen) {
+            *probe(table, table->keys + old[i].keyOff, old[i].keyLen,
+                   old[i].hash) = old[i];
+        }
+    }
+
+    free(old);
+    return EXIT_SUCCESS;
+}
+
+/*
+  Copy the len bytes of key to the end of the key arena.
+
+  return the offset of the copy, or -1 if the arena could not grow
+*/
+static long storeKey(struct hashtable_t *table, const void *key, size_t len) {
+    size_t cap;
+    char *keys;
+    long off;
+
+    if (table->keysLen + len > table->keysCap) {
+        cap = table->keysCap ? table->keysCap : MIN_CAPACITY * 8;
+        while (table->keysLen + len > cap)
+            cap *= 2;
+
+        if (!(keys = realloc(table->keys, cap)))
+            return -1;
+
+        table->keys = keys;
+        table->keysCap = cap;
+    }
+
+    memcpy(table->keys + table->keysLen, key, len);
+    off = table->keysLen;
+    table->keysLen += len;
+
+    return off;
+}
+
+uint32_t ht_hash(const void *key, size_t len) {
+    const uint8_t *bytes = key;
+    uint32_t hash = FNV_OFFSET;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+int ht_init(struct hashtable_t *table, size_t hint) {
+    memset(table, 0, sizeof(*table));
+
+    table->capacity = MIN_CAPACITY;
+    while (OVERLOADED(table, hint))
+        table->capacity *= 2;
+
+    if (!(table->entries = calloc(table->capacity, sizeof(struct ht_entry_t))))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+void ht_free(struct hashtable_t *table) {
+    free(table->entries);
+    free(table->keys);
+    memset(table, 0, sizeof(*table));
+}
+
+int ht_clone(struct hashtable_t *dst, const struct hashtable_t *src) {
+    memset(dst, 0, sizeof(*dst));
+
+    if (!(dst->entries = malloc(src->capacity * sizeof(*(src->entries)))) ||
+        (src->keysLen && !(dst->keys = malloc(src->keysLen)))) {
+        ht_free(dst);
+        return EXIT_FAILURE;
+    }
+
+    memcpy(dst->entries, src->entries,
+           src->capacity * sizeof(*(src->entries)));
+    if (src->keysLen)
+        memcpy(dst->keys, src->keys, src->keysLen);
+
+    dst->capacity = src->capacity;
+    dst->count = src->count;
+    dst->keysLen = dst->keysCap = src->keysLen;
+
+    return EXIT_SUCCESS;
+}
+
+void **ht_find(const struct hashtable_t *table, const void *key, size_t len) {
+    struct ht_entry_t *entry;
+
+    if (!table->entries || !len)
+        return NULL;
+
+    entry = probe(table, key, len, ht_hash(key, len));
+
+    return entry->keyLen ? &(entry->value) : NULL;
+}
+
+void **ht_insert(struct hashtable_t *table, const void *key, size_t len,
+                 int *created) {
+    struct ht_entry_t *entry;
+    uint32_t hash;
+    long off;
+
+    if (!table->entries || !len)
+        return NULL;
+
+    hash = ht_hash(key, len);
+    entry = probe(table, key, len, hash);
+    if (entry->keyLen) {
+        if (created)
+            *created = 0;
+        return &(entry->value);
+    }
+
+    if (OVERLOADED(table, table->count + 1)) {
+        if (grow(table))
+            return NULL;
+        entry = probe(table, key, len, hash);
+    }
+
+    if ((off = storeKey(table, key, len)) == -1)
+        return NULL;
+
+    entry->hash = hash;
+    entry->keyLen = len;
+    entry->keyOff = off;
+    entry->value = NULL;
+    table->count++;
+
+    if (created)
+        *created = 1;
+
+    return &(entry->value);
+}
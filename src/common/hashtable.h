@@ -0,0 +1,83 @@
+#pragma once
+/*!
+  \file hashtable.h
+  \brief Header file for the hash table data structure
+
+  An open addressing hash table with linear probing that maps byte string keys
+  to pointers.  Keys are copied into an arena owned by the table, so the
+  caller's key does not need to outlive the insertion, and there is no
+  allocation per key.  Entries can not be deleted.
+
+  Integer values can be stored by casting them through uintptr_t.
+*/
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+struct ht_entry_t {
+    uint32_t hash;
+    uint32_t keyLen; /* 0 marks an empty slot */
+    size_t keyOff; /* offset of the key in the table's key arena */
+    void *value;
+};
+
+struct hashtable_t {
+    struct ht_entry_t *entries;
+    size_t capacity; /* always a power of two */
+    size_t count;
+
+    char *keys; /* arena holding the copied keys */
+    size_t keysLen, keysCap;
+};
+
+/*!
+  \fn int ht_init(struct hashtable_t *table, size_t hint)
+  \brief initialize an empty table sized for hint entries
+
+  \return 0 on success, 1 otherwise
+*/
+int ht_init(struct hashtable_t *table, size_t hint);
+
+/*!
+  \fn void ht_free(struct hashtable_t *table)
+  \brief deallocate the table's entries and keys, but not the values
+*/
+void ht_free(struct hashtable_t *table);
+
+/*!
+  \fn int ht_clone(struct hashtable_t *dst, const struct hashtable_t *src)
+  \brief initialize dst as a copy of src, sharing the values
+
+  \return 0 on success, 1 otherwise.
+*/
+int ht_clone(struct hashtable_t *dst, const struct hashtable_t *src);
+
+/*!
+  \fn void **ht_find(const struct hashtable_t *table, const void *key,
+                     size_t len)
+  \brief find the value stored under the len bytes of key
+
+  \return a pointer to the value's slot if the key is found, NULL otherwise.
+  The slot is valid until the next insertion.
+*/
+void **ht_find(const struct hashtable_t *table, const void *key, size_t len);
+
+/*!
+  \fn void **ht_insert(struct hashtable_t *table, const void *key, size_t len,
+                       int *created)
+  \brief find the value stored under key, inserting a NULL value if the key
+  is not in the table yet.  Keys must not be empty.
+
+  created is set to 1 if the key was inserted and 0 if it already existed.
+
+  \return a pointer to the value's slot, NULL if the table could not grow.
+  The slot is valid until the next insertion.
+*/
+void **ht_insert(struct hashtable_t *table, const void *key, size_t len,
+                 int *created);
+
+/*!
+  \fn uint32_t ht_hash(const void *key, size_t len)
+  \brief the hash function used by the table (FNV-1a)
+*/
+uint32_t ht_hash(const void *key, size_t len);
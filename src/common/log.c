@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include "log.h"
+#include "asynclog.h"
 
 FILE *logSetup(const char *filename) {
         FILE *file = NULL;
@@ -31,6 +32,12 @@ void log_printf(FILE *stream, const char *func, const int line, const char *form
 
         stream = stream ? stream : DEFAULT_LOG;
 
+        /* an asynchronous log takes the line into a ring */
+        if (asyncLogPrintf(stream, func, line, format, args)) {
+                va_end(args);
+                return;
+        }
+
         if (func != NULL) {
                 fprintf(stream, "[%s (%d)]\t", func, line);
         }
@@ -41,11 +48,21 @@ void log_printf(FILE *stream, const char *func, const int line, const char *form
         va_end(args);
 }
 
+void log_record(FILE *stream, const void *record, size_t len) {
+        stream = stream ? stream : DEFAULT_LOG;
+
+        if (asyncLogWrite(stream, record, len))
+                return;
+
+        fwrite(record, 1, len, stream);
+        fflush(stream);
+}
+
 void logClose(FILE **log) {
 	if (!log)
 		return;
 
-        if (*log && !fclose(*log)) {
+        if (*log && (asyncLogClose(*log) || !fclose(*log))) {
                 log(DEFAULT_LOG, "close log.\n");
         }
 
@@ -8,7 +8,7 @@
 #define log(stream, ...) \
         do { log_printf(stream, __func__, __LINE__, __VA_ARGS__); } while(0)
 #else
-#define log(...)
+#define log(...) do {} while (0)
 #endif
 
 #define log_activity(stream, ...) \
@@ -28,6 +28,11 @@ FILE *logSetup(const char *file);
 void log_printf(FILE *stream, const char *func, const int line,
                 const char *format, ...);
 
+/*
+  Output the len bytes of the binary record to the log, in one piece
+*/
+void log_record(FILE *stream, const void *record, size_t len);
+
 /*
   Close log file elegantly.
 */
@@ -1,344 +1,287 @@
-#include <sys/time.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
-#include <sys/socket.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
 #include "mydnsparse.h"
 #include "../common/log.h"
 
-struct dns_t *generate_dns_message(uint16_t message_id, enum message_type type,
-                                   char *response_ip, int invalid_request)
-{
-	struct dns_t *dns_message = calloc(1, sizeof(struct dns_t));
-
-        if (dns_message == NULL) {
-                log(DEFAULT_LOG,
-                    "failed to calloc memory to generate dns message.\n");
-                return NULL;
-        }
-
-        dns_message->message_id = message_id;
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define TYPE_A 1
+#define CLASS_IN 1
+#define RCODE_NXDOMAIN 3
+#define MAX_POINTERS 16 /* compression pointers followed before giving up */
 
-	dns_message->type = type;
+static const uint8_t vid_domain_labels[] = VID_DOMAIN_LABELS;
 
-        dns_message->invalid_request = invalid_request;
+/**
+   Write a 16 bit value in network byte order to buf_loc.
 
-        if (dns_message->invalid_request) {
-                dns_message->len = DNS_HEADER_LEN; /* no body section */
-                return dns_message;
-        } else if (dns_message->type == QUERY) {
-                dns_message->query_name = VID_DOMAIN;
-                dns_message->len = DNS_REQUEST_LEN;
-                return dns_message;
-        } else {
-                dns_message->query_name = VID_DOMAIN;
-                dns_message->response_name = VID_DOMAIN;
-                dns_message->response_ip = response_ip;
-                dns_message->len = DNS_RESPONSE_LEN;
-                return dns_message;
-        }
+   @return the buffer location right after the value
+*/
+static uint8_t *put16(uint8_t *buf_loc, uint16_t value)
+{
+        value = htons(value);
+        memcpy(buf_loc, &value, 2);
+        return buf_loc + 2;
 }
 
-void free_dns_message(struct dns_t *dns_message)
+/**
+   Read a 16 bit value in network byte order from buf_loc.
+*/
+static uint16_t get16(const uint8_t *buf_loc)
 {
-        if (dns_message->type == RESPONSE &&
-            !dns_message->invalid_request) {
-                free(dns_message->response_ip);
-                dns_message->response_ip = NULL;
-        }
+        uint16_t value;
 
-        free(dns_message);
-        dns_message = NULL;
+        memcpy(&value, buf_loc, 2);
+        return ntohs(value);
 }
 
 /**
-   Turns string format bytes to labels format bytes.
+   Measure the uncompressed labels format name starting at offset off of buf.
 
-   @param buffer     buffer location to store the labels format bytes
+   @return the length of the name including the terminating zero label, -1 if
+   it is malformed or runs past len
 */
-static void string_to_labels_format(uint8_t *buffer)
+static int labels_length(const uint8_t *buf, size_t len, size_t off)
 {
-        char *segment;
-        uint8_t seg_len;
-        uint8_t *buf_loc;
+        size_t start = off;
+
+        while (off < len) {
+                if (buf[off] == 0)
+                        return off - start + 1;
+
+                if (buf[off] > MAX_LABEL_LEN)
+                        return -1; /* compression is not allowed here */
 
-        /* "video.cs.cmu.edu" needs to be declared as char str[] here */
-        char str[] = "video.cs.cmu.edu";
-        buf_loc = buffer;
-        segment = strtok (str,".");
-        while (segment != NULL) {
-                /* places the segment length */
-                seg_len = strlen(segment);
-                *buf_loc = seg_len;
-                buf_loc += 1;
-
-                /* places the segment characters */
-                memcpy(buf_loc, segment, seg_len);
-                buf_loc += seg_len;
-
-                segment = strtok(NULL, ".");
+                off += buf[off] + 1;
+                if (off - start >= MAX_DOMAIN_NAME_LEN)
+                        return -1;
         }
-        *buf_loc = 0;
-        buf_loc += 1;
 
-        return;
+        return -1;
 }
 
 /**
-   Turns string format bytes to labels format bytes.
+   Skip over a possibly compressed name starting at offset off of buf.  The
+   name is only walked to check that it is well formed.
 
-   @param buf_loc     buffer location of the labels format bytes
-   @param char_buf    buffer location to store the string format bytes
-
-   @return The length of the labels format bytes
+   @return the offset right after the name, -1 if it is malformed
 */
-static int labels_format_to_string(uint8_t *buf_loc, char *char_buf)
+static ssize_t skip_name(const uint8_t *buf, size_t len, size_t off)
 {
-        int char_buf_i, i, len, seg_len;
-
-        len = strlen((char *)buf_loc);
-        seg_len = 0;
-        char_buf_i = 0;
-        for (i = 0; i < len; i++) {
-                if (seg_len == 0) {
-                        seg_len = buf_loc[i];
-                        if (i != 0) {
-                                char_buf[char_buf_i] = '.';
-                                char_buf_i++;
-                        }
-                } else {
-                        seg_len--;
-                        char_buf[char_buf_i] = (char)buf_loc[i];
-                        char_buf_i++;
+        ssize_t end = -1;
+        int pointers = 0;
+        int labels;
+
+        while (off < len) {
+                if ((buf[off] & 0xc0) == 0xc0) {
+                        if (off + 2 > len || ++pointers > MAX_POINTERS)
+                                return -1;
+
+                        if (end == -1)
+                                end = off + 2;
+
+                        off = get16(buf + off) & 0x3fff;
+                        continue;
                 }
+
+                if ((labels = labels_length(buf, len, off)) == -1)
+                        return -1;
+
+                return (end == -1) ? (ssize_t) (off + labels) : end;
         }
 
-        return len + 1;
+        return -1;
 }
 
-uint8_t *serialize_dns(struct dns_t *dns_message)
+void generate_dns_message(struct dns_t *dns_message, uint16_t message_id,
+                          enum message_type type,
+                          const struct in_addr *answers, size_t answer_count,
+                          int invalid_request)
 {
-        uint8_t *buf_loc;
-        uint8_t *buf;
-        uint8_t domain_name[MAX_DOMAIN_NAME_LEN];
-        uint16_t tmp;
-        uint16_t id, qdcount, ancount, nscount, arcount, qtype, qclass;
-        uint16_t r_type, r_class, rdlength;
-        uint32_t r_ttl;
-        uint16_t qr, opcode, aa, tc, rd, ra, z, rcode;
-        unsigned long ip_address;
+        memset(dns_message, 0, sizeof(*dns_message));
 
-        buf = calloc(dns_message->len, sizeof(uint8_t));
+        dns_message->message_id = message_id;
+
+        dns_message->type = type;
+
+        dns_message->invalid_request = invalid_request;
 
-        if (buf == NULL) {
-            log(DEFAULT_LOG, "failed to calloc buffer to serialize.\n");
-            return NULL;
+        if (dns_message->invalid_request) {
+                dns_message->len = DNS_HEADER_LEN; /* no body section */
+                return;
+        }
+
+        dns_message->query_name = vid_domain_labels;
+        dns_message->query_name_len = DOMAIN_NAME_LEN;
+
+        if (dns_message->type == QUERY) {
+                dns_message->len = DNS_REQUEST_LEN;
+        } else {
+                dns_message->answer_count = min(answer_count, DNS_MAX_ANSWERS);
+                memcpy(dns_message->answers, answers,
+                       dns_message->answer_count * sizeof(*answers));
+                dns_message->len =
+                        DNS_RESPONSE_LEN(dns_message->answer_count);
+        }
+}
+
+ssize_t serialize_dns(const struct dns_t *dns_message, uint8_t *buf,
+                      size_t size)
+{
+        uint8_t *buf_loc;
+        uint16_t qr, opcode, aa, tc, rd, ra, z, rcode;
+        uint16_t qdcount, ancount;
+        size_t i, needed;
+
+        qdcount = !(dns_message->invalid_request) ? 1 : 0;
+        ancount = (dns_message->type == RESPONSE && qdcount) ?
+                dns_message->answer_count : 0;
+
+        needed = DNS_HEADER_LEN +
+                qdcount * (dns_message->query_name_len + 4) +
+                ancount * (dns_message->query_name_len + 14);
+        if (needed > size) {
+                log(DEFAULT_LOG, "buffer too small to serialize.\n");
+                return -1;
         }
 
         buf_loc = buf;
         /******************* below is the header section ********************/
         /* put in the id number in network byte order */
-        id = htons(dns_message->message_id);
-        memcpy(buf_loc, &id, 2);
-        buf_loc += 2;
+        buf_loc = put16(buf_loc, dns_message->message_id);
 
         /* put in QR, OPCODE, AA, TC, RD, RA, Z and RCODE */
         qr = dns_message->type;
         opcode = 0, tc = 0, rd = 0;
         aa = (qr == QUERY) ? 0 : 1;
         ra = 0, z = 0;
-        rcode = ((dns_message->invalid_request) ? 3 : 0);
-        tmp = htons((qr << 15) | (opcode << 11) | (aa << 10) | (tc << 9) |
-                    (rd << 8) | (ra << 7) | (z << 4) | rcode);
-        memcpy(buf_loc, &tmp, 2);
-        buf_loc += 2;
-
-        /* put in QDCOUNT */
-        qdcount = htons(((dns_message->type == QUERY) ||
-                         (dns_message->type == RESPONSE &&
-                          !(dns_message->invalid_request))) ? 1 : 0);
-        memcpy(buf_loc, &qdcount, 2);
-        buf_loc += 2;
-
-        /* put in ANCOUNT */
-        ancount = htons((dns_message->type == RESPONSE &&
-                         !(dns_message->invalid_request)) ? 1 : 0);
-        memcpy(buf_loc, &ancount, 2);
-        buf_loc += 2;
-
-        /* put in NSCOUNT */
-        nscount = 0;
-        memcpy(buf_loc, &nscount, 2);
-        buf_loc += 2;
-
-        /* put in ARCOUNT */
-        arcount = 0;
-        memcpy(buf_loc, &arcount, 2);
-        buf_loc += 2;
+        rcode = ((dns_message->invalid_request) ? RCODE_NXDOMAIN : 0);
+        buf_loc = put16(buf_loc, (qr << 15) | (opcode << 11) | (aa << 10) |
+                        (tc << 9) | (rd << 8) | (ra << 7) | (z << 4) | rcode);
 
-        /******************* below is the body section ********************/
-        string_to_labels_format(domain_name);
+        /* put in QDCOUNT, ANCOUNT, NSCOUNT and ARCOUNT */
+        buf_loc = put16(buf_loc, qdcount);
+        buf_loc = put16(buf_loc, ancount);
+        buf_loc = put16(buf_loc, 0);
+        buf_loc = put16(buf_loc, 0);
 
+        /******************* below is the body section ********************/
         if (qdcount) {
-                /* put in QNAME */
-                memcpy(buf_loc, domain_name, DOMAIN_NAME_LEN);
-                buf_loc += DOMAIN_NAME_LEN;
-
-                /* put in QTYPE */
-                qtype = htons(1);
-                memcpy(buf_loc, &qtype, 2);
-                buf_loc += 2;
-
-                /* put in QCLASS */
-                qclass = htons(1);
-                memcpy(buf_loc, &qclass, 2);
-                buf_loc += 2;
+                /* put in QNAME, QTYPE and QCLASS */
+                memcpy(buf_loc, dns_message->query_name,
+                       dns_message->query_name_len);
+                buf_loc += dns_message->query_name_len;
+                buf_loc = put16(buf_loc, TYPE_A);
+                buf_loc = put16(buf_loc, CLASS_IN);
         }
 
-        if (ancount) {
-                /* put in NAME */
-                memcpy(buf_loc, domain_name, DOMAIN_NAME_LEN);
-                buf_loc += DOMAIN_NAME_LEN;
-
-                /* put in TYPE */
-                r_type = htons(1);
-                memcpy(buf_loc, &r_type, 2);
-                buf_loc += 2;
-
-                /* put in CLASS */
-                r_class = htons(1);
-                memcpy(buf_loc, &r_class, 2);
-                buf_loc += 2;
+        /* one answer record per ip, in the ranked order */
+        for (i = 0; i < ancount; i++) {
+                /* put in NAME, TYPE and CLASS */
+                memcpy(buf_loc, dns_message->query_name,
+                       dns_message->query_name_len);
+                buf_loc += dns_message->query_name_len;
+                buf_loc = put16(buf_loc, TYPE_A);
+                buf_loc = put16(buf_loc, CLASS_IN);
 
                 /* put in TTL */
-                r_ttl = 0;
-                memcpy(buf_loc, &r_ttl, 4);
+                memset(buf_loc, 0, 4);
                 buf_loc += 4;
 
-                /* put in RDLENGTH */
-                rdlength = htons(4);
-                memcpy(buf_loc, &rdlength, 2);
-                buf_loc += 2;
-
-                /* put in RDATA */
-                inet_pton(AF_INET, dns_message->response_ip, &ip_address);
-                memcpy(buf_loc, &ip_address, 4);
+                /* put in RDLENGTH and RDATA, already in network byte order */
+                buf_loc = put16(buf_loc, 4);
+                memcpy(buf_loc, &(dns_message->answers[i]), 4);
                 buf_loc += 4;
         }
 
-        if ((buf_loc - buf) != dns_message->len) {
-                log(DEFAULT_LOG, "failed to serialize the dns message.\n");
-                return NULL;
-        }
-
-        return buf;
+        return buf_loc - buf;
 }
 
-struct dns_t *deserialize_dns(uint8_t *buf)
+int deserialize_dns(struct dns_t *dns_message, const uint8_t *buf,
+                    size_t len)
 {
-        uint16_t id;
-        uint16_t rcode;
-        uint8_t* start_buf;
-        uint16_t tmp1;
-        char *domain_name;
-        struct dns_t *dns_message;
-        unsigned long ip_address;
-        char *tmp;
+        uint16_t flags, qdcount, ancount, type, class, rdlength;
+        size_t off, i;
+        ssize_t end;
+        int name_len;
 
-        start_buf = buf;
+        memset(dns_message, 0, sizeof(*dns_message));
 
         /******************* below is the header section ********************/
-        dns_message = calloc(1, sizeof(struct dns_t));
-
-        if (dns_message == NULL) {
-            log(DEFAULT_LOG, "failed to calloc struct dns_t for deserialize\n");
-            return NULL;
+        if (len < DNS_HEADER_LEN) {
+                log(DEFAULT_LOG, "dns message shorter than header.\n");
+                return -1;
         }
 
         /* the first two bytes must be the message ID field */
-        memcpy(&id, buf, 2);
-        buf += 2;
-        dns_message->message_id = ntohs(id);
-
-        /* type of packet: query or response */
-        memcpy(&tmp1, buf, 2);
-        buf += 2;
-
-        dns_message->type = (ntohs(tmp1) >> 15) & 0b1;
-
-        /* get the RCODE */
-        rcode = ntohs(tmp1) & 0b1111;
-        dns_message->invalid_request = (rcode) ? 1 : 0;
-        /* skips OPCODE, AA, TC, RD, RA and Z, not useful info */
-
-        /* skips QDCOUNT, ANCOUNT, NSCOUNT and ARCOUNT, not useful info */
-        buf += 8;
+        dns_message->message_id = get16(buf);
+
+        /* type of packet: query or response, and the RCODE.  skips OPCODE,
+           AA, TC, RD, RA and Z, not useful info */
+        flags = get16(buf + 2);
+        dns_message->type = (flags >> 15) & 0b1;
+        dns_message->invalid_request = (flags & 0b1111) ? 1 : 0;
+
+        /* skips NSCOUNT and ARCOUNT, not useful info */
+        qdcount = get16(buf + 4);
+        ancount = get16(buf + 6);
+        off = DNS_HEADER_LEN;
+
+        if (qdcount > 1) {
+                log(DEFAULT_LOG, "more than one question.\n");
+                return -1;
+        }
 
         /******************* below is the body section ********************/
-        if ((dns_message->type == QUERY) ||
-            (dns_message->type == RESPONSE && !(dns_message->invalid_request))) {
-                domain_name = calloc(MAX_DOMAIN_NAME_LEN, sizeof(char));
-                if (domain_name == NULL) {
-                    log(DEFAULT_LOG, "failed to calloc buf for domain name\n");
-                    return NULL;
-                }
-
-                /* stores QNAME */
-                buf += labels_format_to_string(buf, domain_name);
-                if (strcmp(VID_DOMAIN, domain_name)) {
-                        log(DEFAULT_LOG, "invalid query request\n");
-                        dns_message->query_name = domain_name;
-                } else {
-                        dns_message->query_name = VID_DOMAIN;
-                        free(domain_name);
-                        domain_name = NULL;
+        if (qdcount) {
+                /* stores QNAME, skips QTYPE and QCLASS */
+                if ((name_len = labels_length(buf, len, off)) == -1 ||
+                    off + name_len + 4 > len) {
+                        log(DEFAULT_LOG, "malformed question.\n");
+                        return -1;
                 }
 
-                /* skips QTYPE and QCLASS */
-                buf += 4;
+                dns_message->query_name = buf + off;
+                dns_message->query_name_len = name_len;
+                off += name_len + 4;
         }
 
-        if (dns_message->type == RESPONSE &&
-            !(dns_message->invalid_request)) {
-                domain_name = calloc(MAX_DOMAIN_NAME_LEN, sizeof(char));
-                if (domain_name == NULL) {
-                    log(DEFAULT_LOG, "failed to calloc buf for domain name\n");
-                    return NULL;
+        for (i = 0; i < ancount; i++) {
+                /* skips NAME, all answers are for the queried name */
+                if ((end = skip_name(buf, len, off)) == -1 ||
+                    (size_t) end + 10 > len) {
+                        log(DEFAULT_LOG, "malformed answer.\n");
+                        return -1;
                 }
+                off = end;
 
-                /* stores NAME */
-                buf += labels_format_to_string(buf, domain_name);
-                if (strcmp(VID_DOMAIN, domain_name)) {
-                        log(DEFAULT_LOG, "invalid query response\n");
-                        dns_message->response_name = domain_name;
-                } else {
-                        dns_message->response_name = VID_DOMAIN;
-                        free(domain_name);
-                        domain_name = NULL;
-                }
+                /* gets TYPE, CLASS and RDLENGTH, skips TTL */
+                type = get16(buf + off);
+                class = get16(buf + off + 2);
+                rdlength = get16(buf + off + 8);
+                off += 10;
 
-                /* skips QTYPE and QCLASS */
-                buf += 10;
+                if (off + rdlength > len) {
+                        log(DEFAULT_LOG, "truncated answer.\n");
+                        return -1;
+                }
 
-                /* stores RDATA */
-                tmp = calloc(IP_STR_LEN, sizeof(char));
-                if (tmp == NULL) {
-                        log(DEFAULT_LOG,
-                            "failed to calloc buffer for ip address\n");
-                        return NULL;
+                /* stores RDATA of A records, extras beyond DNS_MAX_ANSWERS
+                   are ignored */
+                if (type == TYPE_A && class == CLASS_IN && rdlength == 4 &&
+                    dns_message->answer_count < DNS_MAX_ANSWERS) {
+                        memcpy(&(dns_message->answers[
+                                         dns_message->answer_count++]),
+                               buf + off, 4);
                 }
-                memcpy(&ip_address, buf, 4);
-                inet_ntop(AF_INET, &ip_address, tmp, INET_ADDRSTRLEN);
-                dns_message->response_ip = tmp;
-                buf += 4;
+                off += rdlength;
         }
 
-        dns_message->len = buf - start_buf;
+        dns_message->len = off;
 
-        return dns_message;
+        return 0;
 }
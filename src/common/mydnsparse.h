@@ -5,6 +5,7 @@
 */
 
 #include <stdlib.h>
+#include <sys/types.h>
 
 #include "../nameserver/nameserver.h"
 
@@ -12,45 +13,49 @@
 #define DNS_BUF_SIZE 4096
 #define IP_STR_LEN 128
 #define DNS_HEADER_LEN (6 * 2)
-#define MAX_DOMAIN_NAME_LEN 64
-#define DOMAIN_NAME_LEN 18
+#define MAX_DOMAIN_NAME_LEN 255
+#define MAX_LABEL_LEN 63
+#define DOMAIN_NAME_LEN sizeof(VID_DOMAIN_LABELS)
 #define DNS_REQUEST_LEN (DNS_HEADER_LEN + DOMAIN_NAME_LEN + 4)
-#define DNS_RESPONSE_LEN (DNS_HEADER_LEN + DOMAIN_NAME_LEN*2 + 4 + 14)
+#define DNS_ANSWER_LEN (DOMAIN_NAME_LEN + 14)
+#define DNS_RESPONSE_LEN(n) (DNS_REQUEST_LEN + (n) * DNS_ANSWER_LEN)
 
 /**
-   Generate a dns message.
+   Fill in a dns message for VID_DOMAIN.  Nothing is allocated.
 
+   @param dns_message 	Struct to be filled in
    @param type 	Type of message : QUERY or RESPONSE
-   @param response_ip The ip address for response.
-
-   @return struct pointer to contain the message data, NULL if unsuccessful
-*/
-struct dns_t *generate_dns_message(uint16_t message_id, enum message_type type,
-                                   char *response_ip, int invalid_request);
-
-/**
-   Free a dns message struct.
-
-   @param dns_message 	Struct pointer to contain the message data
+   @param answers The ip addresses for response, preferred one first.
+   @param answer_count The number of ips in answers, at most DNS_MAX_ANSWERS.
 */
-void free_dns_message(struct dns_t *dns_message);
+void generate_dns_message(struct dns_t *dns_message, uint16_t message_id,
+                          enum message_type type,
+                          const struct in_addr *answers, size_t answer_count,
+                          int invalid_request);
 
 /**
-   Take a dns struct and turn it into a string representation that can
-   be sent via UDP (sendto)
+   Write the wire format of a dns struct into buf so it can be sent via UDP
+   (sendto).  Nothing is allocated.
 
-   @param dns 	struct to be serialized
+   @param dns_message 	struct to be serialized
+   @param buf 	caller supplied buffer for the wire format
+   @param size 	size of buf
 
-   @return buffer pointer to contain serialized struct, NULL if unsuccessful
+   @return the number of bytes written, -1 if buf is too small
 */
-uint8_t *serialize_dns(struct dns_t *dns_message);
+ssize_t serialize_dns(const struct dns_t *dns_message, uint8_t *buf,
+                      size_t size);
 
 /**
-   Turn a string representation of dns struct into an actual struct
+   Turn the wire format of a dns message in buf into a struct.  Every field is
+   bounds checked against len and nothing is allocated; query_name points into
+   buf, so buf has to outlive the struct.
 
-   @param buf 	buffer containing the string representation of struct
+   @param dns_message 	struct to be filled with deserialized information
+   @param buf 	buffer containing the wire format
+   @param len 	number of bytes in buf
 
-   @return struct pointer to be filled with deserialized information, NULL
-   if unsuccessful
+   @return 0 on success, -1 if the message is malformed or truncated
 */
-struct dns_t *deserialize_dns(uint8_t *buf);
+int deserialize_dns(struct dns_t *dns_message, const uint8_t *buf,
+                    size_t len);
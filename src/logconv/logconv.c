@@ -0,0 +1,236 @@
+/*
+  Converter of binary activity logs back to text
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "logconv.h"
+#include "../common/actlog.h"
+
+#define DEFAULT_CAP 64
+#define CHUNK_NAME_SIZE 64
+#define UNKNOWN_NAME "?" /* a name id the log never named */
+
+/* A name of the log, pointing into it */
+struct name_t {
+	const char *name;
+	size_t len;
+};
+
+/**
+   Collect the names of the count records of the log data into *names,
+   indexed by their ids.
+
+   @return 0 on success, 1 otherwise
+*/
+static int readNames(const uint8_t *data, size_t count, struct name_t **names,
+		     size_t *namesCount);
+
+/**
+   Write the text line of the chunk or query record to out, skipping any
+   other record.
+
+   @return the number of records the record spans
+*/
+static size_t convertRecord(const uint8_t *record, const struct name_t *names,
+			    size_t namesCount, FILE *out);
+
+/**
+   Format name id into buf of size len.
+*/
+static const char *nameOf(const struct name_t *names, size_t namesCount,
+			  uint32_t id, char *buf, size_t len);
+
+int main(int argc, char **argv)
+{
+	FILE *out;
+	int ret;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <binary log> [<text log>]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	out = stdout;
+	if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+		perror("fopen");
+		return EXIT_FAILURE;
+	}
+
+	ret = convertLog(argv[1], out);
+
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(out);
+
+	return ret;
+}
+
+int convertLog(const char *path, FILE *out)
+{
+	struct actlog_header_t header;
+	struct name_t *names = NULL;
+	struct stat st;
+	uint8_t *data;
+	size_t count, namesCount, i;
+	int fd, ret;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		perror("open");
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if ((size_t) st.st_size < ACTLOG_RECORD) {
+		fprintf(stderr, "%s is not a binary activity log\n", path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	/* a record cut short by a crash is left out */
+	count = st.st_size / ACTLOG_RECORD;
+
+	memcpy(&header, data, sizeof(header));
+	if (header.type != ACTLOG_HEADER ||
+	    memcmp(header.magic, ACTLOG_MAGIC, sizeof(header.magic))) {
+		fprintf(stderr, "%s is not a binary activity log\n", path);
+		ret = EXIT_FAILURE;
+	} else if (header.order != ACTLOG_ORDER ||
+		   header.version != ACTLOG_VERSION) {
+		fprintf(stderr, "%s was written with another byte order or "
+			"version\n", path);
+		ret = EXIT_FAILURE;
+	} else {
+		/* names may come after the records that use them */
+		ret = readNames(data, count, &names, &namesCount);
+		for (i = 1; !ret && i < count;)
+			i += convertRecord(data + i * ACTLOG_RECORD, names,
+					   namesCount, out);
+	}
+
+	free(names);
+	munmap(data, st.st_size);
+	return ret;
+}
+
+static int readNames(const uint8_t *data, size_t count, struct name_t **names,
+		     size_t *namesCount)
+{
+	struct actlog_name_t record;
+	struct name_t *tmp;
+	size_t i, cap, newCap, spans;
+
+	*names = NULL;
+	*namesCount = cap = 0;
+	for (i = 1; i < count; i += spans) {
+		memcpy(&record, data + i * ACTLOG_RECORD, sizeof(record));
+		spans = 1;
+		if (record.type != ACTLOG_NAME)
+			continue;
+
+		spans += (record.len + ACTLOG_RECORD - 1) / ACTLOG_RECORD;
+		if (i + spans > count)
+			break;
+
+		if (record.id >= cap) {
+			for (newCap = cap ? cap : DEFAULT_CAP;
+			     newCap <= record.id; newCap *= 2)
+				;
+			if (!(tmp = realloc(*names,
+					    newCap * sizeof(*tmp)))) {
+				fprintf(stderr, "failed to grow names\n");
+				return EXIT_FAILURE;
+			}
+			memset(tmp + cap, 0, (newCap - cap) * sizeof(*tmp));
+			*names = tmp;
+			cap = newCap;
+		}
+
+		(*names)[record.id].name = (const char *) data +
+			(i + 1) * ACTLOG_RECORD;
+		(*names)[record.id].len = record.len;
+		if (record.id >= *namesCount)
+			*namesCount = record.id + 1;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static size_t convertRecord(const uint8_t *record, const struct name_t *names,
+			    size_t namesCount, FILE *out)
+{
+	struct actlog_chunk_t chunk;
+	struct actlog_query_t query;
+	struct actlog_name_t name;
+	char server[ACTLOG_NAME_MAX + 1], zone[ACTLOG_NAME_MAX + 1];
+	char client[INET6_ADDRSTRLEN], chunkName[CHUNK_NAME_SIZE];
+	float duration;
+
+	switch (((const struct actlog_name_t *) record)->type) {
+	case ACTLOG_CHUNK:
+		memcpy(&chunk, record, sizeof(chunk));
+
+		/* as the proxy formats the line, see parse_response */
+		duration = chunk.duration / 1000000.0;
+		snprintf(chunkName, sizeof(chunkName), "%dSeg%d-Frag%d",
+			 chunk.bitrate, chunk.seg, chunk.frag);
+		fprintf(out, LOG_FMT, (unsigned long) (chunk.time / 1000000),
+			duration, chunk.tput, chunk.avgTput, chunk.bitrate,
+			nameOf(names, namesCount, chunk.server, server,
+			       sizeof(server)),
+			chunkName);
+		return 1;
+	case ACTLOG_QUERY:
+		memcpy(&query, record, sizeof(query));
+
+		/* as the nameserver formats the line, see processQuery */
+		if (!inet_ntop(query.family, query.client, client,
+			       sizeof(client)))
+			client[0] = '\0';
+		fprintf(out, ACTIVITY_FMT, query.time / 1000000.0, client,
+			nameOf(names, namesCount, query.zone, zone,
+			       sizeof(zone)),
+			nameOf(names, namesCount, query.server, server,
+			       sizeof(server)));
+		return 1;
+	case ACTLOG_NAME:
+		memcpy(&name, record, sizeof(name));
+		return 1 + (name.len + ACTLOG_RECORD - 1) / ACTLOG_RECORD;
+	default: /* a header of a rotated file, or unknown */
+		return 1;
+	}
+}
+
+static const char *nameOf(const struct name_t *names, size_t namesCount,
+			  uint32_t id, char *buf, size_t len)
+{
+	if (id >= namesCount || !names[id].name)
+		snprintf(buf, len, "%s", UNKNOWN_NAME);
+	else
+		snprintf(buf, len, "%.*s", (int) names[id].len,
+			 names[id].name);
+
+	return buf;
+}
@@ -0,0 +1,21 @@
+#pragma once
+/*
+  Converter of binary activity logs back to text.
+
+  ./logconv <binary log> [<text log>]
+
+  Every record of the binary log of the proxy or the nameserver, see actlog.h,
+  is written as the activity line it would have logged as text, to the text
+  log or to the standard output.  The log must have been written on a machine
+  with the same byte order.
+*/
+
+#include <stdio.h>
+
+/**
+   Write the records of the binary activity log at path as text lines to out.
+
+   @return 0 on success, 1 if the log can not be read or is not a binary
+   activity log
+*/
+int convertLog(const char *path, FILE *out);
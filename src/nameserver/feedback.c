@@ -0,0 +1,247 @@
+/*
+  Functions to record the throughput reports of the proxies and rank servers
+  by them
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <netinet/in.h>
+
+#include "feedback.h"
+#include "servers.h"
+#include "../common/hashtable.h"
+#include "../common/log.h"
+#include "../common/mytime.h"
+
+/**
+   Point *addr at the IP address of the socket address sa, of *len bytes.
+
+   @return 1 on success, 0 if the address family is unknown
+*/
+static int proxyAddr(const struct sockaddr *sa, const uint8_t **addr,
+		     uint8_t *len);
+
+/**
+   Find the entry of the proxy with address addr of len bytes in the table,
+   or the free entry it would take.
+
+   @return the entry, NULL if the proxy is not there and the table is full
+*/
+static struct proxy_feedback_t *findProxy(struct proxy_feedback_t *table,
+					  const uint8_t *addr, uint8_t len);
+
+/**
+   Find the throughput of the path to server at time now.
+
+   @return the throughput, 0 if there is no valid report
+*/
+static uint64_t pathThroughput(const struct proxy_feedback_t *proxy,
+			       size_t server, mytime_t now);
+
+int feedbackInit(struct dns_config_t *config)
+{
+	size_t i;
+
+	if (!(config->feedback = calloc(FEEDBACK_PROXIES,
+					sizeof(*(config->feedback))))) {
+		log(DEFAULT_LOG, "failed to calloc proxy feedback.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < FEEDBACK_PROXIES; i++)
+		atomic_init(&(config->feedback[i].used), 0);
+
+	return EXIT_SUCCESS;
+}
+
+int dns_ReportFeedback(struct dns_config_t *config,
+		       const struct sockaddr *proxy, char *line)
+{
+	struct proxy_feedback_t *entry;
+	struct path_feedback_t *path;
+	const uint8_t *addr;
+	char *ip, *kbps, *end, *save;
+	unsigned long n;
+	uint64_t blended, old;
+	mytime_t now, time, age;
+	uint8_t len;
+	long server;
+	size_t i;
+
+	ip = strtok_r(line, " \t\r\n", &save);
+	kbps = strtok_r(NULL, " \t\r\n", &save);
+	if (!ip || !kbps) {
+		log(DEFAULT_LOG, "improper feedback report.\n");
+		return EXIT_FAILURE;
+	}
+
+	errno = 0;
+	n = strtoul(kbps, &end, 10);
+	if (errno || *end || end == kbps || n > UINT32_MAX) {
+		log(DEFAULT_LOG, "improper feedback report.\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((server = findServer(config, ip)) == -1) {
+		log(DEFAULT_LOG, "feedback on unknown server %s\n", ip);
+		return EXIT_FAILURE;
+	}
+
+	if (!proxyAddr(proxy, &addr, &len) ||
+	    !(entry = findProxy(config->feedback, addr, len))) {
+		log(DEFAULT_LOG, "no room for feedback of another proxy.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* a new proxy is published once its paths are all there */
+	if (!atomic_load(&(entry->used))) {
+		entry->paths = calloc(config->serversCount,
+				      sizeof(*(entry->paths)));
+		if (!entry->paths) {
+			log(DEFAULT_LOG, "failed to calloc proxy paths.\n");
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < config->serversCount; i++) {
+			atomic_init(&(entry->paths[i].kbps), 0);
+			atomic_init(&(entry->paths[i].time), 0);
+		}
+		memcpy(entry->addr, addr, len);
+		entry->addrLen = len;
+		atomic_store(&(entry->used), 1);
+	}
+
+	/* the previous report weighs half as much as the new one when it
+	   just came, and nothing once it expires */
+	path = &(entry->paths[server]);
+	now = microtime(NULL);
+	time = atomic_load(&(path->time));
+	age = now > time ? now - time : 0;
+	blended = n;
+	if (time && age < FEEDBACK_TTL) {
+		old = atomic_load(&(path->kbps));
+		blended = (n * (FEEDBACK_TTL + age) +
+			   old * (FEEDBACK_TTL - age)) / (2 * FEEDBACK_TTL);
+	}
+
+	atomic_store(&(path->kbps), blended);
+	atomic_store(&(path->time), now);
+
+	log(DEFAULT_LOG, "feedback %s %lu kbps, %" PRIu64 " blended\n", ip, n,
+	    blended);
+	return EXIT_SUCCESS;
+}
+
+void rankByFeedback(const struct dns_config_t *config,
+		    const struct sockaddr *client, size_t *servers,
+		    const uint32_t *dists, size_t count)
+{
+	struct proxy_feedback_t *entry;
+	uint64_t tputs[DNS_MAX_ANSWERS], best;
+	double costs[DNS_MAX_ANSWERS], cost;
+	const uint8_t *addr;
+	size_t i, j, server;
+	mytime_t now;
+	uint8_t len;
+
+	if (!config->feedback || count < 2 || count > DNS_MAX_ANSWERS ||
+	    !proxyAddr(client, &addr, &len))
+		return;
+
+	entry = findProxy(config->feedback, addr, len);
+	if (!entry || !atomic_load(&(entry->used)))
+		return;
+
+	now = microtime(NULL);
+	for (i = 0, best = 0; i < count; i++) {
+		tputs[i] = pathThroughput(entry, servers[i], now);
+		if (tputs[i] > best)
+			best = tputs[i];
+	}
+
+	if (!best)
+		return;
+
+	/* the path cost, longer by as many times as the path is slower than
+	   the fastest one, in a stable insertion sort */
+	for (i = 0; i < count; i++) {
+		server = servers[i];
+		cost = (double) dists[i] + 1;
+		if (tputs[i])
+			cost *= (double) best / tputs[i];
+
+		for (j = i; j > 0 && costs[j - 1] > cost; j--) {
+			costs[j] = costs[j - 1];
+			servers[j] = servers[j - 1];
+		}
+		costs[j] = cost;
+		servers[j] = server;
+	}
+}
+
+void freeFeedback(struct dns_config_t *config)
+{
+	size_t i;
+
+	if (!config->feedback)
+		return;
+
+	for (i = 0; i < FEEDBACK_PROXIES; i++)
+		free(config->feedback[i].paths);
+
+	free(config->feedback);
+	config->feedback = NULL;
+}
+
+static int proxyAddr(const struct sockaddr *sa, const uint8_t **addr,
+		     uint8_t *len)
+{
+	const struct sockaddr_in *v4 = (const struct sockaddr_in *) sa;
+	const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) sa;
+
+	if (sa->sa_family == AF_INET) {
+		*addr = (const uint8_t *) &(v4->sin_addr);
+		*len = sizeof(v4->sin_addr);
+	} else if (sa->sa_family == AF_INET6) {
+		*addr = (const uint8_t *) &(v6->sin6_addr);
+		*len = sizeof(v6->sin6_addr);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+static struct proxy_feedback_t *findProxy(struct proxy_feedback_t *table,
+					  const uint8_t *addr, uint8_t len)
+{
+	struct proxy_feedback_t *entry;
+	size_t first, i;
+
+	/* linear probing, entries are never removed */
+	first = ht_hash(addr, len) % FEEDBACK_PROXIES;
+	for (i = 0; i < FEEDBACK_PROXIES; i++) {
+		entry = &(table[(first + i) % FEEDBACK_PROXIES]);
+		if (!atomic_load(&(entry->used)))
+			return entry;
+
+		if (entry->addrLen == len && !memcmp(entry->addr, addr, len))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static uint64_t pathThroughput(const struct proxy_feedback_t *proxy,
+			       size_t server, mytime_t now)
+{
+	mytime_t time;
+
+	time = atomic_load(&(proxy->paths[server].time));
+	if (!time || (now > time && now - time > FEEDBACK_TTL))
+		return 0;
+
+	return atomic_load(&(proxy->paths[server].kbps));
+}
@@ -0,0 +1,55 @@
+#pragma once
+/*
+  Throughput reports of the proxies.
+
+  Proxies push "<server ip> <kbps>" lines to the feedback port, the throughput
+  they measured from every video server.  A proxy is known by the address it
+  reports from, the one it resolves from, so the ranking of the servers it is
+  given follows the paths it actually sees: among the closest servers, the
+  cost of a measured one is its path cost scaled by how much slower it is
+  than the fastest measured one.
+
+  A report is blended with the previous one of the path, the more so the
+  fresher that one is, and no longer counts after FEEDBACK_TTL.  The table of
+  proxies is written by the control thread only and read by queries without
+  locking.
+*/
+
+#include <sys/socket.h>
+
+#include "nameserver.h"
+
+#define FEEDBACK_PROXIES 256 /* proxies whose reports are kept */
+#define FEEDBACK_TTL 30000000 /* microseconds a report stays valid */
+
+/**
+   Set up the empty table of proxies of config.
+
+   @return 0 on success, 1 otherwise
+*/
+int feedbackInit(struct dns_config_t *config);
+
+/**
+   Record the throughput report line "<ip> <kbps>" of the proxy at address
+   proxy.  line is tokenized in place.
+
+   @return 0 on success, 1 if the line is malformed, the server unknown or
+   the table of proxies full
+*/
+int dns_ReportFeedback(struct dns_config_t *config,
+		       const struct sockaddr *proxy, char *line);
+
+/**
+   Rank the count servers, closest first at the path costs dists, by the
+   throughput reports of client.  Servers without a valid report keep their
+   path cost, so they are still tried.  Does nothing if client reported
+   nothing.
+*/
+void rankByFeedback(const struct dns_config_t *config,
+		    const struct sockaddr *client, size_t *servers,
+		    const uint32_t *dists, size_t count);
+
+/**
+   Free the table of proxies of config.
+*/
+void freeFeedback(struct dns_config_t *config);
@@ -4,119 +4,605 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "graph.h"
 #include "../common/log.h"
 
-#define DEFAULT_NEIGHBORS 4
+#define DEFAULT_VERTICES 64
+
+/* A link out of a vertex, while sorting the neighbors */
+struct arc_t {
+	uint32_t target;
+	uint32_t weight;
+};
+
+/**
+   Grow the array *arr of *cap elements of size size so it holds at least
+   need elements.
+
+   @return 0 on success, 1 otherwise
+*/
+static int reserve(void **arr, size_t *cap, size_t need, size_t size);
 
 /**
-   Add neighbor to node.  This is not a symmetical operation. (i.e. node does
-   not become neighbor of neighbor.)
+   Grow the row so that it holds at least need neighbors.
 
-   @param node the node that's getting a new neighbor
-   @param neighbor the node that's becoming a new neighbor
    @return 0 on success, 1 otherwise
 */
+static int reserveRow(struct graph_row_t *row, size_t need);
+
+/**
+   Return the overlay row of vertex v, starting it as a copy of the
+   neighbors v has so far.
+
+   @return the row, NULL on failure
+*/
+static struct graph_row_t *overlayRow(struct graph_t *graph, uint32_t v);
 
-static int addNeighbor(struct graph_node_t *node, struct graph_node_t *neighbor);
+/**
+   Link vertex v into the row of vertex w at the cost weight, or unlink it
+   if weight is 0.
+
+   @return 0 on success, 1 otherwise
+*/
+static int relink(struct graph_t *graph, uint32_t w, uint32_t v,
+		  uint32_t weight);
 
 /**
-   Find whether or not neighbor is in node's neighbors list.  The comparison is
-   done by comparing the pointers, not the neighbors' ids.
+   Drop the graph's hold on its CSR arrays, freeing them if it was the last
+   holder.
+*/
+static void releaseAdjacency(struct graph_t *graph);
 
-   @param node the node whose list of neighbors will be checked
-   @param neighbor the neighbor node
-   @return 1 if n2 is a neighbor of n1, 0 otherwise
+/**
+   Drop the graph's hold on its vertex ids, freeing them if it was the last
+   holder.
 */
-static int isNeighbor(struct graph_node_t *node, struct graph_node_t *neighbor);
+static void releaseIds(struct graph_t *graph);
 
 /**
-   Given a graph node, prints a list of its neighbors, separated by spaces.
+   Give the graph vertex ids of its own, so that they can be changed.
 
-   @param node the graph node whose neighbors will be printed.
+   @return 0 on success, 1 otherwise
+*/
+static int ownIds(struct graph_t *graph);
+
+/**
+   Compare two links by target and then by cost.
 */
-static void printNeighbors(struct graph_node_t *node);
+static int cmpArc(const void *a, const void *b);
 
-struct graph_node_t *newGraphNode(char *id)
+int graphInit(struct graph_t *graph, size_t hint)
 {
-	struct graph_node_t *node;
+	memset(graph, 0, sizeof(*graph));
 
-	if (!(node = calloc(1, sizeof(*node)))) {
-		log(DEFAULT_LOG, "failed to calloc memory for graph node.\n");
-		return NULL;
+	if (ht_init(&(graph->ids), hint ? hint : DEFAULT_VERTICES)) {
+		log(DEFAULT_LOG, "failed to init vertex ids.\n");
+		return EXIT_FAILURE;
 	}
 
-	if (!(node->id = strdup(id))) {
-		log(DEFAULT_LOG, "strdup failed.\n");
-		free(node);
-		return NULL;
+	return EXIT_SUCCESS;
+}
+
+int shareGraph(struct graph_t *dst, struct graph_t *src)
+{
+	if (compactGraph(src))
+		return EXIT_FAILURE;
+
+	if ((!src->adjacencyRefs &&
+	     !(src->adjacencyRefs = calloc(1, sizeof(size_t)))) ||
+	    (!src->idsRefs && !(src->idsRefs = calloc(1, sizeof(size_t))))) {
+		log(DEFAULT_LOG, "failed to share graph.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* a fresh count stands for src alone */
+	if (!*(src->adjacencyRefs))
+		*(src->adjacencyRefs) = 1;
+	if (!*(src->idsRefs))
+		*(src->idsRefs) = 1;
+
+	memset(dst, 0, sizeof(*dst));
+	dst->vertexCount = dst->vertexCap = src->vertexCount;
+	dst->edgeCount = src->edgeCount;
+	dst->ids = src->ids;
+	dst->names = src->names;
+	dst->namesLen = dst->namesCap = src->namesLen;
+	dst->nameOffsets = src->nameOffsets;
+	dst->offsets = src->offsets;
+	dst->targets = src->targets;
+	dst->weights = src->weights;
+	dst->rows = src->rows;
+
+	dst->adjacencyRefs = src->adjacencyRefs;
+	dst->idsRefs = src->idsRefs;
+	(*(src->adjacencyRefs))++;
+	(*(src->idsRefs))++;
+
+	return EXIT_SUCCESS;
+}
+
+void freeGraph(struct graph_t *graph)
+{
+	size_t i;
+
+	releaseIds(graph);
+	releaseAdjacency(graph);
+	free(graph->pending);
+
+	for (i = 0; i < graph->overlayCap; i++) {
+		free(graph->overlay[i].targets);
+		free(graph->overlay[i].weights);
+	}
+	free(graph->overlay);
+	free(graph->overlayIndex);
+	memset(graph, 0, sizeof(*graph));
+}
+
+long internVertex(struct graph_t *graph, const char *id, size_t len)
+{
+	void **slot;
+	int created;
+
+	/* a snapshot may be reading the ids */
+	if (graph->idsRefs && !ht_find(&(graph->ids), id, len) &&
+	    ownIds(graph))
+		return -1;
+
+	if (!(slot = ht_insert(&(graph->ids), id, len, &created))) {
+		log(DEFAULT_LOG, "failed to insert vertex id.\n");
+		return -1;
+	}
+
+	if (!created)
+		return (uintptr_t) *slot;
+
+	if (reserve((void **) &(graph->nameOffsets), &(graph->vertexCap),
+		    graph->vertexCount + 1, sizeof(size_t)) ||
+	    reserve((void **) &(graph->names), &(graph->namesCap),
+		    graph->namesLen + len + 1, sizeof(char))) {
+		log(DEFAULT_LOG, "failed to grow vertex names.\n");
+		return -1;
 	}
 
-	return node;
+	graph->nameOffsets[graph->vertexCount] = graph->namesLen;
+	memcpy(graph->names + graph->namesLen, id, len);
+	graph->names[graph->namesLen + len] = '\0';
+	graph->namesLen += len + 1;
+
+	*slot = (void *) (uintptr_t) graph->vertexCount;
+	return graph->vertexCount++;
+}
+
+long findVertex(const struct graph_t *graph, const char *id)
+{
+	void **slot;
+
+	if (!(slot = ht_find(&(graph->ids), id, strlen(id))))
+		return -1;
+
+	return (uintptr_t) *slot;
+}
+
+const char *vertexName(const struct graph_t *graph, uint32_t v)
+{
+	return graph->names + graph->nameOffsets[v];
 }
 
-int addEdge(struct graph_node_t *n1, struct graph_node_t *n2)
+int addEdge(struct graph_t *graph, uint32_t v1, uint32_t v2, uint32_t weight)
 {
-	if (!n1 || !n2)
+	if (v1 == v2)
+		return EXIT_SUCCESS;
+
+	if (reserve((void **) &(graph->pending), &(graph->pendingCap),
+		    graph->pendingCount + 6, sizeof(uint32_t))) {
+		log(DEFAULT_LOG, "failed to grow edge list.\n");
 		return EXIT_FAILURE;
+	}
+
+	/* store both directions, so each vertex sees the other as neighbor */
+	graph->pending[graph->pendingCount++] = v1;
+	graph->pending[graph->pendingCount++] = v2;
+	graph->pending[graph->pendingCount++] = weight;
+	graph->pending[graph->pendingCount++] = v2;
+	graph->pending[graph->pendingCount++] = v1;
+	graph->pending[graph->pendingCount++] = weight;
 
-	return addNeighbor(n1, n2) || addNeighbor(n2, n1);
+	return EXIT_SUCCESS;
 }
 
-int edgeExists(struct graph_node_t *n1, struct graph_node_t *n2)
+int buildAdjacency(struct graph_t *graph)
 {
-	return isNeighbor(n1, n2) &&
-		isNeighbor(n2, n1);
+	uint32_t *offsets, *targets, *weights, *fill;
+	struct arc_t *arcs;
+	size_t i, edges, v, out, start, end;
+
+	edges = graph->pendingCount / 3;
+	offsets = calloc(graph->vertexCount + 1, sizeof(uint32_t));
+	arcs = calloc(edges ? edges : 1, sizeof(*arcs));
+	targets = calloc(edges ? edges : 1, sizeof(uint32_t));
+	weights = calloc(edges ? edges : 1, sizeof(uint32_t));
+	fill = calloc(graph->vertexCount + 1, sizeof(uint32_t));
+	if (!offsets || !arcs || !targets || !weights || !fill) {
+		log(DEFAULT_LOG, "failed to calloc adjacency.\n");
+		free(offsets);
+		free(arcs);
+		free(targets);
+		free(weights);
+		free(fill);
+		return EXIT_FAILURE;
+	}
+
+	/* counting sort of the edges by source vertex */
+	for (i = 0; i < graph->pendingCount; i += 3)
+		offsets[graph->pending[i] + 1]++;
+
+	for (v = 0; v < graph->vertexCount; v++)
+		offsets[v + 1] += offsets[v];
+
+	for (i = 0; i < graph->pendingCount; i += 3) {
+		v = graph->pending[i];
+		arcs[offsets[v] + fill[v]].target = graph->pending[i + 1];
+		arcs[offsets[v] + fill[v]++].weight = graph->pending[i + 2];
+	}
+
+	/* sort every neighbor list and squeeze out duplicate edges, the
+	   cheapest of them sorts first and is kept */
+	out = 0;
+	for (v = 0; v < graph->vertexCount; v++) {
+		start = offsets[v];
+		end = offsets[v + 1];
+		qsort(arcs + start, end - start, sizeof(*arcs), cmpArc);
+
+		offsets[v] = out;
+		for (i = start; i < end; i++) {
+			if (i == start || arcs[i].target != arcs[i - 1].target) {
+				targets[out] = arcs[i].target;
+				weights[out++] = arcs[i].weight;
+			}
+		}
+	}
+	offsets[graph->vertexCount] = out;
+
+	free(fill);
+	free(arcs);
+	releaseAdjacency(graph);
+	free(graph->pending);
+
+	graph->offsets = offsets;
+	graph->targets = targets;
+	graph->weights = weights;
+	graph->edgeCount = out;
+	graph->rows = graph->vertexCount;
+	graph->pending = NULL;
+	graph->pendingCount = graph->pendingCap = 0;
+
+	return EXIT_SUCCESS;
 }
 
-int cmpGraphById(const void *this, const void *id)
+int setNeighbors(struct graph_t *graph, uint32_t v, const uint32_t *neighbors,
+		 const uint32_t *weights, size_t count)
 {
-	struct graph_node_t *node = (struct graph_node_t *) this;
-	return strcmp(node->id, id);
+	const uint32_t *old, *oldWeights;
+	struct graph_row_t *row;
+	size_t oldCount, i, j;
+	int ret;
+
+	oldCount = getNeighbors(graph, v, &old, &oldWeights);
+
+	/* merge the old and new sorted neighbor lists to find the vertices
+	   whose link to v appears, disappears or changes cost, and relink v
+	   in their rows.  Those rows are not the row of v, so old stays */
+	ret = EXIT_SUCCESS;
+	for (i = j = 0; !ret && (i < oldCount || j < count);) {
+		if (j == count || (i < oldCount && old[i] < neighbors[j])) {
+			ret = relink(graph, old[i++], v, 0);
+		} else if (i == oldCount || neighbors[j] < old[i]) {
+			ret = relink(graph, neighbors[j], v, weights[j]);
+			j++;
+		} else {
+			if (oldWeights[i] != weights[j])
+				ret = relink(graph, neighbors[j], v,
+					     weights[j]);
+			i++;
+			j++;
+		}
+	}
+
+	if (ret || !(row = overlayRow(graph, v)) || reserveRow(row, count)) {
+		log(DEFAULT_LOG, "failed to grow overlay.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (count) {
+		memcpy(row->targets, neighbors, count * sizeof(uint32_t));
+		memcpy(row->weights, weights, count * sizeof(uint32_t));
+	}
+	graph->edgeCount = graph->edgeCount - row->count + count;
+	row->count = count;
+
+	return EXIT_SUCCESS;
 }
 
-int cmpGraphByNode(const void *this, const void *that)
+int compactGraph(struct graph_t *graph)
 {
-	return this != that;
+	const uint32_t *neighbors, *weights;
+	uint32_t *offsets, *targets, *newWeights;
+	size_t v, i, count, out;
+
+	if (!graph->overlayCount && graph->rows == graph->vertexCount)
+		return EXIT_SUCCESS;
+
+	offsets = malloc((graph->vertexCount + 1) * sizeof(uint32_t));
+	targets = malloc((graph->edgeCount + 1) * sizeof(uint32_t));
+	newWeights = malloc((graph->edgeCount + 1) * sizeof(uint32_t));
+	if (!offsets || !targets || !newWeights) {
+		log(DEFAULT_LOG, "failed to malloc adjacency.\n");
+		free(offsets);
+		free(targets);
+		free(newWeights);
+		return EXIT_FAILURE;
+	}
+
+	out = 0;
+	for (v = 0; v < graph->vertexCount; v++) {
+		offsets[v] = out;
+		count = getNeighbors(graph, v, &neighbors, &weights);
+		if (count) {
+			memcpy(targets + out, neighbors,
+			       count * sizeof(uint32_t));
+			memcpy(newWeights + out, weights,
+			       count * sizeof(uint32_t));
+		}
+		out += count;
+	}
+	offsets[graph->vertexCount] = out;
+
+	for (i = 0; i < graph->overlayCount; i++)
+		graph->overlayIndex[graph->overlay[i].vertex] = 0;
+	graph->overlayCount = 0;
+
+	releaseAdjacency(graph);
+	graph->offsets = offsets;
+	graph->targets = targets;
+	graph->weights = newWeights;
+	graph->edgeCount = out;
+	graph->rows = graph->vertexCount;
+
+	return EXIT_SUCCESS;
 }
 
-void printGraph(struct graph_node_t *node)
+size_t getNeighbors(const struct graph_t *graph, uint32_t v,
+		    const uint32_t **neighbors, const uint32_t **weights)
 {
-	if (!node)
-		return;
+	const struct graph_row_t *row;
 
-	log_activity(DEFAULT_LOG, "node: %s -> ", node->id);
-	printNeighbors(node);
-	log_activity(DEFAULT_LOG, "\n");
+	if (v < graph->indexCap && graph->overlayIndex[v]) {
+		row = &(graph->overlay[graph->overlayIndex[v] - 1]);
+		*neighbors = row->targets;
+		if (weights)
+			*weights = row->weights;
+		return row->count;
+	}
+
+	if (v >= graph->rows) {
+		*neighbors = NULL;
+		if (weights)
+			*weights = NULL;
+		return 0;
+	}
+
+	*neighbors = graph->targets + graph->offsets[v];
+	if (weights)
+		*weights = graph->weights + graph->offsets[v];
+	return graph->offsets[v + 1] - graph->offsets[v];
 }
 
-static void printNeighbors(struct graph_node_t *node)
+void printGraph(const struct graph_t *graph)
 {
-	Node *tmp;
-	struct graph_node_t *n;
+	const uint32_t *neighbors, *weights;
+	size_t v, e, count;
+
+	for (v = 0; v < graph->vertexCount; v++) {
+		log_activity(DEFAULT_LOG, "node: %s -> ", vertexName(graph, v));
+
+		count = getNeighbors(graph, v, &neighbors, &weights);
+		for (e = 0; e < count; e++)
+			log_activity(DEFAULT_LOG, "%s:%u ",
+				     vertexName(graph, neighbors[e]),
+				     weights[e]);
 
-	for (tmp = node->neighbors; tmp; tmp = tmp->next) {
-		n = tmp->data;
-		log_activity(DEFAULT_LOG, "%s ", n->id);
+		log_activity(DEFAULT_LOG, "\n");
 	}
 }
 
-static int isNeighbor(struct graph_node_t *node, struct graph_node_t *neighbor)
+static int reserve(void **arr, size_t *cap, size_t need, size_t size)
+{
+	size_t newCap;
+	void *tmp;
+
+	if (need <= *cap)
+		return EXIT_SUCCESS;
+
+	newCap = *cap ? *cap : DEFAULT_VERTICES;
+	while (newCap < need)
+		newCap *= 2;
+
+	if (!(tmp = realloc(*arr, newCap * size)))
+		return EXIT_FAILURE;
+
+	*arr = tmp;
+	*cap = newCap;
+	return EXIT_SUCCESS;
+}
+
+static int reserveRow(struct graph_row_t *row, size_t need)
+{
+	size_t targetsCap = row->cap, weightsCap = row->cap;
+
+	if (reserve((void **) &(row->targets), &targetsCap, need,
+		    sizeof(uint32_t)) ||
+	    reserve((void **) &(row->weights), &weightsCap, need,
+		    sizeof(uint32_t)))
+		return EXIT_FAILURE;
+
+	row->cap = targetsCap;
+	return EXIT_SUCCESS;
+}
+
+static struct graph_row_t *overlayRow(struct graph_t *graph, uint32_t v)
 {
-	if (node_find(node->neighbors, cmpGraphByNode, neighbor)) {
-		return 1;
+	const uint32_t *neighbors, *weights;
+	struct graph_row_t *row;
+	size_t count, cap;
+
+	if (v < graph->indexCap && graph->overlayIndex[v])
+		return &(graph->overlay[graph->overlayIndex[v] - 1]);
+
+	cap = graph->indexCap;
+	if (reserve((void **) &(graph->overlayIndex), &(graph->indexCap),
+		    v + 1, sizeof(uint32_t)))
+		return NULL;
+	memset(graph->overlayIndex + cap, 0,
+	       (graph->indexCap - cap) * sizeof(uint32_t));
+
+	/* rows past the count keep the buffers of compacted rows */
+	cap = graph->overlayCap;
+	if (reserve((void **) &(graph->overlay), &(graph->overlayCap),
+		    graph->overlayCount + 1, sizeof(*(graph->overlay))))
+		return NULL;
+	memset(graph->overlay + cap, 0,
+	       (graph->overlayCap - cap) * sizeof(*(graph->overlay)));
+
+	row = &(graph->overlay[graph->overlayCount]);
+	count = getNeighbors(graph, v, &neighbors, &weights);
+	if (reserveRow(row, count))
+		return NULL;
+
+	if (count) {
+		memcpy(row->targets, neighbors, count * sizeof(uint32_t));
+		memcpy(row->weights, weights, count * sizeof(uint32_t));
 	}
+	row->vertex = v;
+	row->count = count;
 
-	return 0;
+	graph->overlayIndex[v] = ++(graph->overlayCount);
+	return row;
 }
 
-static int addNeighbor(struct graph_node_t *node, struct graph_node_t *neighbor)
+static int relink(struct graph_t *graph, uint32_t w, uint32_t v,
+		  uint32_t weight)
 {
-	if (!node_insert(&(node->neighbors), neighbor)) {
-		log(DEFAULT_LOG, "failed to insert into neighbors.\n");
+	struct graph_row_t *row;
+	size_t at;
+
+	if (!(row = overlayRow(graph, w)) || reserveRow(row, row->count + 1))
 		return EXIT_FAILURE;
+
+	for (at = 0; at < row->count && row->targets[at] < v; at++)
+		;
+
+	if (at < row->count && row->targets[at] == v) {
+		if (weight) {
+			row->weights[at] = weight;
+			return EXIT_SUCCESS;
+		}
+
+		memmove(row->targets + at, row->targets + at + 1,
+			(row->count - at - 1) * sizeof(uint32_t));
+		memmove(row->weights + at, row->weights + at + 1,
+			(row->count - at - 1) * sizeof(uint32_t));
+		row->count--;
+		graph->edgeCount--;
+	} else if (weight) {
+		memmove(row->targets + at + 1, row->targets + at,
+			(row->count - at) * sizeof(uint32_t));
+		memmove(row->weights + at + 1, row->weights + at,
+			(row->count - at) * sizeof(uint32_t));
+		row->targets[at] = v;
+		row->weights[at] = weight;
+		row->count++;
+		graph->edgeCount++;
 	}
 
 	return EXIT_SUCCESS;
 }
+
+static void releaseAdjacency(struct graph_t *graph)
+{
+	if (!graph->adjacencyRefs || !--*(graph->adjacencyRefs)) {
+		free(graph->offsets);
+		free(graph->targets);
+		free(graph->weights);
+		free(graph->adjacencyRefs);
+	}
+
+	graph->offsets = graph->targets = graph->weights = NULL;
+	graph->adjacencyRefs = NULL;
+}
+
+static void releaseIds(struct graph_t *graph)
+{
+	if (!graph->idsRefs || !--*(graph->idsRefs)) {
+		ht_free(&(graph->ids));
+		free(graph->names);
+		free(graph->nameOffsets);
+		free(graph->idsRefs);
+	}
+
+	memset(&(graph->ids), 0, sizeof(graph->ids));
+	graph->names = NULL;
+	graph->nameOffsets = NULL;
+	graph->idsRefs = NULL;
+}
+
+static int ownIds(struct graph_t *graph)
+{
+	struct hashtable_t ids;
+	size_t *nameOffsets;
+	char *names;
+
+	if (!graph->idsRefs)
+		return EXIT_SUCCESS;
+
+	if (*(graph->idsRefs) > 1) {
+		names = malloc(graph->namesLen + 1);
+		nameOffsets = malloc((graph->vertexCount + 1) *
+				     sizeof(size_t));
+		if (!names || !nameOffsets || ht_clone(&ids, &(graph->ids))) {
+			log(DEFAULT_LOG, "failed to copy vertex ids.\n");
+			free(names);
+			free(nameOffsets);
+			return EXIT_FAILURE;
+		}
+
+		memcpy(names, graph->names, graph->namesLen);
+		memcpy(nameOffsets, graph->nameOffsets,
+		       graph->vertexCount * sizeof(size_t));
+
+		/* the others keep the old ones */
+		(*(graph->idsRefs))--;
+		graph->ids = ids;
+		graph->names = names;
+		graph->nameOffsets = nameOffsets;
+		graph->namesCap = graph->namesLen + 1;
+		graph->vertexCap = graph->vertexCount + 1;
+	} else {
+		free(graph->idsRefs);
+	}
+
+	graph->idsRefs = NULL;
+	return EXIT_SUCCESS;
+}
+
+static int cmpArc(const void *a, const void *b)
+{
+	const struct arc_t *x = a;
+	const struct arc_t *y = b;
+
+	if (x->target != y->target)
+		return (x->target > y->target) - (x->target < y->target);
+
+	return (x->weight > y->weight) - (x->weight < y->weight);
+}
@@ -1,61 +1,154 @@
 #pragma once
 /*
-  A general graph structure for LSA.  The nodes are identified by strings and
-  the edges are implied based on the list of neighbors it has.
+  A general graph structure for LSA.  The vertices are identified by strings,
+  which are interned to dense integer ids, and the edges are stored in
+  compressed sparse row (CSR) form: the neighbors of vertex v are
+  targets[offsets[v]] up to targets[offsets[v + 1]], and the cost of the link
+  to each of them is at the same index of weights.
+
+  A graph is built by interning vertices and adding edges, then calling
+  buildAdjacency once.  Afterwards the neighbors of one vertex at a time can
+  be replaced with setNeighbors as the topology changes.  The replaced rows
+  are kept in an overlay over the CSR arrays, so that a change only costs
+  the rows it touches, and compactGraph folds them back in once a batch of
+  changes is done.
+
+  The CSR arrays and the vertex ids are never changed in place once built,
+  so that shareGraph can hand them to snapshots without copying them.  They
+  are freed with their last holder.
 */
 
 #include <stdlib.h>
-#include "../common/linkedlist.h"
+#include <inttypes.h>
+
+#include "../common/hashtable.h"
+
+/* The neighbors of a vertex replaced since the adjacency was built */
+struct graph_row_t {
+	uint32_t vertex;
+	uint32_t count, cap;
+	uint32_t *targets; /* sorted */
+	uint32_t *weights;
+};
+
+struct graph_t {
+	size_t vertexCount;
+	size_t edgeCount; /* directed edges, each link is counted twice */
+
+	struct hashtable_t ids; /* vertex id string -> vertex */
+	char *names; /* arena of the vertex id strings */
+	size_t namesLen, namesCap;
+	size_t *nameOffsets; /* offset of every vertex's id in names */
+
+	uint32_t *offsets; /* rows + 1 entries */
+	uint32_t *targets; /* edgeCount entries */
+	uint32_t *weights; /* edgeCount link costs */
+	size_t rows; /* vertices covered by the adjacency, the rest have none */
+
+	/* edges added since the adjacency was built, as source, target and
+	   cost triples */
+	uint32_t *pending;
+	size_t pendingCount, pendingCap;
+	size_t vertexCap;
+
+	/* the rows replaced by setNeighbors.  overlayIndex has the position + 1
+	   in overlay of the row of every vertex, 0 if it has none.  The rows
+	   keep their buffers once compacted, for the next ones */
+	struct graph_row_t *overlay;
+	size_t overlayCount, overlayCap;
+	uint32_t *overlayIndex;
+	size_t indexCap;
 
-struct graph_node_t {
-	char *id;
-	Node *neighbors; /* list of neighboring nodes */
-	int weight;
+	/* holders of the CSR arrays, and of ids, names and nameOffsets, NULL
+	   while the graph is their only holder.  See shareGraph */
+	size_t *adjacencyRefs, *idsRefs;
 };
 
 /**
-   Create a graph node with id id and no neighbors.  The id can be freed
-   afterwards, since newGraphNode allocates memory internally.
+   Initialize an empty graph sized for about hint vertices.
+
+   @return 0 on success, 1 otherwise.
+*/
+int graphInit(struct graph_t *graph, size_t hint);
+
+/**
+   Initialize dst as a read-only copy of the built graph src, after
+   compacting it, that shares its CSR arrays and vertex ids.  Changes to src
+   afterwards do not show in dst.
+
+   @return 0 on success, 1 otherwise.
+*/
+int shareGraph(struct graph_t *dst, struct graph_t *src);
+
+/**
+   Free everything the graph holds.
+*/
+void freeGraph(struct graph_t *graph);
+
+/**
+   Return the vertex with the id of len bytes, creating it if it does not
+   exist yet.  The id is copied.
+
+   @return the vertex, or -1 on failure.
+*/
+long internVertex(struct graph_t *graph, const char *id, size_t len);
+
+/**
+   Find the vertex with the id id.
 
-   @param id the new node's id
-   @return an allocated graph node on success, NULL otherwise.
+   @return the vertex, or -1 if it is not in the graph.
 */
-struct graph_node_t *newGraphNode(char *id);
+long findVertex(const struct graph_t *graph, const char *id);
 
 /**
-   Add an edge between two nodes.  In otherwise, the two nodes become neighbors.
-   It does not check the existence of an edge already.
+   Return the id string of vertex v.
+*/
+const char *vertexName(const struct graph_t *graph, uint32_t v);
+
+/**
+   Add an edge of cost weight between two vertices.  In otherwise, the two
+   vertices become neighbors.  Duplicate edges are merged by buildAdjacency,
+   which keeps the lowest cost.
 
-   @param n1 node 1
-   @param n2 node 2
    @return 0 on success, 1 otherwise.
 */
-int addEdge(struct graph_node_t *n1, struct graph_node_t *n2);
+int addEdge(struct graph_t *graph, uint32_t v1, uint32_t v2, uint32_t weight);
 
 /**
-   Test to see if an edge exists between two nodes. An edge exists if n1 has n2
-   as an neighbor and n2 has n1 as an neighbor.
+   Turn the added edges into the CSR adjacency arrays.
 
-   @param n1 node 1
-   @param n2 node 2
-   @return 1 if an edge does exist, 0 otherwise.
+   @return 0 on success, 1 otherwise.
 */
-int edgeExists(struct graph_node_t *n1, struct graph_node_t *n2);
+int buildAdjacency(struct graph_t *graph);
 
 /**
-   Wrapper function for linked lists's find function.  Tests whether or not
-   this has the same id.
+   Replace the neighbors of vertex v with the count sorted, distinct vertices
+   in neighbors, linked at the costs in weights, and update the vertices that
+   gained, lost or relinked v to match.  Only the rows of those vertices
+   are written, into the overlay.
 
-   @param this the graph node that's being tested
-   @param id the id that the graph node's id is tested against
+   @return 0 on success, 1 otherwise.
+*/
+int setNeighbors(struct graph_t *graph, uint32_t v, const uint32_t *neighbors,
+		 const uint32_t *weights, size_t count);
 
-   @return 0 if it is an exact match, 1 otherwise.
+/**
+   Fold the rows of the overlay into new CSR arrays, which vertices
+   interned since the adjacency was built also get rows in.
+
+   @return 0 on success, 1 otherwise.
 */
-int cmpGraphById(const void *this, const void *ip);
+int compactGraph(struct graph_t *graph);
 
 /**
-   Print the entire graph starting at a specific node.
+   Return the number of neighbors of vertex v and point *neighbors at them,
+   sorted, and *weights at the costs of the links to them unless weights is
+   NULL.
+*/
+size_t getNeighbors(const struct graph_t *graph, uint32_t v,
+		    const uint32_t **neighbors, const uint32_t **weights);
 
-   @param node the node that's the entry to the graph.
+/**
+   Print the entire graph, one vertex and its neighbors per line.
 */
-void printGraph(struct graph_node_t *node);
+void printGraph(const struct graph_t *graph);
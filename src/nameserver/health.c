@@ -0,0 +1,333 @@
+/*
+  Functions to check the health of the video servers
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "health.h"
+#include "nearest.h"
+#include "../common/log.h"
+#include "../common/mytime.h"
+
+#define MAX_STREAK 1000 /* checks in a row a server may need */
+
+/**
+   Parse the number at the start of str into *n, from 1 to max, and point
+   *end past it.
+
+   @return 0 on success, 1 otherwise
+*/
+static int parseNumber(const char *str, char **end, unsigned long max,
+		       unsigned long *n);
+
+/**
+   Start a non-blocking connect to server into *fd.
+
+   @return 1 if it is in progress, 0 if it already ended in *passed
+*/
+static int startCheck(const struct server_t *server, int *fd, int *passed);
+
+/**
+   Count the check of server that passed or not, and take it out or put it
+   back once its streak reaches the hysteresis of config.
+*/
+static void recordCheck(struct dns_config_t *config, size_t server,
+			int passed);
+
+/**
+   Close the sockets of a round of checks cut short by cancellation.
+*/
+static void closeChecks(void *arg);
+
+/* The sockets of the round of checks in progress */
+struct health_round_t {
+	struct pollfd *fds;
+	size_t count;
+};
+
+int dns_ParseHealth(struct dns_config_t *config, const char *arg)
+{
+	unsigned long interval, fall = HEALTH_FALL, rise = HEALTH_RISE;
+	char *end;
+
+	if (parseNumber(arg, &end, UINT32_MAX, &interval))
+		return EXIT_FAILURE;
+
+	if (*end == ',' &&
+	    (parseNumber(end + 1, &end, MAX_STREAK, &fall) || *end != ',' ||
+	     parseNumber(end + 1, &end, MAX_STREAK, &rise)))
+		return EXIT_FAILURE;
+
+	if (*end)
+		return EXIT_FAILURE;
+
+	config->healthInterval = interval;
+	config->healthFall = fall;
+	config->healthRise = rise;
+	return EXIT_SUCCESS;
+}
+
+int healthInit(struct dns_config_t *config)
+{
+	size_t i;
+
+	config->health = calloc(config->serversCount + 1,
+				sizeof(*(config->health)));
+	if (!config->health) {
+		log(DEFAULT_LOG, "failed to calloc server health.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < config->serversCount; i++) {
+		atomic_init(&(config->health[i].up), 1);
+		config->health[i].ranked = 1;
+	}
+
+	/* neither end may block, a full pipe already wakes the reader */
+	config->healthPipe[0] = config->healthPipe[1] = -1;
+	if (pipe(config->healthPipe) ||
+	    fcntl(config->healthPipe[0], F_SETFL, O_NONBLOCK) ||
+	    fcntl(config->healthPipe[1], F_SETFL, O_NONBLOCK)) {
+		perror("pipe");
+		log(DEFAULT_LOG, "failed to open health pipe.\n");
+		freeHealth(config);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void *dns_HealthCheck(void *arg)
+{
+	struct dns_config_t *config = arg;
+	struct health_round_t round;
+	struct timespec rest;
+	mytime_t start, deadline, now, elapsed;
+	size_t i, pending;
+	socklen_t len;
+	int passed, err, timeout;
+
+	round.count = config->serversCount;
+	if (!(round.fds = calloc(round.count, sizeof(*(round.fds))))) {
+		log(DEFAULT_LOG, "failed to calloc health checks.\n");
+		return NULL;
+	}
+
+	timeout = config->healthInterval < HEALTH_TIMEOUT ?
+		config->healthInterval : HEALTH_TIMEOUT;
+
+	for (i = 0; i < round.count; i++)
+		round.fds[i].fd = -1;
+	pthread_cleanup_push(closeChecks, &round);
+
+	while (1) {
+		start = microtime(NULL);
+		deadline = start + (mytime_t) timeout * 1000;
+
+		/* connects that end at once are recorded, the others polled.
+		   A done check has its fd set to -1 so that poll skips it */
+		for (i = 0, pending = 0; i < round.count; i++) {
+			round.fds[i].events = POLLOUT;
+			if (startCheck(&(config->servers[i]), &(round.fds[i].fd),
+				       &passed))
+				pending++;
+			else
+				recordCheck(config, i, passed);
+		}
+
+		while (pending && (now = microtime(NULL)) < deadline) {
+			if (poll(round.fds, round.count,
+				 (deadline - now + 999) / 1000) <= 0)
+				continue;
+
+			for (i = 0; i < round.count; i++) {
+				if (round.fds[i].fd < 0 || !round.fds[i].revents)
+					continue;
+
+				len = sizeof(err);
+				passed = !getsockopt(round.fds[i].fd, SOL_SOCKET,
+						     SO_ERROR, &err, &len) &&
+					!err;
+				close(round.fds[i].fd);
+				round.fds[i].fd = -1;
+				recordCheck(config, i, passed);
+				pending--;
+			}
+		}
+
+		/* the ones still connecting timed out */
+		for (i = 0; i < round.count; i++) {
+			if (round.fds[i].fd < 0)
+				continue;
+
+			close(round.fds[i].fd);
+			round.fds[i].fd = -1;
+			recordCheck(config, i, 0);
+		}
+
+		elapsed = microtime(NULL) - start;
+		if (elapsed < (mytime_t) config->healthInterval * 1000) {
+			elapsed = (mytime_t) config->healthInterval * 1000 -
+				elapsed;
+			rest.tv_sec = elapsed / 1000000;
+			rest.tv_nsec = elapsed % 1000000 * 1000;
+			nanosleep(&rest, NULL);
+		}
+	}
+
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+int isHealthy(const struct dns_config_t *config, size_t server)
+{
+	return !config->health ||
+		atomic_load_explicit(&(config->health[server].up),
+				     memory_order_relaxed);
+}
+
+int poolHealthy(const struct dns_config_t *config, const struct zone_t *zone)
+{
+	size_t i;
+
+	for (i = 0; i < zone->poolCount; i++)
+		if (isHealthy(config, zone->pool[i]))
+			return 1;
+
+	return 0;
+}
+
+size_t dns_RankHealth(struct dns_config_t *config)
+{
+	struct server_health_t *health;
+	char wakeups[64];
+	size_t i, changed;
+	int up;
+
+	while (read(config->healthPipe[0], wakeups, sizeof(wakeups)) > 0)
+		;
+
+	for (i = 0, changed = 0; i < config->serversCount; i++) {
+		health = &(config->health[i]);
+		up = atomic_load(&(health->up));
+		if (up == health->ranked)
+			continue;
+
+		health->ranked = up;
+		if (dns_RankServer(config, i))
+			log(DEFAULT_LOG, "failed to rank %s\n",
+			    config->servers[i].ip);
+		changed++;
+	}
+
+	return changed;
+}
+
+size_t keepHealthy(const struct dns_config_t *config, size_t *servers,
+		   size_t count)
+{
+	size_t i, kept;
+
+	if (!config->health)
+		return count;
+
+	for (i = 0, kept = 0; i < count; i++)
+		if (isHealthy(config, servers[i]))
+			servers[kept++] = servers[i];
+
+	/* with all of them down nothing was moved */
+	return kept ? kept : count;
+}
+
+void freeHealth(struct dns_config_t *config)
+{
+	if (config->health && config->healthPipe[0] != -1) {
+		close(config->healthPipe[0]);
+		close(config->healthPipe[1]);
+	}
+
+	free(config->health);
+	config->health = NULL;
+}
+
+static int parseNumber(const char *str, char **end, unsigned long max,
+		       unsigned long *n)
+{
+	errno = 0;
+	*n = strtoul(str, end, 10);
+	return errno || *end == str || !*n || *n > max;
+}
+
+static int startCheck(const struct server_t *server, int *fd, int *passed)
+{
+	struct sockaddr_in addr;
+
+	if ((*fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) {
+		log(DEFAULT_LOG, "health check socket failed.\n");
+		*passed = 0;
+		return 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr = server->addr;
+	addr.sin_port = htons(HEALTH_PORT);
+
+	if (!connect(*fd, (struct sockaddr *) &addr, sizeof(addr)))
+		*passed = 1;
+	else if (errno == EINPROGRESS)
+		return 1;
+	else
+		*passed = 0;
+
+	close(*fd);
+	*fd = -1;
+	return 0;
+}
+
+static void recordCheck(struct dns_config_t *config, size_t server,
+			int passed)
+{
+	struct server_health_t *health = &(config->health[server]);
+	int up = atomic_load(&(health->up));
+
+	/* a streak only counts checks that disagree with the state */
+	if (passed == up) {
+		health->streak = 0;
+		return;
+	}
+
+	if (++(health->streak) < (up ? config->healthFall :
+				  config->healthRise))
+		return;
+
+	health->streak = 0;
+	atomic_store(&(health->up), passed);
+	log(DEFAULT_LOG, "server %s is %s\n", config->servers[server].ip,
+	    passed ? "up" : "down");
+
+	if (write(config->healthPipe[1], "", 1) == -1 && errno != EAGAIN)
+		log(DEFAULT_LOG, "failed to wake the control thread.\n");
+}
+
+static void closeChecks(void *arg)
+{
+	struct health_round_t *round = arg;
+	size_t i;
+
+	for (i = 0; i < round->count; i++)
+		if (round->fds[i].fd >= 0)
+			close(round->fds[i].fd);
+
+	free(round->fds);
+}
@@ -0,0 +1,75 @@
+#pragma once
+/*
+  Active health checks of the video servers.
+
+  With -i <interval>[,<fall>,<rise>] a thread opens a TCP connection to port
+  HEALTH_PORT of every server each interval milliseconds, all of them at once
+  with non-blocking connects.  A server is taken out of the answers after
+  fall checks failed in a row, and put back after rise checks passed in a
+  row, so a single lost connect does not flap it.  Servers start out up.
+
+  The nearest-server tables only rank the servers that are up.  When one goes
+  up or down the health thread wakes the control thread through a pipe, which
+  repairs the tables around it and publishes them.
+*/
+
+#include "nameserver.h"
+
+#define HEALTH_PORT 8080 /* the port the video servers serve on */
+#define HEALTH_TIMEOUT 1000 /* milliseconds a connect may take at most */
+#define HEALTH_FALL 3 /* failed checks in a row a server is down after */
+#define HEALTH_RISE 2 /* passed checks in a row a server is up after */
+
+/**
+   Parse the health check option "<interval>[,<fall>,<rise>]" into config.
+
+   @return 0 on success, 1 if it is malformed
+*/
+int dns_ParseHealth(struct dns_config_t *config, const char *arg);
+
+/**
+   Set up the health state of every registered server of config, all up,
+   and the pipe that tells of changes.
+
+   @return 0 on success, 1 otherwise
+*/
+int healthInit(struct dns_config_t *config);
+
+/**
+   Check the health of config's servers every config->healthInterval
+   milliseconds until the thread is cancelled.
+*/
+void *dns_HealthCheck(void *arg);
+
+/**
+   Tell whether server is up.  Every server is up without health checks.
+*/
+int isHealthy(const struct dns_config_t *config, size_t server);
+
+/**
+   Tell whether any server in the pool of zone is up.
+*/
+int poolHealthy(const struct dns_config_t *config, const struct zone_t *zone);
+
+/**
+   Take the wake-ups of config->healthPipe, and repair the nearest-server
+   tables around the servers that went up or down since they were ranked.
+
+   @return the number of servers that did
+*/
+size_t dns_RankHealth(struct dns_config_t *config);
+
+/**
+   Drop the servers that are down from the count indices in servers, keeping
+   the order of the others.  Nothing is dropped if they are all down, an
+   answer being better than none.
+
+   @return the number of servers left
+*/
+size_t keepHealthy(const struct dns_config_t *config, size_t *servers,
+		   size_t count);
+
+/**
+   Free the health state of config.
+*/
+void freeHealth(struct dns_config_t *config);
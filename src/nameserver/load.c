@@ -0,0 +1,134 @@
+/*
+  Functions to record and compare the load of the video servers
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "load.h"
+#include "servers.h"
+#include "../common/log.h"
+
+/**
+   Parse the unsigned 32 bit number str.
+
+   @return 0 on success, 1 otherwise
+*/
+static int parseCount(const char *str, uint32_t *count);
+
+/**
+   Find the headroom of server at time now.
+
+   @return 1 and set *room if the server has a valid report, 0 otherwise
+*/
+static int headroom(const struct dns_config_t *config, size_t server,
+		    mytime_t now, int64_t *room);
+
+int loadInit(struct dns_config_t *config)
+{
+	size_t i;
+
+	config->loads = calloc(config->serversCount + 1,
+			       sizeof(*(config->loads)));
+	if (!config->loads) {
+		log(DEFAULT_LOG, "failed to calloc server loads.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < config->serversCount; i++) {
+		atomic_init(&(config->loads[i].report), 0);
+		atomic_init(&(config->loads[i].time), 0);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int dns_ReportLoad(struct dns_config_t *config, char *line)
+{
+	char *ip, *load, *capacity, *save;
+	uint32_t l, c;
+	long server;
+
+	ip = strtok_r(line, " \t\r\n", &save);
+	load = strtok_r(NULL, " \t\r\n", &save);
+	capacity = strtok_r(NULL, " \t\r\n", &save);
+
+	if (!ip || !load || !capacity || parseCount(load, &l) ||
+	    parseCount(capacity, &c)) {
+		log(DEFAULT_LOG, "improper load report.\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((server = findServer(config, ip)) == -1) {
+		log(DEFAULT_LOG, "load report from unknown server %s\n", ip);
+		return EXIT_FAILURE;
+	}
+
+	atomic_store(&(config->loads[server].report),
+		     ((uint64_t) l << 32) | c);
+	atomic_store(&(config->loads[server].time), microtime(NULL));
+
+	log(DEFAULT_LOG, "load %s %u/%u\n", ip, l, c);
+	return EXIT_SUCCESS;
+}
+
+int hasLoadReport(const struct dns_config_t *config, size_t server,
+		  mytime_t now)
+{
+	int64_t room;
+
+	return headroom(config, server, now, &room);
+}
+
+int moreHeadroom(const struct dns_config_t *config, size_t a, size_t b,
+		 mytime_t now)
+{
+	int64_t ha, hb;
+
+	return headroom(config, a, now, &ha) &&
+		headroom(config, b, now, &hb) && ha > hb;
+}
+
+int isFull(const struct dns_config_t *config, size_t server, mytime_t now)
+{
+	int64_t room;
+
+	return headroom(config, server, now, &room) && room <= 0;
+}
+
+void freeLoads(struct dns_config_t *config)
+{
+	free(config->loads);
+	config->loads = NULL;
+}
+
+static int parseCount(const char *str, uint32_t *count)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(str, &end, 10);
+	if (errno || *end || end == str || n > UINT32_MAX)
+		return EXIT_FAILURE;
+
+	*count = n;
+	return EXIT_SUCCESS;
+}
+
+static int headroom(const struct dns_config_t *config, size_t server,
+		    mytime_t now, int64_t *room)
+{
+	uint64_t report;
+	mytime_t time;
+
+	time = atomic_load(&(config->loads[server].time));
+	if (!time || (now > time && now - time > LOAD_TTL))
+		return 0;
+
+	report = atomic_load(&(config->loads[server].report));
+	*room = (int64_t) (report & UINT32_MAX) - (int64_t) (report >> 32);
+	return 1;
+}
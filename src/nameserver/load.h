@@ -0,0 +1,54 @@
+#pragma once
+/*
+  Load reports of the video servers.
+
+  Servers, or an agent next to them, push "<ip> <load> <capacity>" lines to
+  the load port, in any unit as long as both numbers share it (sessions,
+  kbps...).  The latest report of every server is kept in atomics so queries
+  read it without locking.  A report older than LOAD_TTL no longer counts.
+*/
+
+#include "nameserver.h"
+#include "../common/mytime.h"
+
+#define LOAD_TTL 10000000 /* microseconds a load report stays valid */
+
+/**
+   Set up a load report slot for every registered server of config.
+
+   @return 0 on success, 1 otherwise
+*/
+int loadInit(struct dns_config_t *config);
+
+/**
+   Record the load report line "<ip> <load> <capacity>".  line is tokenized
+   in place.
+
+   @return 0 on success, 1 if the line is malformed or the server unknown
+*/
+int dns_ReportLoad(struct dns_config_t *config, char *line);
+
+/**
+   Tell whether server has a valid load report at time now.
+*/
+int hasLoadReport(const struct dns_config_t *config, size_t server,
+		  mytime_t now);
+
+/**
+   Tell whether server a has strictly more headroom (capacity left) than
+   server b at time now.  Servers without a valid report are never preferred,
+   nor preferred over.
+*/
+int moreHeadroom(const struct dns_config_t *config, size_t a, size_t b,
+		 mytime_t now);
+
+/**
+   Tell whether server has a valid load report at time now without any
+   headroom left.
+*/
+int isFull(const struct dns_config_t *config, size_t server, mytime_t now);
+
+/**
+   Free the load report slots of config.
+*/
+void freeLoads(struct dns_config_t *config);
@@ -0,0 +1,418 @@
+/*
+  Functions to store LSAs and keep the network graph in step with them
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "lsa.h"
+#include "graph.h"
+#include "nearest.h"
+#include "servers.h"
+#include "../common/log.h"
+
+#define DEFAULT_NEIGHBORS 8
+
+/**
+   Grow config's LSAs so that every vertex of the graph has one.
+
+   @return 0 on success, 1 otherwise
+*/
+static int reserveLSAs(struct dns_config_t *config);
+
+/**
+   Return the cost vertex u advertises for its link to vertex v, 0 if it does
+   not advertise v.
+*/
+static uint32_t advertisedCost(const struct dns_config_t *config, uint32_t u,
+			       uint32_t v);
+
+/**
+   Link the servers that are on the vertices interned from first on.
+*/
+static void linkNewVertices(struct dns_config_t *config, size_t first);
+
+/**
+   Compare two links by vertex and then by cost, for sorting neighbors.
+*/
+static int cmpLink(const void *a, const void *b);
+
+/**
+   Return the lower of two costs, 0 standing for no link.
+*/
+static uint32_t minCost(uint32_t a, uint32_t b);
+
+/**
+   Grow the neighbor buffers of scratch, kept from one LSA to the next, to
+   hold n vertices.
+
+   @return 0 on success, 1 otherwise
+*/
+static int growRow(struct nearest_scratch_t *scratch, size_t n);
+
+int parseLSA(char *line, char **ip, int *seqNum, char **neighbors)
+{
+	char *seq, *end, *save;
+	long n;
+
+	*ip = strtok_r(line, " \t\r\n", &save);
+	seq = strtok_r(NULL, " \t\r\n", &save);
+	*neighbors = strtok_r(NULL, " \t\r\n", &save);
+
+	if (!(*ip) || !seq || !(*neighbors))
+		return EXIT_FAILURE;
+
+	errno = 0;
+	n = strtol(seq, &end, 10);
+	if (errno || *end || n < 0 || n > INT32_MAX)
+		return EXIT_FAILURE;
+
+	*seqNum = n;
+	return EXIT_SUCCESS;
+}
+
+int parseNeighbor(char *tok, struct lsa_token_t *token)
+{
+	char *sep, *end;
+	unsigned long cost;
+
+	token->ip = tok;
+	token->cost = DEFAULT_LINK_COST;
+	if (!(sep = strchr(tok, ':')))
+		return EXIT_SUCCESS;
+
+	*sep = '\0';
+	errno = 0;
+	cost = strtoul(sep + 1, &end, 10);
+	if (errno || *end || end == sep + 1 || !cost || cost > MAX_LINK_COST)
+		return EXIT_FAILURE;
+
+	token->cost = cost;
+	return EXIT_SUCCESS;
+}
+
+int dns_StoreLSA(struct dns_config_t *config, const char *ip, int seqNum,
+		 char *neighbors, int *updated)
+{
+	struct lsa_token_t *tokens, *tmp;
+	size_t count, cap;
+	char *tok, *save;
+	int ret;
+
+	tokens = NULL;
+	count = cap = 0;
+	for (tok = strtok_r(neighbors, ",\n", &save); tok;
+	     tok = strtok_r(NULL, ",\n", &save)) {
+		if (count == cap) {
+			cap = cap ? cap * 2 : DEFAULT_NEIGHBORS;
+			if (!(tmp = realloc(tokens, cap * sizeof(*tokens)))) {
+				log(DEFAULT_LOG, "failed to store LSA of %s\n",
+				    ip);
+				free(tokens);
+				return EXIT_FAILURE;
+			}
+			tokens = tmp;
+		}
+
+		if (parseNeighbor(tok, &(tokens[count++]))) {
+			log(DEFAULT_LOG, "bad link cost to %s\n", tok);
+			free(tokens);
+			return EXIT_FAILURE;
+		}
+	}
+
+	ret = dns_StoreTokens(config, ip, seqNum, tokens, count, updated);
+	free(tokens);
+	return ret;
+}
+
+int dns_StoreTokens(struct dns_config_t *config, const char *ip, int seqNum,
+		    const struct lsa_token_t *tokens, size_t count,
+		    int *updated)
+{
+	struct graph_t *graph = &(config->graph);
+	struct lsa_t *lsa;
+	struct lsa_link_t *list;
+	size_t i, out;
+	long v, u;
+
+	*updated = 0;
+
+	if ((v = internVertex(graph, ip, strlen(ip))) == -1 ||
+	    reserveLSAs(config))
+		return EXIT_FAILURE;
+
+	lsa = &(config->lsas[v]);
+	if (lsa->present && seqNum <= lsa->seqNum) {
+		log(DEFAULT_LOG, "stale LSA %s %d\n", ip, seqNum);
+		return EXIT_SUCCESS;
+	}
+
+	if (!(list = malloc((count + 1) * sizeof(*list))))
+		goto fail;
+
+	for (i = out = 0; i < count; i++) {
+		u = internVertex(graph, tokens[i].ip, strlen(tokens[i].ip));
+		if (u == -1)
+			goto fail;
+
+		if (u == v)
+			continue;
+
+		list[out].vertex = u;
+		list[out++].cost = tokens[i].cost;
+	}
+	count = out;
+
+	/* keep the advertised neighbors sorted and distinct, at their lowest
+	   cost */
+	if (count)
+		qsort(list, count, sizeof(*list), cmpLink);
+	for (i = out = 0; i < count; i++)
+		if (!i || list[i].vertex != list[i - 1].vertex)
+			list[out++] = list[i];
+
+	/* interning the neighbors may have added vertices */
+	if (reserveLSAs(config))
+		goto fail;
+
+	lsa = &(config->lsas[v]);
+	free(lsa->links);
+	lsa->present = 1;
+	lsa->seqNum = seqNum;
+	lsa->links = list;
+	lsa->count = out;
+
+	log(DEFAULT_LOG, "stored %s %d with %zu neighbors\n", ip, seqNum, out);
+
+	*updated = 1;
+	return EXIT_SUCCESS;
+
+fail:
+	log(DEFAULT_LOG, "failed to store LSA of %s\n", ip);
+	free(list);
+	return EXIT_FAILURE;
+}
+
+int dns_BuildTopology(struct dns_config_t *config)
+{
+	struct graph_t *graph = &(config->graph);
+	struct lsa_t *lsa;
+	size_t v, i;
+
+	for (v = 0; v < graph->vertexCount; v++) {
+		lsa = &(config->lsas[v]);
+
+		for (i = 0; i < lsa->count; i++) {
+			if (addEdge(graph, v, lsa->links[i].vertex,
+				    lsa->links[i].cost)) {
+				log(DEFAULT_LOG, "failed to connect %s <--> %s",
+				    vertexName(graph, v),
+				    vertexName(graph, lsa->links[i].vertex));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (buildAdjacency(graph)) {
+		log(DEFAULT_LOG, "failed to build adjacency.\n");
+		return EXIT_FAILURE;
+	}
+
+#ifdef DEBUG
+	printGraph(graph);
+#endif
+	return EXIT_SUCCESS;
+}
+
+int dns_UpdateLSA(struct dns_config_t *config, const char *ip, int seqNum,
+		  char *neighbors)
+{
+	struct graph_t *graph = &(config->graph);
+	const uint32_t *old, *oldWeights;
+	const struct lsa_t *lsa;
+	uint32_t *row, *weights, *changed, u, cost;
+	size_t vertices, oldCount, count, changedCount, i, j;
+	int updated;
+	long v;
+
+	vertices = graph->vertexCount;
+	if (dns_StoreLSA(config, ip, seqNum, neighbors, &updated))
+		return EXIT_FAILURE;
+
+	if (!updated)
+		return EXIT_SUCCESS;
+
+	linkNewVertices(config, vertices);
+
+	v = findVertex(graph, ip);
+	lsa = &(config->lsas[v]);
+	oldCount = getNeighbors(graph, v, &old, &oldWeights);
+
+	if (growRow(&(config->scratch), oldCount + lsa->count + 1)) {
+		log(DEFAULT_LOG, "failed to grow neighbors.\n");
+		return EXIT_FAILURE;
+	}
+
+	row = config->scratch.row;
+	weights = config->scratch.weights;
+	changed = config->scratch.changed;
+
+	/* the sender keeps the neighbors it advertises now, and the old ones
+	   that still advertise it.  The links that appear, disappear or change
+	   cost are the ones to repair around */
+	count = changedCount = 0;
+	changed[changedCount++] = v;
+	for (i = j = 0; i < oldCount || j < lsa->count;) {
+		if (j == lsa->count ||
+		    (i < oldCount && old[i] < lsa->links[j].vertex)) {
+			u = old[i];
+			cost = advertisedCost(config, u, v);
+		} else if (i == oldCount || lsa->links[j].vertex < old[i]) {
+			u = lsa->links[j].vertex;
+			cost = minCost(lsa->links[j++].cost,
+				       advertisedCost(config, u, v));
+		} else {
+			u = old[i];
+			cost = minCost(lsa->links[j++].cost,
+				       advertisedCost(config, u, v));
+		}
+
+		if (i < oldCount && old[i] == u) {
+			if (oldWeights[i] != cost)
+				changed[changedCount++] = u;
+			i++;
+		} else {
+			changed[changedCount++] = u;
+		}
+
+		if (cost) {
+			row[count] = u;
+			weights[count++] = cost;
+		}
+	}
+
+	if ((changedCount > 1 || vertices < graph->vertexCount) &&
+	    (setNeighbors(graph, v, row, weights, count) ||
+	     dns_RepairNearest(config, changed, changedCount))) {
+		log(DEFAULT_LOG, "failed to apply LSA of %s\n", ip);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void freeLSAs(struct dns_config_t *config)
+{
+	size_t v;
+
+	for (v = 0; v < config->lsasCap; v++)
+		free(config->lsas[v].links);
+
+	free(config->lsas);
+	config->lsas = NULL;
+	config->lsasCap = 0;
+}
+
+static int reserveLSAs(struct dns_config_t *config)
+{
+	struct lsa_t *lsas;
+	size_t cap;
+
+	if (config->graph.vertexCount <= config->lsasCap)
+		return EXIT_SUCCESS;
+
+	cap = config->lsasCap ? config->lsasCap : DEFAULT_NEIGHBORS;
+	while (cap < config->graph.vertexCount)
+		cap *= 2;
+
+	if (!(lsas = realloc(config->lsas, cap * sizeof(*lsas)))) {
+		log(DEFAULT_LOG, "failed to grow LSAs.\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(lsas + config->lsasCap, 0,
+	       (cap - config->lsasCap) * sizeof(*lsas));
+	config->lsas = lsas;
+	config->lsasCap = cap;
+	return EXIT_SUCCESS;
+}
+
+static uint32_t advertisedCost(const struct dns_config_t *config, uint32_t u,
+			       uint32_t v)
+{
+	const struct lsa_t *lsa = &(config->lsas[u]);
+	const struct lsa_link_t *link;
+	struct lsa_link_t key = { v, 0 };
+
+	if (!lsa->count)
+		return 0;
+
+	link = bsearch(&key, lsa->links, lsa->count, sizeof(key), cmpLink);
+	return link ? link->cost : 0;
+}
+
+static void linkNewVertices(struct dns_config_t *config, size_t first)
+{
+	size_t v;
+	long server;
+
+	for (v = first; v < config->graph.vertexCount; v++) {
+		server = findServer(config, vertexName(&(config->graph), v));
+		if (server != -1) {
+			log(DEFAULT_LOG, "server %s joined the graph\n",
+			    config->servers[server].ip);
+			config->servers[server].vertex = v;
+		}
+	}
+}
+
+static int cmpLink(const void *a, const void *b)
+{
+	const struct lsa_link_t *x = a;
+	const struct lsa_link_t *y = b;
+
+	if (x->vertex != y->vertex)
+		return (x->vertex > y->vertex) - (x->vertex < y->vertex);
+
+	/* only ordered by cost while sorting, bsearch keys have none */
+	if (!x->cost || !y->cost)
+		return 0;
+
+	return (x->cost > y->cost) - (x->cost < y->cost);
+}
+
+static uint32_t minCost(uint32_t a, uint32_t b)
+{
+	if (!a || !b)
+		return a ? a : b;
+
+	return a < b ? a : b;
+}
+
+static int growRow(struct nearest_scratch_t *scratch, size_t n)
+{
+	uint32_t *row, *weights, *changed;
+	size_t cap;
+
+	if (n <= scratch->rowCap)
+		return EXIT_SUCCESS;
+
+	cap = scratch->rowCap ? scratch->rowCap : DEFAULT_NEIGHBORS;
+	while (cap < n)
+		cap *= 2;
+
+	if ((row = realloc(scratch->row, cap * sizeof(*row))))
+		scratch->row = row;
+	if ((weights = realloc(scratch->weights, cap * sizeof(*weights))))
+		scratch->weights = weights;
+	if ((changed = realloc(scratch->changed, cap * sizeof(*changed))))
+		scratch->changed = changed;
+	if (!row || !weights || !changed)
+		return EXIT_FAILURE;
+
+	scratch->rowCap = cap;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#pragma once
+/*
+  The latest link state advertisement (LSA) of every vertex.
+
+  LSAs are loaded from the LSA file at startup and received on the control
+  socket afterwards.  The advertisement of a sender is stored by its vertex in
+  the graph, and is only replaced by one with a higher sequence number.  Two
+  vertices are neighbors when either of them advertises the other.
+
+  A neighbor may carry the cost of the link to it, such as its latency, as
+  "<ip>:<cost>".  Links without one cost DEFAULT_LINK_COST, and a link
+  advertised by both of its ends costs the lower of the two.
+*/
+
+#include <inttypes.h>
+
+#include "nameserver.h"
+
+#define DEFAULT_LINK_COST 1
+#define MAX_LINK_COST 65535
+
+/**
+   A neighbor of an LSA that is parsed but not interned yet
+*/
+struct lsa_token_t {
+	const char *ip; /* terminated */
+	uint32_t cost;
+};
+
+/**
+   Split an LSA line "<sender> <seq number> <neighbors>" in place, the
+   neighbors being separated by commas, each one optionally followed by
+   ":<cost>".
+
+   @return 0 on success, 1 if the line is malformed
+*/
+int parseLSA(char *line, char **ip, int *seqNum, char **neighbors);
+
+/**
+   Split the neighbor "<ip>[:<cost>]" of an LSA in place.
+
+   @return 0 on success, 1 if the cost is malformed
+*/
+int parseNeighbor(char *tok, struct lsa_token_t *token);
+
+/**
+   Store the LSA of sender ip, unless an LSA with the same or a higher
+   sequence number is already stored.  The graph adjacency is left alone, see
+   dns_BuildTopology.  neighbors is tokenized in place.
+
+   @param updated set to 1 if the LSA was stored, 0 if it was stale
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_StoreLSA(struct dns_config_t *config, const char *ip, int seqNum,
+		 char *neighbors, int *updated);
+
+/**
+   dns_StoreLSA for an LSA whose count neighbors are already parsed.
+*/
+int dns_StoreTokens(struct dns_config_t *config, const char *ip, int seqNum,
+		    const struct lsa_token_t *tokens, size_t count,
+		    int *updated);
+
+/**
+   Build the adjacency of config's graph from all of the stored LSAs.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_BuildTopology(struct dns_config_t *config);
+
+/**
+   Apply an LSA received at runtime.  When it is newer than the stored one,
+   the neighbors of the sender are updated in the graph and the nearest-server
+   table is repaired around the links that changed.
+
+   @return 0 on success, including a stale LSA, 1 otherwise
+*/
+int dns_UpdateLSA(struct dns_config_t *config, const char *ip, int seqNum,
+		  char *neighbors);
+
+/**
+   Free all of the stored LSAs of config.
+*/
+void freeLSAs(struct dns_config_t *config);
@@ -0,0 +1,313 @@
+/*
+  Functions to read an LSA file on several threads
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lsafile.h"
+#include "lsa.h"
+#include "../common/hashtable.h"
+#include "../common/log.h"
+
+#define MIN_RANGE (1 << 20) /* bytes of the file worth a thread */
+#define MAX_THREADS 64
+#define DEFAULT_CAP 256
+
+/* An LSA line of the file, its neighbors being tokens of its range */
+struct lsa_record_t {
+	const char *ip;
+	int seqNum;
+	size_t first, count;
+};
+
+/* The lines of the file that one thread parses, and what it parsed */
+struct lsa_range_t {
+	char *begin, *end;
+	char *tail; /* copy of a last line without a newline */
+	struct lsa_record_t *records;
+	size_t recordsCount, recordsCap;
+	struct lsa_token_t *tokens;
+	size_t tokensCount, tokensCap;
+	int failed;
+	pthread_t thread;
+};
+
+/**
+   Split the lines of a range into records, on their own thread.
+*/
+static void *parseRange(void *arg);
+
+/**
+   Split the terminated line of a range into a record.
+
+   @return 0 on success, 1 if the line is malformed or memory runs out
+*/
+static int parseLine(struct lsa_range_t *range, char *line);
+
+/**
+   Store the latest LSA of every sender among the records of the count
+   ranges.
+
+   @return 0 on success, 1 otherwise
+*/
+static int mergeRanges(struct dns_config_t *config,
+		       const struct lsa_range_t *ranges, size_t count);
+
+/**
+   Grow the array *arr of *cap elements of size size so it holds one more
+   than count.
+
+   @return 0 on success, 1 otherwise
+*/
+static int grow(void **arr, size_t *cap, size_t count, size_t size);
+
+int dns_ReadLSAFile(struct dns_config_t *config)
+{
+	struct lsa_range_t *ranges;
+	struct stat st;
+	char *data, *nl;
+	size_t size, threads, started, at, end, i;
+	long cpus;
+	int fd, ret;
+
+	if ((fd = open(config->lsaFile, O_RDONLY)) == -1) {
+		perror("open");
+		log(DEFAULT_LOG, "open lsa file failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (!(size = st.st_size)) {
+		close(fd);
+		return EXIT_SUCCESS;
+	}
+
+	/* a private writable mapping, the lines are split in place */
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = cpus > 0 ? (size_t) cpus : 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if (threads > size / MIN_RANGE + 1)
+		threads = size / MIN_RANGE + 1;
+
+	if (!(ranges = calloc(threads, sizeof(*ranges)))) {
+		log(DEFAULT_LOG, "failed to calloc lsa ranges.\n");
+		munmap(data, size);
+		return EXIT_FAILURE;
+	}
+
+	/* every range ends after a newline, or at the end of the file */
+	for (i = 0, at = 0; i < threads; i++) {
+		end = i == threads - 1 ? size : size / threads * (i + 1);
+		if (end < at)
+			end = at;
+
+		if (end < size && (nl = memchr(data + end, '\n', size - end)))
+			end = nl - data + 1;
+		else
+			end = size;
+
+		ranges[i].begin = data + at;
+		ranges[i].end = data + end;
+		at = end;
+	}
+
+	for (i = 1, started = 1; i < threads; i++, started++)
+		if (pthread_create(&(ranges[i].thread), NULL, parseRange,
+				   &(ranges[i])))
+			break;
+
+	/* the ranges of threads that did not start are parsed here */
+	for (i = started; i < threads; i++)
+		parseRange(&(ranges[i]));
+	parseRange(&(ranges[0]));
+
+	for (i = 1; i < started; i++)
+		pthread_join(ranges[i].thread, NULL);
+
+	for (i = 0, ret = EXIT_SUCCESS; i < threads; i++)
+		if (ranges[i].failed)
+			ret = EXIT_FAILURE;
+
+	if (!ret)
+		ret = mergeRanges(config, ranges, threads);
+
+	log(DEFAULT_LOG, "read %zu bytes of LSAs on %zu threads\n", size,
+	    started);
+
+	for (i = 0; i < threads; i++) {
+		free(ranges[i].records);
+		free(ranges[i].tokens);
+		free(ranges[i].tail);
+	}
+	free(ranges);
+	munmap(data, size);
+	return ret;
+}
+
+static void *parseRange(void *arg)
+{
+	struct lsa_range_t *range = arg;
+	char *line, *next, *nl;
+	size_t len;
+
+	for (line = range->begin; line < range->end; line = next) {
+		if ((nl = memchr(line, '\n', range->end - line))) {
+			*nl = '\0';
+			next = nl + 1;
+		} else {
+			/* the mapping ends with the line, no room to end it */
+			len = range->end - line;
+			if (!(range->tail = malloc(len + 1))) {
+				range->failed = 1;
+				break;
+			}
+			memcpy(range->tail, line, len);
+			range->tail[len] = '\0';
+			line = range->tail;
+			next = range->end;
+		}
+
+		if (parseLine(range, line)) {
+			range->failed = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int parseLine(struct lsa_range_t *range, char *line)
+{
+	struct lsa_record_t *record;
+	char *ip, *neighbors, *tok, *save;
+	int seqNum;
+
+	if (parseLSA(line, &ip, &seqNum, &neighbors)) {
+		log(DEFAULT_LOG, "improper LSA format line.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (grow((void **) &(range->records), &(range->recordsCap),
+		 range->recordsCount, sizeof(*(range->records))))
+		return EXIT_FAILURE;
+
+	record = &(range->records[range->recordsCount++]);
+	record->ip = ip;
+	record->seqNum = seqNum;
+	record->first = range->tokensCount;
+
+	for (tok = strtok_r(neighbors, ",\n", &save); tok;
+	     tok = strtok_r(NULL, ",\n", &save)) {
+		if (grow((void **) &(range->tokens), &(range->tokensCap),
+			 range->tokensCount, sizeof(*(range->tokens))))
+			return EXIT_FAILURE;
+
+		if (parseNeighbor(tok,
+				  &(range->tokens[range->tokensCount++]))) {
+			log(DEFAULT_LOG, "bad link cost to %s\n", tok);
+			return EXIT_FAILURE;
+		}
+	}
+
+	record->count = range->tokensCount - record->first;
+	return EXIT_SUCCESS;
+}
+
+static int mergeRanges(struct dns_config_t *config,
+		       const struct lsa_range_t *ranges, size_t count)
+{
+	struct hashtable_t latest;
+	const struct lsa_record_t *record;
+	size_t records, i, j;
+	void **slot;
+	int created, updated;
+
+	for (i = 0, records = 0; i < count; i++)
+		records += ranges[i].recordsCount;
+
+	if (ht_init(&latest, records)) {
+		log(DEFAULT_LOG, "failed to init latest LSAs.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the latest record of every sender, the first one in the file if
+	   several have its sequence number */
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < ranges[i].recordsCount; j++) {
+			record = &(ranges[i].records[j]);
+			slot = ht_insert(&latest, record->ip,
+					 strlen(record->ip), &created);
+			if (!slot)
+				goto fail;
+
+			if (created || record->seqNum >
+			    ((const struct lsa_record_t *) *slot)->seqNum)
+				*slot = (void *) record;
+		}
+	}
+
+	/* stored in file order, so that vertices are interned in it */
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < ranges[i].recordsCount; j++) {
+			record = &(ranges[i].records[j]);
+			slot = ht_find(&latest, record->ip,
+				       strlen(record->ip));
+			if (*slot != record)
+				continue;
+
+			if (dns_StoreTokens(config, record->ip,
+					    record->seqNum,
+					    ranges[i].tokens + record->first,
+					    record->count, &updated))
+				goto fail;
+		}
+	}
+
+	log(DEFAULT_LOG, "stored %zu latest of %zu LSAs\n", latest.count,
+	    records);
+	ht_free(&latest);
+	return EXIT_SUCCESS;
+
+fail:
+	log(DEFAULT_LOG, "store latest LSA failed.\n");
+	ht_free(&latest);
+	return EXIT_FAILURE;
+}
+
+static int grow(void **arr, size_t *cap, size_t count, size_t size)
+{
+	size_t newCap;
+	void *tmp;
+
+	if (count < *cap)
+		return EXIT_SUCCESS;
+
+	newCap = *cap ? *cap * 2 : DEFAULT_CAP;
+	if (!(tmp = realloc(*arr, newCap * size))) {
+		log(DEFAULT_LOG, "failed to grow lsa records.\n");
+		return EXIT_FAILURE;
+	}
+
+	*arr = tmp;
+	*cap = newCap;
+	return EXIT_SUCCESS;
+}
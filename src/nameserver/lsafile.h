@@ -0,0 +1,22 @@
+#pragma once
+/*
+  Parallel reader of LSA files.
+
+  The LSA file is mapped and split into line-aligned ranges, and every range
+  is parsed on its own thread into a buffer of (sender, sequence number,
+  neighbors) records.  The records are then merged, keeping the LSA with the
+  highest sequence number of every sender, the first one in the file among
+  equal ones, and only those are stored.
+*/
+
+#include "nameserver.h"
+
+/**
+   Read the LSAs of config's LSA file and store the latest one of every
+   sender, as dns_StoreLSA would for every line in order.  The graph
+   adjacency is left alone, see dns_BuildTopology.
+
+   @return 0 on success, 1 if the file can not be read or has a malformed
+   line
+*/
+int dns_ReadLSAFile(struct dns_config_t *config);
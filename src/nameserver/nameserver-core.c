@@ -3,145 +3,161 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
-#include <limits.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
 
 #include "nameserver-core.h"
 #include "nameserver.h"
 #include "../common/log.h"
-#include "../common/linkedlist.h"
 #include "graph.h"
-
-#define OPT_STRING "r"
+#include "nearest.h"
+#include "servers.h"
+#include "lsa.h"
+#include "load.h"
+#include "prefix.h"
+#include "topology.h"
+#include "lsafile.h"
+#include "health.h"
+#include "ratelimit.h"
+#include "zones.h"
+#include "feedback.h"
+
+#define OPT_STRING "rpasc:l:w:n:o:i:q:z:f:b:x"
+#define MAX_WORKERS 64
+#define SUBNET4_BYTES 3 /* clients of a /24 share their servers */
+#define SUBNET6_BYTES 6 /* and of a /48 */
 #define min(a,b) ((a < b) ? (a) : (b))
-#define LSA_FMT "%s %d %s\n" /* <sender> <seq number> <neighbors> */
-#define DEFAULT_IP "0.0.0.0"
-
-static unsigned rrIndex; /* round robin index */
-
-struct lsa {
-	char *ip;
-	int seqNum;
-	char *neighbors;
-};
 
 /**
-   Given a list to store parsed LSAs, look through the list and only store
-   the neighbors for a given ip, based on the highest seqNum.
-
-   If the ip does not exist in the list, add the ip to the list.  Therefore,
-   the list is guaranteed to have the latest (highest sequence number) neighbors
-   for the given ip.
+   Parse the weight of a server in the servers file.
 
-   @param list the list of parsed LSA
-   @param ip the ip portion of the LSA
-   @param seqNum the seq number of the LSA
-   @param neighbors the neights of the LSA
-
-   @return 0 if store was successful, or 1 otherwise.
+   @return 0 on success, 1 if it is not a number from 1 to MAX_WEIGHT
 */
-static int storeLatestLSA(Node **list, char *ip, int seqNum, char *neighbors);
+static int parseWeight(const char *str, uint32_t *weight);
 
 /**
-   Construct a graph of the network's topology based on the list of LSA.
-
-   @param config dns configuration. The graph will be attached to it.
-   @param list a list of LSA, which will be mutated to be a list of graph nodes.
+   Store the indices of up to n servers of the pool of zone in servers, the
+   one at position first of the pool first and the rest following it in the
+   pool order.  Servers that are down are passed over, unless all of them
+   are.
 
-   @return 0 if the entire graph was constructed correctly, 1 otherwise.
+   @return the number of servers stored
 */
-static int constructNetworkGraph(struct dns_config_t *config, Node **list);
+static size_t rotateFrom(const struct dns_config_t *config,
+			 const struct zone_t *zone, size_t first,
+			 size_t *servers, size_t n);
 
 /**
-   Connect the nodes with id neighbor and id ip together.  The nodes are fetched
-   from the list of graph nodes in config.  If the nodes are not found, they
-   are created and added to the list of nodes.
+   Parse the LSAs of config's LSA file into its graph, and build the graph and
+   the nearest-server table from them.
 
-   @param config dns configuration, with list of graph nodes.
-   @param ip the id of a node
-   @param neighbor the id of the other node
-
-   @return 0 on successfully connection the nodes, 1 otherwise.
+   @return 0 on success, 1 otherwise
 */
-static int connectNodes(struct dns_config_t *config, char *ip, char *neighbor);
+static int parseLSAFile(struct dns_config_t *config);
 
 /**
-   Wrapper function for linked lists's find function.  Tests whether or not
-   this has the same ip.
-
-   @param this the lsa struct that's being tested
-   @param ip the ip that the lsa's ip is tested against
+   Hash the subnet of client.
 
-   @return 0 if it is an exact match, 1 otherwise.
+   @return 1 and set *key on success, 0 if the address family is unknown
 */
-static int cmpLsaByIp(const void *this, const void *ip);
+static int subnetKey(const struct sockaddr *client, uint32_t *key);
 
 /**
-   Set all of the nodes in the list of graph nodes to infinite weight.
-   This is called in preparation for the Djikstra's algorithm
-
-   @param graphNodes a list of nodes in the graph
+   Return the rendezvous score of the server with key serverKey for the
+   subnet with key clientKey.
 */
-static void infAllNodes(Node *graphNodes);
-
-/**
-   Return the linked list node containing the graph node with the smallest
-   weight in list L.
-
-   @param L the list of nodes to find minimum node from
-
-   @return a valid list to node with the min weight if success, NULL otherwise.
-*/
-static Node *findMinWeight(Node *node);
-
-/**
-   After running Djikstra's algorithm to change the distance from a given
-   client, return the numerical representation of the ip for the server closest
-   to the client.
-
-   @param config the dns configuration that contains the graph and list of
-   servers
-
-   @return the ip representation of the closest server
- */
-static const char *minWeightedServer(struct dns_config_t *config);
+static uint64_t rendezvousScore(uint32_t serverKey, uint32_t clientKey);
 
 int dns_ParseConfig(struct dns_config_t *config, int argc, char **argv)
 {
 	int opt;
+	char *end;
+	unsigned long workers;
 
 	/* Determine Load Balancing Type */
 	config->lbType = GEO;
+	config->workers = 1;
 	while((opt = getopt(argc, argv, OPT_STRING)) != -1) {
 		switch(opt) {
 		case 'r':
 			config->lbType = RR;
 			break;
+		case 'p':
+			config->lbType = LOAD;
+			break;
+		case 'a':
+			config->lbType = HASH;
+			break;
+		case 's':
+			config->lbType = WRR;
+			break;
+		case 'c':
+			config->controlPort = optarg;
+			break;
+		case 'l':
+			config->loadPort = optarg;
+			break;
+		case 'w':
+			errno = 0;
+			workers = strtoul(optarg, &end, 10);
+			if (errno || *end || !workers ||
+			    workers > MAX_WORKERS) {
+				log(DEFAULT_LOG, "workers must be 1 to %d.\n",
+				    MAX_WORKERS);
+				return EXIT_FAILURE;
+			}
+			config->workers = workers;
+			break;
+		case 'n':
+			config->prefixFile = optarg;
+			break;
+		case 'o':
+			config->compileFile = optarg;
+			break;
+		case 'i':
+			if (dns_ParseHealth(config, optarg)) {
+				log(DEFAULT_LOG, "improper health check "
+				    "option.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'z':
+			config->zonesFile = optarg;
+			break;
+		case 'f':
+			config->feedbackPort = optarg;
+			break;
+		case 'b':
+			if (logParseRotate(optarg, &(config->logRotate))) {
+				log(DEFAULT_LOG, "improper log rotation.\n");
+				return EXIT_FAILURE;
+			}
+			config->asyncLog = 1;
+			break;
+		case 'x':
+			config->binaryLog = 1;
+			break;
+		case 'q':
+			if (dns_ParseRateLimit(config, optarg)) {
+				log(DEFAULT_LOG, "improper rate limit.\n");
+				return EXIT_FAILURE;
+			}
+			break;
 		default: /* '?' */
 			break;
 		}
 	}
 
-	if ((config->lbType == RR && argc < 7) ||
-	    (config->lbType == GEO && argc < 6)) {
+	if (argc - optind < 5) {
 		log(DEFAULT_LOG, "not enough arguments.\n");
 		return EXIT_FAILURE;
 	}
 
-	if (config->lbType == RR) {
-		/* round robin */
-		config->logFilename = argv[2];
-		config->ip = argv[3];
-		config->port = argv[4];
-		config->serversFile = argv[5];
-		config->lsaFile = argv[6];
-		rrIndex = 0;
-	} else { /* geographic */
-		config->logFilename = argv[1];
-		config->ip = argv[2];
-		config->port = argv[3];
-		config->serversFile = argv[4];
-		config->lsaFile = argv[5];
-	}
+	config->logFilename = argv[optind];
+	config->ip = argv[optind + 1];
+	config->port = argv[optind + 2];
+	config->serversFile = argv[optind + 3];
+	config->lsaFile = argv[optind + 4];
 
 	return EXIT_SUCCESS;
 }
@@ -149,9 +165,9 @@ int dns_ParseConfig(struct dns_config_t *config, int argc, char **argv)
 int dns_ParseServers(struct dns_config_t *config)
 {
 	FILE *file;
-	char *ip = NULL;
-	size_t ipSize;
-	int length;
+	char *line = NULL, *ip, *weight, *save;
+	size_t lineSize;
+	long server;
 
 	if (!(file = fopen(config->serversFile, "r"))) {
 		perror("fopen");
@@ -159,368 +175,313 @@ int dns_ParseServers(struct dns_config_t *config)
 		return EXIT_FAILURE;
 	}
 
-	memset(&config->servers, 0, MAX_SERVERS * sizeof(config->servers[0]));
-	config->serversCount = 0;
-
-	/* read servers file one line at a time and store the ip address
-	   in the servers array */
-	while((length = getline(&ip, &ipSize, file)) != -1) {
-		if (!(config->servers[config->serversCount] =
-		      strndup(ip, length - 1))) {
-			perror("strdup");
-			fclose(file);
-			freeServers(config);
-			return EXIT_FAILURE;
-		}
+	freeServers(config);
 
-		log(DEFAULT_LOG, "servers %s\n",
-		    config->servers[config->serversCount]);
+	/* read servers file one line at a time and register the ip address */
+	while(getline(&line, &lineSize, file) != -1) {
+		if (!(ip = strtok_r(line, " \t\r\n", &save)))
+			continue;
 
-		config->serversCount++;
-
-		if (config->serversCount > MAX_SERVERS) {
-			log(DEFAULT_LOG, "servers exceed limit of %d\n",
-			    MAX_SERVERS);
-			config->serversCount--;;
-			fclose(file);
-			freeServers(config);
-			return EXIT_FAILURE;
+		weight = strtok_r(NULL, " \t\r\n", &save);
+		if ((server = registerServer(config, ip, strlen(ip))) == -1 ||
+		    (weight && parseWeight(weight,
+					   &(config->servers[server].weight)))) {
+			log(DEFAULT_LOG, "improper server line.\n");
+			goto fail;
 		}
+
+		log(DEFAULT_LOG, "servers %s weight %u\n",
+		    config->servers[server].ip,
+		    config->servers[server].weight);
 	}
 
-	if (ip)
-		free(ip);
+	if (dns_ParseZones(config))
+		goto fail;
 
+	free(line);
 	fclose(file);
 
 	return EXIT_SUCCESS;
+
+fail:
+	fclose(file);
+	free(line);
+	freeServers(config);
+	return EXIT_FAILURE;
 }
 
 int dns_ConstructGraph(struct dns_config_t *config)
 {
-	FILE *file;
-	char *line = NULL;
-	size_t lineLen;
-	char ip[NI_MAXHOST];
-	int seqNum;
-	char *neighbors;
-	Node *list;
-	int length;
-
-	if (!(file = fopen(config->lsaFile, "r"))) {
-		perror("fopen");
-		log(DEFAULT_LOG, "fopen lsa file failed.\n");
-		return EXIT_FAILURE;
-	}
-
-	list = NULL;
-	while((length = getline(&line, &lineLen, file)) != -1) {
-		log(DEFAULT_LOG, "%s\n", line);
+	int ret;
 
-		memset(ip, 0, NI_MAXHOST);
-		neighbors = calloc(length, sizeof(char));
-		if (!neighbors) {
-			log(DEFAULT_LOG, "failed to calloc for lsa neighbors.\n");
-			return EXIT_FAILURE;
-		}
+	/* a compiled topology is loaded as is, an LSA file is parsed */
+	if (isCompiledTopology(config->lsaFile))
+		ret = dns_LoadTopology(config, config->lsaFile);
+	else
+		ret = parseLSAFile(config);
 
-		/* break down line: ip sequence number neighbors */
-		if (sscanf(line, LSA_FMT, ip, &seqNum, neighbors) < 3) {
-			log(DEFAULT_LOG, "improper LSA format line.\n");
-			free(neighbors);
-			return EXIT_FAILURE;
-		}
-
-		log(DEFAULT_LOG, "parsed: %s %d %s\n", ip, seqNum, neighbors);
-
-		if (storeLatestLSA(&list, ip, seqNum, neighbors)) {
-			log(DEFAULT_LOG, "store latest LSA failed.\n");
-			free(neighbors);
-			return EXIT_FAILURE;
-		}
+	if (ret)
+		return EXIT_FAILURE;
 
-		free(neighbors);
+	if (dns_BuildPoolNearest(config)) {
+		log(DEFAULT_LOG, "failed to build pool tables.\n");
+		return EXIT_FAILURE;
 	}
 
-	if (constructNetworkGraph(config, &list)) {
-		log(DEFAULT_LOG, "failed to construct network graph.\n");
+	if (dns_ParsePrefixes(config)) {
+		log(DEFAULT_LOG, "failed to parse client networks.\n");
 		return EXIT_FAILURE;
 	}
 
 	return EXIT_SUCCESS;
 }
 
-static int constructNetworkGraph(struct dns_config_t *config, Node **list)
+static int parseWeight(const char *str, uint32_t *weight)
 {
-	Node *tmp;
-	struct lsa *lsa;
-	char *neighborTok;
+	char *end;
+	unsigned long n;
 
-	if (!list || !(*list))
+	errno = 0;
+	n = strtoul(str, &end, 10);
+	if (errno || *end || end == str || !n || n > MAX_WEIGHT)
 		return EXIT_FAILURE;
 
-	/* for each ip in the list, construct the ip's neighbors */
-	for(tmp = *list; tmp; tmp = tmp->next) {
-		lsa = tmp->data;
-
-		/* parse individual neighbor */
-		neighborTok = strtok(lsa->neighbors, ",\n");
-		log(DEFAULT_LOG, "%s:%s\n", lsa->ip, neighborTok);
-
-		while (neighborTok) {
-			if (connectNodes(config, lsa->ip, neighborTok)) {
-				log(DEFAULT_LOG, "failed to connect %s <--> %s",
-				    lsa->ip, neighborTok);
-				return EXIT_FAILURE;
-			}
-
-			neighborTok = strtok(NULL, ",\n");
-		}
-	}
-
-#ifdef DEBUG
-	struct graph_node_t *node;
-	if (config->graphNodes) {
-		for (tmp = config->graphNodes; tmp; tmp = tmp->next) {
-			node = tmp->data;
-			printGraph(node);
-		}
-	}
-#endif
+	*weight = n;
 	return EXIT_SUCCESS;
 }
 
-static int connectNodes(struct dns_config_t *config, char *ip, char *neighborTok)
+static int parseLSAFile(struct dns_config_t *config)
 {
-	Node *n1, *n2; /* linked list nodes */
-	struct graph_node_t *v1, *v2; /* vertices */
-
-	/* find or create graph node with id ip */
-	n1 = node_find(config->graphNodes, cmpGraphById, ip);
-	if (n1) {
-		v1 = n1->data;
-	} else {
-		v1 = newGraphNode(ip);
-		if (!v1) {
-			log(DEFAULT_LOG, "failed to calloc graph_node.\n");
-			return EXIT_FAILURE;
-		}
-
-		n1 = node_insert(&(config->graphNodes), v1);
-		if (!n1) {
-			log(DEFAULT_LOG, "failed to insert node to graph list.\n");
-			free(v1);
-			return EXIT_FAILURE;
-		}
+	if (graphInit(&(config->graph), 0)) {
+		log(DEFAULT_LOG, "failed to init graph.\n");
+		return EXIT_FAILURE;
 	}
 
-	/* find or create graph node with id neighborTok */
-	n2 = node_find(config->graphNodes, cmpGraphById, neighborTok);
-	if (n2) {
-		v2 = n2->data;
-	} else {
-		v2 = newGraphNode(neighborTok);
-		if (!v2) {
-			log(DEFAULT_LOG, "failed to calloc graph_node.\n");
-			node_delete(&(config->graphNodes), n1, NULL);
-			free(v1);
-			return EXIT_FAILURE;
-		}
+	if (dns_ReadLSAFile(config)) {
+		log(DEFAULT_LOG, "failed to read LSA file.\n");
+		return EXIT_FAILURE;
+	}
 
-		n2 = node_insert(&(config->graphNodes), v2);
-		if (!n2) {
-			log(DEFAULT_LOG, "failed to insert node to graph list.\n");
-			node_delete(&(config->graphNodes), n1, NULL);
-			free(v1);
-			free(v2);
-			return EXIT_FAILURE;
-		}
+	if (!config->graph.vertexCount || dns_BuildTopology(config)) {
+		log(DEFAULT_LOG, "failed to construct network graph.\n");
+		return EXIT_FAILURE;
 	}
 
-	if (!edgeExists(v1, v2)) {
-		if (addEdge(v1, v2)) {
-			log(DEFAULT_LOG, "failed to add edge.\n");
-			node_delete(&(config->graphNodes), n1, NULL);
-			node_delete(&(config->graphNodes), n2, NULL);
-			free(v1);
-			free(v2);
-			return EXIT_FAILURE;
-		}
+	linkServers(config);
+
+	if (dns_BuildNearest(config)) {
+		log(DEFAULT_LOG, "failed to build nearest-server table.\n");
+		return EXIT_FAILURE;
 	}
 
 	return EXIT_SUCCESS;
 }
 
-static int cmpLsaByIp(const void *this, const void *that)
+size_t getRRIP(struct dns_config_t *config, struct zone_t *zone,
+	       size_t *servers, size_t n)
 {
-	struct lsa *lsa = (struct lsa *)this;
-	return strcmp(lsa->ip, that);
-}
-
-static int storeLatestLSA(Node **list, char *ip, int seqNum, char *neighbors)
-{
-	Node *tmp;
-	struct lsa *tmpLSA;
-
-	if (list == NULL)
-		return EXIT_FAILURE;
+	unsigned first;
 
-	tmp = node_find(*list, cmpLsaByIp, ip);
+	if (zone->poolCount == 0)
+		return 0;
 
-	if (!tmp) {
-		/* ip has not been stored in the list */
-		tmpLSA = calloc(1, sizeof(*tmpLSA));
-		if (!tmpLSA) {
-			log(DEFAULT_LOG, "calloc for lsa struct failed.\n");
-			return EXIT_FAILURE;
-		}
+	first = atomic_fetch_add_explicit(&(zone->next), 1,
+					  memory_order_relaxed);
+	return rotateFrom(config, zone, first % zone->poolCount, servers, n);
+}
 
-		tmpLSA->ip = strdup(ip);
-		if (!(tmpLSA->ip)) {
-			log(DEFAULT_LOG, "strdup failed for ip.\n");
-			return EXIT_FAILURE;
-		}
+size_t getWRRIP(struct dns_config_t *config, struct zone_t *zone,
+		size_t *servers, size_t n)
+{
+	unsigned pick;
 
-		tmpLSA->neighbors = strdup(neighbors);
-		if (!(tmpLSA->neighbors)) {
-			log(DEFAULT_LOG, "strdup failed for neighbors.\n");
-			free(tmpLSA->ip);
-			return EXIT_FAILURE;
-		}
+	if (zone->rotationCount == 0)
+		return 0;
 
-		tmpLSA->seqNum = seqNum;
-		node_insert(list, tmpLSA);
-	} else {
-		/* new LSA is more current */
-		tmpLSA = tmp->data;
-		if (tmpLSA->seqNum < seqNum) {
-			free(tmpLSA->neighbors);
-
-			tmpLSA->seqNum = seqNum;
-			tmpLSA->neighbors = strdup(neighbors);
-			if (!(tmpLSA->neighbors)) {
-				log(DEFAULT_LOG, "strdup failed for neighbors.\n");
-				fflush(stdout);
-				return EXIT_FAILURE;
-			}
-		}
-	}
-
-	log(DEFAULT_LOG, "stored %s:%s\n", tmpLSA->ip, tmpLSA->neighbors);
-	return EXIT_SUCCESS;
+	pick = atomic_fetch_add_explicit(&(zone->next), 1,
+					 memory_order_relaxed);
+	return rotateFrom(config, zone,
+			  zone->rotation[pick % zone->rotationCount], servers,
+			  n);
 }
 
-void freeServers(struct dns_config_t *config)
+static size_t rotateFrom(const struct dns_config_t *config,
+			 const struct zone_t *zone, size_t first,
+			 size_t *servers, size_t n)
 {
-	size_t i;
-	for (i = 0; i < config->serversCount; i++) {
-		free(config->servers[i]);
+	size_t i, out, next;
+
+	n = min(n, zone->poolCount);
+	for (i = 0, out = 0; i < zone->poolCount && out < n; i++) {
+		next = zone->pool[(first + i) % zone->poolCount];
+		if (isHealthy(config, next))
+			servers[out++] = next;
 	}
-}
 
-const char *getRRIP(struct dns_config_t *config)
-{
-	if (config->serversCount == 0)
-		return NULL;
+	for (i = 0; !out && i < n; i++)
+		servers[i] = zone->pool[(first + i) % zone->poolCount];
 
-	return config->servers[rrIndex++ % config->serversCount];
+	return out ? out : n;
 }
 
-const char *getGEOIP(struct dns_config_t *config, char *ip)
+size_t getGEOIP(const struct dns_config_t *config,
+		const struct snapshot_t *snapshot,
+		const struct zone_t *zone, const struct sockaddr *client,
+		size_t *servers, size_t n)
 {
-	Node *unvisited; /* set of vertices not visited */
-	Node *curr;
-	Node *neighbor;
-	struct graph_node_t *gcurr; /* current graph node */
-	struct graph_node_t *gneighbor; /* neighbor graph node */
-	int weight;
-
-	if (!node_dup_list(config->graphNodes, &unvisited)) {
-		log(DEFAULT_LOG, "failed to duplicte graph nodes.\n");
-		return NULL;
+	const struct sockaddr_in *v4 = (const struct sockaddr_in *) client;
+	const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) client;
+	const struct nearest_t *nearest;
+	char ip[INET6_ADDRSTRLEN];
+	size_t closest[DNS_MAX_ANSWERS], count, i;
+	uint32_t dists[DNS_MAX_ANSWERS];
+	long v;
+
+	if (!snapshot || zone->ranking > snapshot->poolNearestCount)
+		return 0;
+
+	/* clients attach as vertices themselves, IPv4 ones by prefix too */
+	if (client->sa_family == AF_INET &&
+	    inet_ntop(AF_INET, &(v4->sin_addr), ip, sizeof(ip))) {
+		v = findVertex(&(snapshot->graph), ip);
+		if (v == -1)
+			v = prefixLookup(snapshot->prefixes, &(v4->sin_addr));
+	} else if (client->sa_family == AF_INET6 &&
+		   inet_ntop(AF_INET6, &(v6->sin6_addr), ip, sizeof(ip))) {
+		v = findVertex(&(snapshot->graph), ip);
+	} else {
+		v = -1;
 	}
 
-	log(DEFAULT_LOG, "running djikstra's on %s\n", ip);
-	infAllNodes(unvisited); /* max weight all nodes */
+	if (v == -1) {
+		log(DEFAULT_LOG, "client not attached to the graph\n");
+		return 0;
+	}
 
-	/* set the current node with weight 0 */
-	curr = node_find(unvisited, cmpGraphById, ip);
-	gcurr = curr->data;
-	gcurr->weight = 0;
+	/* the closest servers of the pool of the zone, reordered by the
+	   throughput the client reported for them */
+	nearest = zone->ranking ? &(snapshot->poolNearest[zone->ranking - 1]) :
+		&(snapshot->nearest);
+	count = nearestServers(nearest, v, closest, dists, DNS_MAX_ANSWERS);
+	rankByFeedback(config, client, closest, dists, count);
 
-	while(unvisited) {
-		curr = findMinWeight(unvisited);
-		gcurr = curr->data;
+	n = min(n, count);
+	for (i = 0; i < n; i++)
+		servers[i] = closest[i];
 
-		for(neighbor = gcurr->neighbors; neighbor;
-		    neighbor = neighbor->next) {
-			if (node_find(unvisited, cmpGraphById, gcurr->id)) {
-				/* only consider the unvisited */
-				gneighbor = neighbor->data;
+	return n;
+}
 
-				/* new weight = current + distance */
-				weight = gcurr->weight + 1;
-				if (weight < gneighbor->weight)
-					gneighbor->weight = weight;
-			}
+size_t getLoadIP(struct dns_config_t *config,
+		 const struct snapshot_t *snapshot, const struct zone_t *zone,
+		 const struct sockaddr *client, size_t *servers, size_t n,
+		 unsigned *seed)
+{
+	size_t candidates[DNS_MAX_ANSWERS];
+	size_t count, a, b, pick, i, out;
+	mytime_t now;
+	int reported;
+
+	count = getGEOIP(config, snapshot, zone, client, candidates,
+			 DNS_MAX_ANSWERS);
+	if (!count || !n)
+		return 0;
+
+	now = microtime(NULL);
+	for (i = 0, reported = 0; i < count && !reported; i++)
+		reported = hasLoadReport(config, candidates[i], now);
+
+	/* two distinct random candidates, a being the closer one.  The
+	   farther one only wins with more headroom.  Without any report this
+	   is plain geographic balancing */
+	pick = 0;
+	if (count > 1 && reported) {
+		a = rand_r(seed) % count;
+		b = rand_r(seed) % (count - 1);
+		if (b >= a)
+			b++;
+		if (b < a) {
+			i = a;
+			a = b;
+			b = i;
 		}
 
-		node_delete(&unvisited, curr, NULL);
+		pick = moreHeadroom(config, candidates[b], candidates[a],
+				    now) ? b : a;
 	}
 
-	return minWeightedServer(config);
+	/* the pick first, then the rest of the candidates closest first */
+	servers[0] = candidates[pick];
+	for (i = 0, out = 1; i < count && out < n; i++)
+		if (i != pick)
+			servers[out++] = candidates[i];
+
+	return out;
 }
 
-static void infAllNodes(Node *graphNodes)
+size_t getHashIP(struct dns_config_t *config, const struct zone_t *zone,
+		 const struct sockaddr *client, size_t *servers, size_t n)
 {
-	Node *tmp;
-	struct graph_node_t *gnode;
-
-	for(tmp = graphNodes; tmp; tmp = tmp->next) {
-		gnode = tmp->data;
-		gnode->weight = INT_MAX;
+	uint64_t scores[DNS_MAX_ANSWERS], score;
+	size_t i, j, count, server;
+	uint32_t key;
+	mytime_t now;
+
+	if (!zone->poolCount || !subnetKey(client, &key))
+		return 0;
+
+	/* the n highest scores, servers that are down scoring below any
+	   other and full ones below the rest */
+	n = min(n, min(zone->poolCount, DNS_MAX_ANSWERS));
+	now = microtime(NULL);
+	for (i = 0, count = 0; i < zone->poolCount; i++) {
+		server = zone->pool[i];
+		score = rendezvousScore(config->servers[server].key, key) >> 2;
+		if (isHealthy(config, server))
+			score |= (uint64_t) 1 << 63;
+		if (!isFull(config, server, now))
+			score |= (uint64_t) 1 << 62;
+
+		if (count == n && score <= scores[n - 1])
+			continue;
+
+		if (count < n)
+			count++;
+		for (j = count - 1; j > 0 && scores[j - 1] < score; j--) {
+			scores[j] = scores[j - 1];
+			servers[j] = servers[j - 1];
+		}
+		scores[j] = score;
+		servers[j] = server;
 	}
+
+	return count;
 }
 
-static Node *findMinWeight(Node *node)
+static int subnetKey(const struct sockaddr *client, uint32_t *key)
 {
-	struct graph_node_t *gnode;
-	int minWeight;
-	Node *min = node;
-
-	minWeight = INT_MAX;
-	for(; node; node = node->next) {
-		gnode = node->data;
+	const struct sockaddr_in *v4 = (const struct sockaddr_in *) client;
+	const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) client;
 
-		if (gnode->weight < minWeight) {
-			minWeight = gnode->weight;
-			min = node;
-		}
-	}
+	if (client->sa_family == AF_INET)
+		*key = ht_hash(&(v4->sin_addr), SUBNET4_BYTES);
+	else if (client->sa_family == AF_INET6)
+		*key = ht_hash(&(v6->sin6_addr), SUBNET6_BYTES);
+	else
+		return 0;
 
-	return min;
+	return 1;
 }
 
-static const char *minWeightedServer(struct dns_config_t *config)
+static uint64_t rendezvousScore(uint32_t serverKey, uint32_t clientKey)
 {
-	size_t i;
-	const char *ip;
-	int minWeight;
-	Node *node;
-	struct graph_node_t *gnode;
-
-	minWeight = INT_MAX;
-	ip = DEFAULT_IP;
-	for (i = 0; i < config->serversCount; ++i) {
-		node = node_find(config->graphNodes, cmpGraphById,
-				 config->servers[i]);
-		gnode = node->data;
-
-		if (gnode->weight < minWeight) {
-			minWeight = gnode->weight;
-			ip = config->servers[i];
-		}
-	}
-
-	return ip;
+	uint64_t x = ((uint64_t) serverKey << 32) | clientKey;
+
+	/* the splitmix64 finalizer, so that every bit of both keys counts */
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
 }
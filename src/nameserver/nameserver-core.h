@@ -5,6 +5,8 @@
 #include <netdb.h>
 
 struct dns_config_t;
+struct snapshot_t;
+struct zone_t;
 
 /**
    Take the arguments provided through the command line arguments to get
@@ -15,35 +17,83 @@ struct dns_config_t;
 int dns_ParseConfig(struct dns_config_t *config, int argc, char **argv);
 
 /**
-   Parse the list of servers in the servers list in config.
+   Parse the list of servers in the servers list in config, and the zones
+   of its zones file.
 
    return 0 for success, 1 for failure
 */
 int dns_ParseServers(struct dns_config_t *config);
 
 /**
-   free all of the server addressed stored in the servers array in config
+   Given a client address, rank the video servers based on geographical
+   difference in the topology snapshot from the vertex the client attaches
+   to, and store the indices into the servers of up to n of them in servers,
+   closest first.  The DNS_MAX_ANSWERS closest servers in the pool of zone
+   are taken from the table of its pool, and ranked by the throughput the
+   client reported for them in config's feedback if it did.
+
+   return the number of servers stored, 0 if none could be found.
+*/
+size_t getGEOIP(const struct dns_config_t *config,
+		const struct snapshot_t *snapshot,
+		const struct zone_t *zone, const struct sockaddr *client,
+		size_t *servers, size_t n);
+
+/**
+   Given a client address, pick two of its closest servers in the pool of
+   zone in the topology snapshot at random and prefer the one with more headroom in
+   config's load reports (power of two choices).  Without any report for the
+   closest servers this is getGEOIP.  The pick is stored first in servers,
+   followed by the other closest servers, up to n of them.
+
+   @param seed the rand_r state of the calling thread
+
+   return the number of servers stored, 0 if none could be found.
+*/
+size_t getLoadIP(struct dns_config_t *config,
+		 const struct snapshot_t *snapshot, const struct zone_t *zone,
+		 const struct sockaddr *client, size_t *servers, size_t n,
+		 unsigned *seed);
+
+/**
+   Store the indices into config's servers of up to n video servers of the
+   pool of zone in servers based on round robin selecting.  The first server
+   is the next one in the rotation and the rest follow it in the pool order,
+   passing over servers that are down.
+
+   return the number of servers stored, 0 if none could be found.
 */
-void freeServers(struct dns_config_t *config);
+size_t getRRIP(struct dns_config_t *config, struct zone_t *zone,
+	       size_t *servers, size_t n);
 
 /**
-   Given a client identified by ip, find the closest video server
-   based on geographical difference.
+   Store the indices into config's servers of up to n video servers of the
+   pool of zone in servers based on smooth weighted round robin selecting.
+   The first server is the next one in zone's rotation, so every server is
+   first in a share of the answers given by its weight, and the rest follow
+   it in the pool order, passing over servers that are down.
 
-   return a valid ip if one is successfully found, NULL otherwise.
+   return the number of servers stored, 0 if none could be found.
 */
-const char *getGEOIP(struct dns_config_t *config, char *ip);
+size_t getWRRIP(struct dns_config_t *config, struct zone_t *zone,
+		size_t *servers, size_t n);
 
 /**
-   Return the next video ip address available based on round robin selecting
+   Given a client address, rank the pool of zone by rendezvous hashing of
+   the client subnet and store the indices of the n highest ranked ones in
+   servers, highest first.  Clients of a subnet keep their servers while
+   other servers come and go.  Servers that are down are ranked last, and
+   servers that report no headroom left in config's load reports after the
+   rest.
 
-   return a valid ip if one is successfully found, NULL otherwise.
+   return the number of servers stored, 0 if none could be found.
 */
-const char *getRRIP(struct dns_config_t *config);
+size_t getHashIP(struct dns_config_t *config, const struct zone_t *zone,
+		 const struct sockaddr *client, size_t *servers, size_t n);
 
 /**
    Parse the list of LSAs in config's lsa file list and construct the network graph
-   from them.
+   from them, or load them all from the compiled topology in its place.
 
    @param config the dns configuration that has the lsa list and where the network graph will be saved to.
 
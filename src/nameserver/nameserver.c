@@ -1,47 +1,157 @@
 /*
   Functions for manipulating the state of the nameserver
 */
+#define _GNU_SOURCE /* recvmmsg and sendmmsg */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <sys/select.h>
 #include <netdb.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "nameserver.h"
 #include "nameserver-core.h"
+#include "response.h"
+#include "nearest.h"
+#include "servers.h"
+#include "lsa.h"
+#include "snapshot.h"
+#include "load.h"
+#include "prefix.h"
+#include "topology.h"
+#include "health.h"
+#include "ratelimit.h"
+#include "zones.h"
+#include "feedback.h"
 #include "../common/mydnsparse.h"
 #include "../common/log.h"
 #include "../common/mytime.h"
+#include "../common/actlog.h"
 
 #define BUF_SIZE 4096
-#define FMT "%f %s %s %s\n" /* time client-ip query-name response-ip */
+#define BATCH_SIZE 32 /* datagrams received and answered per syscall */
 
 /**
-   Start the DNS server.
+   The datagrams a worker received with one recvmmsg, and the replies it sends
+   back with one sendmmsg.  A reply goes to the address its query came from.
+*/
+struct dns_batch_t {
+	struct mmsghdr queries[BATCH_SIZE];
+	struct mmsghdr replies[BATCH_SIZE];
+	struct iovec queryIov[BATCH_SIZE];
+	struct iovec replyIov[BATCH_SIZE];
+	struct sockaddr_storage addrs[BATCH_SIZE];
+	uint8_t queryBufs[BATCH_SIZE][BUF_SIZE];
+	uint8_t replyBufs[BATCH_SIZE][DNS_BUF_SIZE];
+};
+
+/**
+   A query thread.  Every worker receives on its own socket, the kernel
+   spreading the queries over them, and reads the topology as its own snapshot
+   reader.
+*/
+struct dns_worker_t {
+	struct dns_config_t *config;
+	pthread_t thread;
+	int socket;
+	size_t reader; /* snapshot reader, also the index of the worker */
+	unsigned seed; /* rand_r state */
+	struct dns_batch_t *batch;
+};
+
+/**
+   Create a UDP socket bound to config's ip and port.  With reuse set, other
+   sockets may be bound to the same address with reuse set as well.
 
-   return 0 on success, -1 on failure.
+   return the socket on success, -1 on failure.
 */
-static int setupListen(struct dns_config_t *config);
+static int setupListen(struct dns_config_t *config, const char *port,
+		       int reuse);
 
 /**
-   Process the buffer buf of size len that was filled by a recvfrom call
+   Format the numerical representation "127.0.0.1" of addr into name, the
+   empty string if it is not an IP address.
 */
-static void processRecvfrom(struct dns_config_t *config, uint8_t *buf,
-			    ssize_t len, struct sockaddr *src_addr,
-			    socklen_t addlen);
+static void clientName(const struct sockaddr *addr, char *name, size_t len);
 
 /**
-   Start the DNS server
+   Start config's log as a binary activity log, naming every server by its
+   index and every zone by its index after the servers.
+
+   return 0 on success, 1 on failure.
+*/
+static int startActivityLog(struct dns_config_t *config);
+
+/**
+   Log the answer server to the query of zone from client as a binary
+   activity record.
+*/
+static void logQuery(struct dns_config_t *config,
+		     const struct sockaddr *client, const struct zone_t *zone,
+		     size_t server);
+
+/**
+   Answer the query buf of size len that worker received from src_addr,
+   filling the reply into response of size responseSize.
+
+   return the length of the reply, -1 if there is none to send.
+*/
+static ssize_t processQuery(struct dns_worker_t *worker, const uint8_t *buf,
+			    ssize_t len, const struct sockaddr *src_addr,
+			    uint8_t *response, size_t responseSize);
+
+/**
+   Apply the LSAs, one per line, of the terminated datagram buf that was
+   received on the control socket
+
+   return the number of LSAs applied.
+*/
+static int processControl(struct dns_config_t *config, char *buf);
+
+/**
+   Record the load reports, one per line, of the terminated datagram buf that
+   was received on the load socket
+*/
+static void processLoad(struct dns_config_t *config, char *buf);
+
+/**
+   Record the throughput reports, one per line, of the terminated datagram
+   buf that the proxy at address proxy sent to the feedback socket
+*/
+static void processFeedback(struct dns_config_t *config,
+			    const struct sockaddr *proxy, char *buf);
+
+/**
+   Control thread: apply the LSAs received on the control socket and publish
+   a new topology snapshot after every batch of them, and record the load
+   reports received on the load socket and the throughput reports received
+   on the feedback socket
+*/
+static void *dns_Control(void *arg);
+
+/**
+   Query loop of a worker
+*/
+static void *dns_Work(void *arg);
+
+/**
+   Start the DNS server with config's workers, the calling thread being the
+   first one.  The sockets of the others are opened here, the first one uses
+   config's socket.
 */
 static void dns_Start(struct dns_config_t *config);
 
 int main(int argc, char **argv)
 {
 	struct dns_config_t config;
+	pthread_t control, health;
+	int controlRunning, healthRunning, ret;
+	const char *failed;
 
 	memset(&config, 0, sizeof(config));
 	if (dns_ParseConfig(&config, argc, argv)) {
@@ -55,34 +165,185 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (config.asyncLog && logAsync(config.log, config.logFilename,
+					 &(config.logRotate)))
+		log(DEFAULT_LOG, "async log failed, logging synchronously.\n");
+
 	if (dns_ParseServers(&config)) {
 		log(DEFAULT_LOG, "parse servers failed.\n");
 		logClose(&(config.log));
 		return EXIT_FAILURE;
 	}
 
-	if(config.lbType == GEO) {
-		if (dns_ConstructGraph(&config)) {
+	if (config.binaryLog && startActivityLog(&config)) {
+		log(DEFAULT_LOG, "start binary log failed.\n");
+		freeZones(&config);
+		freeServers(&config);
+		logClose(&(config.log));
+		return EXIT_FAILURE;
+	}
+
+	/* compiling only needs the servers and the topology */
+	if (config.compileFile) {
+		ret = dns_ConstructGraph(&config) ||
+			dns_CompileTopology(&config, config.compileFile);
+		freePrefixes(&config);
+		freeNearest(&config);
+		freeLSAs(&config);
+		freeGraph(&(config.graph));
+		freeZones(&config);
+		freeServers(&config);
+		logClose(&(config.log));
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	failed = NULL;
+	if (dns_BuildTemplates(&config))
+		failed = "build response templates failed.\n";
+	else if (loadInit(&config))
+		failed = "setup server loads failed.\n";
+	else if (config.healthInterval && healthInit(&config))
+		failed = "setup health checks failed.\n";
+	else if (config.rateLimit && rateInit(&config))
+		failed = "setup rate limit failed.\n";
+	if (failed) {
+		log(DEFAULT_LOG, "%s", failed);
+		freeRateLimit(&config);
+		freeHealth(&config);
+		freeLoads(&config);
+		freeTemplates(&config);
+		freeZones(&config);
+		freeServers(&config);
+		logClose(&(config.log));
+		return EXIT_FAILURE;
+	}
+
+	if (snapshotInit(&config, config.workers)) {
+		log(DEFAULT_LOG, "setup snapshots failed.\n");
+		freeRateLimit(&config);
+		freeHealth(&config);
+		freeLoads(&config);
+		freeTemplates(&config);
+		freeZones(&config);
+		freeServers(&config);
+		logClose(&(config.log));
+		return EXIT_FAILURE;
+	}
+
+	if(zonesUseGraph(&config)) {
+		if (dns_ConstructGraph(&config) || dns_PublishSnapshot(&config)) {
 			log(DEFAULT_LOG, "failed to construct graph.\n");
 			logClose(&(config.log));
 			return EXIT_FAILURE;
 		}
 	}
 
-	config.socket = setupListen(&config);
+	config.controlSocket = -1;
+	if (config.controlPort) {
+		config.controlSocket = setupListen(&config, config.controlPort,
+						  0);
+		if (config.controlSocket == -1)
+			log(DEFAULT_LOG, "control socket failed, LSAs are only "
+			    "read at startup.\n");
+	}
+
+	config.loadSocket = -1;
+	if (config.loadPort) {
+		config.loadSocket = setupListen(&config, config.loadPort, 0);
+		if (config.loadSocket == -1)
+			log(DEFAULT_LOG, "load socket failed, servers are picked "
+			    "without load reports.\n");
+	}
+
+	config.feedbackSocket = -1;
+	if (config.feedbackPort) {
+		config.feedbackSocket = setupListen(&config,
+						    config.feedbackPort, 0);
+		if (config.feedbackSocket != -1 && feedbackInit(&config)) {
+			close(config.feedbackSocket);
+			config.feedbackSocket = -1;
+		}
+		if (config.feedbackSocket == -1)
+			log(DEFAULT_LOG, "feedback socket failed, servers are "
+			    "ranked without proxy reports.\n");
+	}
+
+	config.socket = setupListen(&config, config.port,
+				    config.workers > 1);
 	if (config.socket == -1) {
+		if (config.controlSocket != -1)
+			close(config.controlSocket);
+		if (config.loadSocket != -1)
+			close(config.loadSocket);
+		if (config.feedbackSocket != -1)
+			close(config.feedbackSocket);
+		freeSnapshots(&config);
+		freeNearest(&config);
+		freePrefixes(&config);
+		freeLSAs(&config);
+		freeGraph(&(config.graph));
+		freeFeedback(&config);
+		freeRateLimit(&config);
+		freeHealth(&config);
+		freeLoads(&config);
+		freeTemplates(&config);
+		freeZones(&config);
 		freeServers(&config);
 		log(DEFAULT_LOG, "start dns failed.\n");
 		logClose(&(config.log));
 		return EXIT_FAILURE;
 	}
 
+	controlRunning = (config.controlSocket != -1 ||
+			  config.loadSocket != -1 ||
+			  config.feedbackSocket != -1 ||
+			  config.health != NULL);
+	if (controlRunning &&
+	    pthread_create(&control, NULL, dns_Control, &config)) {
+		log(DEFAULT_LOG, "failed to start control thread.\n");
+		controlRunning = 0;
+	}
+
+	healthRunning = config.health != NULL;
+	if (healthRunning &&
+	    pthread_create(&health, NULL, dns_HealthCheck, &config)) {
+		log(DEFAULT_LOG, "failed to start health checks.\n");
+		healthRunning = 0;
+	}
+
 	log(DEFAULT_LOG, "DNS Starting...\n");
 
 	dns_Start(&config);
 
+	if (controlRunning) {
+		pthread_cancel(control);
+		pthread_join(control, NULL);
+	}
+	if (healthRunning) {
+		pthread_cancel(health);
+		pthread_join(health, NULL);
+	}
+	if (config.controlSocket != -1)
+		close(config.controlSocket);
+	if (config.loadSocket != -1)
+		close(config.loadSocket);
+	if (config.feedbackSocket != -1)
+		close(config.feedbackSocket);
+	close(config.socket);
+	freeSnapshots(&config);
+	freeNearest(&config);
+	freePrefixes(&config);
+	freeLSAs(&config);
+	freeGraph(&(config.graph));
+	freeFeedback(&config);
+	freeRateLimit(&config);
+	freeHealth(&config);
+	freeLoads(&config);
+	freeTemplates(&config);
+	freeZones(&config);
 	freeServers(&config);
 	logClose(&(config.log));
+	actlogFree();
 
 	log(DEFAULT_LOG, "DNS Shutting Down...\n");
 
@@ -91,111 +352,413 @@ int main(int argc, char **argv)
 
 static void dns_Start(struct dns_config_t *config)
 {
-	fd_set recvfds;
-	struct sockaddr src_addr;
-	socklen_t addrlen;
-	uint8_t buf[BUF_SIZE];
-	ssize_t size;
+	struct dns_worker_t *workers;
+	size_t i, started;
 
-	while (1) {
-		memset(&src_addr, 0, sizeof(src_addr));
-		addrlen = sizeof(src_addr);
+	if (!(workers = calloc(config->workers, sizeof(*workers)))) {
+		log(DEFAULT_LOG, "failed to calloc workers.\n");
+		return;
+	}
 
-		FD_ZERO(&recvfds);
-		FD_SET(config->socket, &recvfds);
+	for (i = 0; i < config->workers; i++) {
+		workers[i].config = config;
+		workers[i].reader = i;
+		workers[i].seed = (microtime(NULL) ^ getpid()) + i;
+		workers[i].socket = i ? -1 : config->socket;
+	}
 
-		select(config->socket + 1, &recvfds, NULL, NULL, NULL);
+	if (!(workers[0].batch = malloc(sizeof(*(workers[0].batch))))) {
+		log(DEFAULT_LOG, "failed to malloc query batch.\n");
+		free(workers);
+		return;
+	}
 
-		if (FD_ISSET(config->socket, &recvfds)) {
-			if ((size = recvfrom(config->socket, buf, BUF_SIZE, 0,
-					     &src_addr, &addrlen)) == -1)
-				continue;
+	/* a worker that fails to start leaves its share of the queries to the
+	   others */
+	for (i = 1, started = 1; i < config->workers; i++) {
+		if (!(workers[i].batch = malloc(sizeof(*(workers[i].batch)))))
+			break;
+
+		workers[i].socket = setupListen(config, config->port, 1);
+		if (workers[i].socket == -1)
+			break;
 
-			processRecvfrom(config, buf, size, &src_addr, addrlen);
+		if (pthread_create(&(workers[i].thread), NULL, dns_Work,
+				   &(workers[i]))) {
+			close(workers[i].socket);
+			workers[i].socket = -1;
+			break;
 		}
+		started++;
+	}
+
+	if (started < config->workers)
+		log(DEFAULT_LOG, "only started %zu of %zu workers.\n", started,
+		    config->workers);
+
+	dns_Work(&(workers[0]));
+
+	for (i = 1; i < started; i++) {
+		pthread_cancel(workers[i].thread);
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].socket);
 	}
+	for (i = 0; i < config->workers; i++)
+		free(workers[i].batch);
+	free(workers);
 }
 
-static void processRecvfrom(struct dns_config_t *config, uint8_t *buf,
-			    ssize_t len, struct sockaddr *src_addr,
-			    socklen_t addrlen)
+static void *dns_Work(void *arg)
 {
-	struct dns_t *dnsRequest;
-	struct dns_t *dnsReply;
-	const char *ip;
-	uint8_t *response;
+	struct dns_worker_t *worker = arg;
+	struct dns_batch_t *batch = worker->batch;
+	struct mmsghdr *query, *reply;
 	ssize_t responseLen;
-	char client[NI_MAXHOST];
+	mytime_t now;
+	int received, replies, sent, i;
 
-	/* quiet gcc warning */
-	len = len;
+	while (1) {
+		for (i = 0; i < BATCH_SIZE; i++) {
+			batch->queryIov[i].iov_base = batch->queryBufs[i];
+			batch->queryIov[i].iov_len = BUF_SIZE;
+
+			query = &(batch->queries[i]);
+			memset(query, 0, sizeof(*query));
+			query->msg_hdr.msg_name = &(batch->addrs[i]);
+			query->msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+			query->msg_hdr.msg_iov = &(batch->queryIov[i]);
+			query->msg_hdr.msg_iovlen = 1;
+		}
 
-	if (!(dnsRequest = deserialize_dns(buf))) {
-		log(DEFAULT_LOG, "deserialize dns failed.\n");
-		return;
-	}
+		/* block for the first datagram only, then take whatever else
+		   is already queued */
+		received = recvmmsg(worker->socket, batch->queries, BATCH_SIZE,
+				    MSG_WAITFORONE, NULL);
+		if (received == -1)
+			continue;
 
-	/* find numerical representation "127.0.0.1" of the client for logging
-	   and geo load balancing purposes */
-	if (getnameinfo(src_addr, addrlen, client, NI_MAXHOST,
-			NULL, 0, NI_NUMERICHOST)) {
-		perror("getnameinfo");
-		log(DEFAULT_LOG, "failed to get hostname.\n");
-	}
+		/* queries over their client's rate are dropped unread */
+		now = microtime(NULL);
+		for (i = 0, replies = 0; i < received; i++) {
+			query = &(batch->queries[i]);
+			if (!allowQuery(worker->config, query->msg_hdr.msg_name,
+					now))
+				continue;
 
-	if (config->lbType == RR) {
-		ip = getRRIP(config);
-	} else {
-		ip = getGEOIP(config, client);
+			responseLen = processQuery(worker, batch->queryBufs[i],
+						   query->msg_len,
+						   query->msg_hdr.msg_name,
+						   batch->replyBufs[replies],
+						   DNS_BUF_SIZE);
+			if (responseLen == -1)
+				continue;
+
+			batch->replyIov[replies].iov_base =
+				batch->replyBufs[replies];
+			batch->replyIov[replies].iov_len = responseLen;
+
+			reply = &(batch->replies[replies]);
+			memset(reply, 0, sizeof(*reply));
+			reply->msg_hdr.msg_name = query->msg_hdr.msg_name;
+			reply->msg_hdr.msg_namelen = query->msg_hdr.msg_namelen;
+			reply->msg_hdr.msg_iov = &(batch->replyIov[replies++]);
+			reply->msg_hdr.msg_iovlen = 1;
+		}
+
+		/* sendmmsg stops at the first reply it fails to send, which is
+		   dropped */
+		for (sent = 0; sent < replies; sent += i) {
+			if ((i = sendmmsg(worker->socket, batch->replies + sent,
+					  replies - sent, 0)) == -1) {
+				log(DEFAULT_LOG, "did not send all the "
+				    "data.\n");
+				i = 1;
+			}
+		}
 	}
 
-	if (!ip) {
-		log(DEFAULT_LOG, "failed to find server ip\n");
-	} else {
-		/* DNS only handles resolution for DOMAIN (in nameserver.h)*/
-		if (strcmp(dnsRequest->query_name, VID_DOMAIN)) {
-			free(dnsRequest->query_name);
-			dnsRequest->query_name = NULL;
-
-			log(DEFAULT_LOG, "request not for %s\n", VID_DOMAIN);
-			if (!(dnsReply = generate_dns_message(dnsRequest->message_id,
-							      RESPONSE, NULL, 1))) {
-				log(DEFAULT_LOG, "generate dns failed.\n");
-				return;
+	return NULL;
+}
+
+static void *dns_Control(void *arg)
+{
+	struct dns_config_t *config = arg;
+	fd_set recvfds;
+	char buf[BUF_SIZE];
+	struct sockaddr_storage from;
+	socklen_t fromLen;
+	ssize_t size;
+	int applied, maxfd;
+
+	maxfd = config->controlSocket > config->loadSocket ?
+		config->controlSocket : config->loadSocket;
+	if (config->feedbackSocket > maxfd)
+		maxfd = config->feedbackSocket;
+	if (config->health && config->healthPipe[0] > maxfd)
+		maxfd = config->healthPipe[0];
+
+	while (1) {
+		FD_ZERO(&recvfds);
+		if (config->controlSocket != -1)
+			FD_SET(config->controlSocket, &recvfds);
+		if (config->loadSocket != -1)
+			FD_SET(config->loadSocket, &recvfds);
+		if (config->feedbackSocket != -1)
+			FD_SET(config->feedbackSocket, &recvfds);
+		if (config->health)
+			FD_SET(config->healthPipe[0], &recvfds);
+
+		if (select(maxfd + 1, &recvfds, NULL, NULL, NULL) == -1)
+			continue;
+
+		/* take every queued LSA datagram so that one snapshot covers
+		   them all */
+		if (config->controlSocket != -1 &&
+		    FD_ISSET(config->controlSocket, &recvfds)) {
+			applied = 0;
+			while ((size = recv(config->controlSocket, buf,
+					    BUF_SIZE - 1, MSG_DONTWAIT)) != -1) {
+				buf[size] = '\0';
+				applied += processControl(config, buf);
 			}
-		} else {
-			if (!(dnsReply = generate_dns_message(dnsRequest->message_id,
-							      RESPONSE,
-							      (char *) ip, 0))) {
-				log(DEFAULT_LOG, "generate dns failed for %s\n", ip);
-				return;
+
+			if (applied && dns_PublishSnapshot(config))
+				log(DEFAULT_LOG, "publish snapshot failed.\n");
+		}
+
+		/* servers that went up or down are ranked or dropped in the
+		   nearest-server tables */
+		if (config->health &&
+		    FD_ISSET(config->healthPipe[0], &recvfds) &&
+		    dns_RankHealth(config) && zonesUseGraph(config) &&
+		    dns_PublishSnapshot(config))
+			log(DEFAULT_LOG, "publish snapshot failed.\n");
+
+		if (config->loadSocket != -1 &&
+		    FD_ISSET(config->loadSocket, &recvfds)) {
+			while ((size = recv(config->loadSocket, buf,
+					    BUF_SIZE - 1, MSG_DONTWAIT)) != -1) {
+				buf[size] = '\0';
+				processLoad(config, buf);
 			}
 		}
 
-		if (!(response = serialize_dns(dnsReply))) {
-			log(DEFAULT_LOG, "serialize dns failed for %s\n", ip);
-			return;
+		if (config->feedbackSocket != -1 &&
+		    FD_ISSET(config->feedbackSocket, &recvfds)) {
+			fromLen = sizeof(from);
+			while ((size = recvfrom(config->feedbackSocket, buf,
+						BUF_SIZE - 1, MSG_DONTWAIT,
+						(struct sockaddr *) &from,
+						&fromLen)) != -1) {
+				buf[size] = '\0';
+				processFeedback(config,
+						(struct sockaddr *) &from, buf);
+				fromLen = sizeof(from);
+			}
 		}
+	}
 
-		responseLen = dnsReply->len;
+	return NULL;
+}
 
-		/* prevent free_dns_message from freeing the response ip */
-		dnsReply->response_ip = NULL;
-		free_dns_message(dnsReply);
+static void processLoad(struct dns_config_t *config, char *buf)
+{
+	char *line, *save;
 
-		log_activity(config->log, FMT,
-			     microtime(NULL) / 1000000.0,
-			     client, VID_DOMAIN, ip);
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+		dns_ReportLoad(config, line);
+}
+
+static void processFeedback(struct dns_config_t *config,
+			    const struct sockaddr *proxy, char *buf)
+{
+	char *line, *save;
+
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save))
+		dns_ReportFeedback(config, proxy, line);
+}
 
-		if (sendto(config->socket, response, responseLen, 0, src_addr,
-			   addrlen)
-		    != responseLen) {
-			log(DEFAULT_LOG, "did not send all the data.\n");
+static int processControl(struct dns_config_t *config, char *buf)
+{
+	char *line, *save, *ip, *neighbors;
+	int seqNum, applied;
+
+	if (!zonesUseGraph(config)) {
+		log(DEFAULT_LOG, "no graph to apply LSAs to.\n");
+		return 0;
+	}
+
+	applied = 0;
+	for (line = strtok_r(buf, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (parseLSA(line, &ip, &seqNum, &neighbors)) {
+			log(DEFAULT_LOG, "improper LSA format line.\n");
+			continue;
 		}
+
+		if (dns_UpdateLSA(config, ip, seqNum, neighbors))
+			log(DEFAULT_LOG, "update LSA of %s failed.\n", ip);
+		else
+			applied++;
+	}
+
+	return applied;
+}
+
+static void clientName(const struct sockaddr *addr, char *name, size_t len)
+{
+	const void *src;
+
+	if (addr->sa_family == AF_INET)
+		src = &(((const struct sockaddr_in *)addr)->sin_addr);
+	else if (addr->sa_family == AF_INET6)
+		src = &(((const struct sockaddr_in6 *)addr)->sin6_addr);
+	else
+		src = NULL;
+
+	if (!src || !inet_ntop(addr->sa_family, src, name, len)) {
+		log(DEFAULT_LOG, "failed to get client address.\n");
+		name[0] = '\0';
+	}
+}
+
+static ssize_t processQuery(struct dns_worker_t *worker, const uint8_t *buf,
+			    ssize_t len, const struct sockaddr *src_addr,
+			    uint8_t *response, size_t responseSize)
+{
+	struct dns_config_t *config = worker->config;
+	struct dns_t dnsRequest;
+	size_t servers[DNS_MAX_ANSWERS];
+	size_t serversCount;
+	ssize_t responseLen;
+	char client[INET6_ADDRSTRLEN];
+	const struct snapshot_t *snapshot;
+	struct zone_t *zone;
+
+	if (deserialize_dns(&dnsRequest, buf, len)) {
+		log(DEFAULT_LOG, "deserialize dns failed.\n");
+		return -1;
+	}
+
+	if (dnsRequest.type != QUERY)
+		return -1;
+
+	/* the client address is only formatted here, for logging purposes.
+	   Binary records carry it as is */
+	client[0] = '\0';
+	if (!config->binaryLog)
+		clientName(src_addr, client, sizeof(client));
+
+	/* DNS only handles resolution for the names of its zones */
+	if (!(zone = findZone(config, &dnsRequest))) {
+		log(DEFAULT_LOG, "request not for a zone of %s\n", client);
+		return dns_FillNXDomain(&(config->templates), &dnsRequest,
+					response, responseSize);
+	}
+
+	if (zone->lbType == RR) {
+		serversCount = getRRIP(config, zone, servers, DNS_MAX_ANSWERS);
+	} else if (zone->lbType == WRR) {
+		serversCount = getWRRIP(config, zone, servers,
+					DNS_MAX_ANSWERS);
+	} else if (zone->lbType == HASH) {
+		serversCount = getHashIP(config, zone, src_addr, servers,
+					 DNS_MAX_ANSWERS);
+	} else {
+		snapshot = snapshotEnter(config, worker->reader);
+		if (zone->lbType == LOAD)
+			serversCount = getLoadIP(config, snapshot, zone,
+						 src_addr, servers,
+						 DNS_MAX_ANSWERS,
+						 &(worker->seed));
+		else
+			serversCount = getGEOIP(config, snapshot, zone,
+						src_addr, servers,
+						DNS_MAX_ANSWERS);
+		snapshotLeave(config, worker->reader);
+
+		/* the tables rank the servers that were up when they were
+		   last repaired.  When those went down since, round-robin
+		   answers the others of the pool, and a pool that is all down
+		   is not ranked at all but still answered */
+		serversCount = keepHealthy(config, servers, serversCount);
+		if (serversCount ? !isHealthy(config, servers[0]) :
+		    !poolHealthy(config, zone))
+			serversCount = getRRIP(config, zone, servers,
+					       DNS_MAX_ANSWERS);
+	}
+
+	serversCount = keepHealthy(config, servers, serversCount);
+	if (!serversCount) {
+		log(DEFAULT_LOG, "failed to find server ip for %s\n", client);
+		return -1;
+	}
+
+	responseLen = dns_FillReply(&(config->templates), &dnsRequest,
+				    servers, serversCount, response,
+				    responseSize);
+	if (responseLen == -1) {
+		log(DEFAULT_LOG, "fill response failed for %s\n",
+		    config->servers[servers[0]].ip);
+		return -1;
 	}
+
+	if (config->binaryLog)
+		logQuery(config, src_addr, zone, servers[0]);
+	else
+		log_activity(config->log, ACTIVITY_FMT,
+			     microtime(NULL) / 1000000.0,
+			     client, zone->name, config->servers[servers[0]].ip);
+
+	return responseLen;
+}
+
+static int startActivityLog(struct dns_config_t *config)
+{
+	size_t i;
+
+	if (actlogStart(config->log))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < config->serversCount; i++)
+		if (actlogName(config->log, i, config->servers[i].ip))
+			return EXIT_FAILURE;
+
+	for (i = 0; i < config->zonesCount; i++)
+		if (actlogName(config->log, config->serversCount + i,
+			       config->zones[i].name))
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
 }
 
-static int setupListen(struct dns_config_t *config)
+static void logQuery(struct dns_config_t *config,
+		     const struct sockaddr *client, const struct zone_t *zone,
+		     size_t server)
+{
+	struct actlog_query_t record;
+
+	memset(&record, 0, sizeof(record));
+	record.type = ACTLOG_QUERY;
+	record.family = client->sa_family;
+	record.zone = config->serversCount + (zone - config->zones);
+	record.time = microtime(NULL);
+	record.server = server;
+
+	if (client->sa_family == AF_INET)
+		memcpy(record.client,
+		       &(((const struct sockaddr_in *) client)->sin_addr), 4);
+	else if (client->sa_family == AF_INET6)
+		memcpy(record.client,
+		       &(((const struct sockaddr_in6 *) client)->sin6_addr), 16);
+
+	actlogWrite(config->log, &record);
+}
+
+static int setupListen(struct dns_config_t *config, const char *port,
+		       int reuse)
 {
 	struct addrinfo hints;
 	struct addrinfo *results;
@@ -207,9 +770,9 @@ static int setupListen(struct dns_config_t *config)
 	hints.ai_socktype = SOCK_DGRAM;
 	hints.ai_protocol = 0;
 
-	log(DEFAULT_LOG, "setup DNS listen on %s:%s\n", config->ip, config->port);
+	log(DEFAULT_LOG, "setup DNS listen on %s:%s\n", config->ip, port);
 
-	if (getaddrinfo(config->ip, config->port, &hints, &results)) {
+	if (getaddrinfo(config->ip, port, &hints, &results)) {
 		perror("getaddrinfo");
 		return -1;
 	}
@@ -219,6 +782,13 @@ static int setupListen(struct dns_config_t *config)
 				tmp->ai_protocol)) == -1)
 			continue;
 
+		if (reuse && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &reuse,
+					sizeof(reuse))) {
+			perror("setsockopt");
+			close(s);
+			continue;
+		}
+
 		if (!bind(s, tmp->ai_addr, tmp->ai_addrlen))
 			break;
 
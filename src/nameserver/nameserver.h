@@ -5,9 +5,15 @@
 
 #include <stdio.h>
 #include <inttypes.h>
-#include "../common/linkedlist.h"
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include "graph.h"
+#include "../common/asynclog.h"
+#include "../common/actlog.h" /* ACTIVITY_FMT */
 
 #define VID_DOMAIN "video.cs.cmu.edu"
+#define VID_DOMAIN_LABELS "\005video\002cs\003cmu\003edu" /* wire format */
+#define DNS_MAX_ANSWERS 4 /* most A records carried in a single response */
 
 /*
   Representation of a dns packet
@@ -18,56 +24,362 @@ enum message_type {
 };
 
 struct dns_t {
-        /* use generate_dns_message to generate the struct */
-        /* use free_dns_message to free the struct */
+        /* use generate_dns_message or deserialize_dns to fill in the struct,
+           nothing inside is allocated so it never needs to be freed */
         uint16_t message_id;
 
         enum message_type type;
         int len; /* length of the complete dns request or response */
         /* length of request should always be DNS_REQUEST_LEN */
-        /* length of response should always be DNS_RESPONSE_LEN */
+        /* length of response should always be
+           DNS_RESPONSE_LEN(answer_count) */
 
-        /**** exists if message is query ****/
-        char *query_name; /* should always be "video.cs.cmu.edu" */
+        /**** exists if message is query or valid response ****/
+        /* name in labels format, should always be VID_DOMAIN_LABELS.  It
+           points into the buffer the message was deserialized from */
+        const uint8_t *query_name;
+        size_t query_name_len; /* including the terminating zero label */
 
         /**** exists if message is response ****/
-	char *response_name; /* should always be "video.cs.cmu.edu"  */
-	char *response_ip; /* ip resolved eg. "4.0.0.1" */
+        /* ips resolved eg. 4.0.0.1, ranked with the preferred one first */
+        struct in_addr answers[DNS_MAX_ANSWERS];
+        size_t answer_count;
 
         int invalid_request; /* flagged if the request is invalid */
 };
 
+/**
+   Precomputed response wire images, built once the servers are known so that
+   a reply is only a copy and a few patches.  See response.h
+*/
+struct dns_templates_t {
+	uint8_t *header; /* response header, the answer count to be patched */
+	size_t headerLen;
+	uint8_t *answers; /* the answer record of every server */
+	size_t answerLen; /* length of each answer record */
+	uint8_t *nxdomain; /* complete name error response */
+	size_t nxdomainLen;
+};
+
+/**
+   The ranked closest servers of every vertex in the network graph, computed
+   once when the graph is constructed.  See nearest.h
+*/
+struct nearest_t {
+	size_t vertices;
+	uint32_t *servers; /* DNS_MAX_ANSWERS server indices per vertex */
+	uint32_t *dists; /* path cost from the vertex to each of those servers */
+	uint8_t *counts; /* number of ranked servers per vertex */
+};
+
+/**
+   A server reaching a vertex at the path cost dist, while ranking the
+   closest servers
+*/
+struct nearest_label_t {
+	uint32_t vertex;
+	uint32_t server;
+	uint32_t dist;
+};
+
+/**
+   The buffers of applying LSAs and repairing the nearest-server table, kept
+   from one LSA to the next.  See nearest.h
+*/
+struct nearest_scratch_t {
+	uint8_t *state; /* of every vertex, see nearest.c */
+	size_t stateCap;
+	uint32_t *stack, *affected;
+	size_t stackCap, affectedCap;
+	struct nearest_label_t *heap;
+	size_t heapCap;
+
+	/* the new neighbors of an LSA sender and the vertices whose links
+	   changed, see dns_UpdateLSA */
+	uint32_t *row, *weights, *changed;
+	size_t rowCap;
+
+	/* the vertices whose closest servers changed since the last
+	   snapshot */
+	uint32_t *dirty;
+	size_t dirtyCount, dirtyCap;
+};
+
+/**
+   A video server the nameserver hands out, see servers.h
+*/
+struct server_t {
+	char *ip;
+	struct in_addr addr; /* ip in binary form */
+	long vertex; /* vertex of the server in the graph, -1 if not in it */
+	uint32_t key; /* hash of ip, for rendezvous hashing */
+	uint32_t weight; /* share of the weighted rotation, 1 by default */
+};
+
+/**
+   A neighbor advertised in an LSA and the cost of the link to it
+*/
+struct lsa_link_t {
+	uint32_t vertex;
+	uint32_t cost;
+};
+
+/**
+   The latest LSA a vertex advertised, see lsa.h
+*/
+struct lsa_t {
+	int present; /* whether the vertex advertised any LSA */
+	int seqNum;
+	struct lsa_link_t *links; /* advertised neighbors, sorted by vertex */
+	size_t count;
+};
+
+/**
+   A client subnet and the vertex its clients attach to, see prefix.h
+*/
+struct prefix_t {
+	uint32_t addr; /* network address in host byte order */
+	uint8_t len;
+	char *attachment; /* name of the vertex */
+};
+
+/**
+   A node of a prefix trie, standing for the first len bits of addr
+*/
+struct prefix_node_t {
+	uint32_t addr; /* in host byte order, the bits past len clear */
+	uint32_t vertex; /* of the prefix addr/len, UINT32_MAX for a branch */
+	uint32_t child[2]; /* by the bit past len, 0 if there is none */
+	uint8_t len;
+};
+
+/**
+   Longest-prefix-match table from IPv4 client addresses to vertices, a
+   path-compressed binary trie of the client networks.  It is immutable once
+   built and shared by the snapshots, see prefix.h
+*/
+struct prefix_table_t {
+	struct prefix_node_t *nodes; /* the root being node 0 */
+	size_t count, cap;
+	size_t refs;
+};
+
+/**
+   An immutable, versioned copy of the topology that queries read without
+   locking, see snapshot.h
+*/
+struct snapshot_t {
+	unsigned long version;
+	struct graph_t graph;
+	struct nearest_t nearest;
+	struct nearest_t *poolNearest; /* see dns_config_t */
+	size_t poolNearestCount;
+	struct server_t *servers; /* ips are shared with the registry */
+	size_t serversCount;
+	struct prefix_table_t *prefixes; /* shared with the other snapshots */
+};
+
+/**
+   The epoch a query thread entered a snapshot in, 0 while it holds none.
+   Padded so that readers do not share cache lines
+*/
+struct snapshot_reader_t {
+	atomic_ulong epoch;
+	char pad[64 - sizeof(atomic_ulong)];
+};
+
+/**
+   The latest load report of a video server, see load.h.  Written by the
+   control thread and read by queries without locking
+*/
+struct server_load_t {
+	atomic_uint_least64_t report; /* load << 32 | capacity */
+	atomic_uint_least64_t time; /* microtime of the report, 0 if none */
+};
+
+/**
+   The throughput a proxy observed from a video server, see feedback.h.
+   Written by the control thread and read by queries without locking
+*/
+struct path_feedback_t {
+	atomic_uint_least64_t kbps; /* blended with the earlier reports */
+	atomic_uint_least64_t time; /* microtime of the report, 0 if none */
+};
+
+/**
+   A proxy that reports throughput, keyed by its address.  used is set once
+   the address and paths are, and the entry is never reused afterwards
+*/
+struct proxy_feedback_t {
+	atomic_int used;
+	uint8_t addr[16]; /* IPv4 or IPv6 address in network byte order */
+	uint8_t addrLen;
+	struct path_feedback_t *paths; /* one per server */
+};
+
+/**
+   The health of a video server, see health.h.  up is written by the health
+   check thread and read by queries without locking
+*/
+struct server_health_t {
+	atomic_int up;
+	unsigned streak; /* checks in a row that disagree with up */
+	int ranked; /* up as the nearest-server tables have it, only touched
+		       by the thread that builds them */
+};
+
+/**
+   The token bucket of a client, see ratelimit.h
+*/
+struct rate_bucket_t {
+	uint32_t key; /* hash of the client address */
+	uint32_t tokens; /* in 1/TOKEN of a token */
+	uint64_t time; /* microtime of the last query, 0 if unused */
+};
+
+#define RATE_WAYS 3 /* clients a line of the rate limit table holds */
+
+/**
+   A cache line of the rate limit table, the buckets of RATE_WAYS clients
+*/
+struct rate_slot_t {
+	_Alignas(64) atomic_flag lock;
+	struct rate_bucket_t buckets[RATE_WAYS];
+};
+
 /**
    Load balancing type the DNS uses when queried for entry
 */
 enum load_balance_t {
 	RR, /* round-robin */
-	GEO /* geographic distance */
+	GEO, /* geographic distance */
+	LOAD, /* two of the closest servers, the one with more headroom */
+	HASH, /* rendezvous hashing of the client subnet, for cache affinity */
+	WRR /* smooth weighted round-robin by server weight */
+};
+
+/* whether the load balancing type ranks servers in the network graph */
+#define usesGraph(lbType) ((lbType) == GEO || (lbType) == LOAD)
+
+/**
+   A name the nameserver answers for, with its own pool of servers and load
+   balancing policy, see zones.h
+*/
+struct zone_t {
+	char *name; /* dotted, for the activity log */
+	enum load_balance_t lbType;
+	uint32_t *pool; /* indices into the servers */
+	size_t poolCount, poolCap;
+	uint8_t *members; /* whether each server is in pool, NULL if all are */
+	uint32_t *rotation; /* positions in pool in smooth weighted round-robin
+			       order */
+	size_t rotationCount;
+	atomic_uint next; /* round robin index, shared by the workers */
+	size_t ranking; /* nearest-server table of pool when it is ranked, 0
+			   for the one of all the servers and i for
+			   poolNearest[i - 1] of the config */
 };
 
 /**
   DNS configuration setup
 
   Constructed from command line arguments:
-  ./nameserver [-r] <log> <ip> <port> <servers> <LSAs>
+  ./nameserver [-r | -p | -a | -s] [-c <control port>] [-l <load port>]
+               [-w <workers>] [-n <client networks>]
+               [-i <check interval>[,<fall>,<rise>]]
+               [-q <queries per second>[,<burst>]] [-z <zones>]
+               [-f <feedback port>] [-b <rotate MB>[,<rotate seconds>]] [-x]
+               [-o <compiled topology>] <log> <ip> <port> <servers> <LSAs>
 */
 struct dns_config_t {
 	FILE *log;
 
+	/* the log is written from a background thread when asyncLog is set,
+	   and rotated by logRotate */
+	int asyncLog;
+	struct log_rotate_t logRotate;
+
+	/* answers are logged as binary records when binaryLog is set, see
+	   actlog.h */
+	int binaryLog;
+
 	/* File names */
 	const char *logFilename;
 	const char *serversFile;
 	const char *lsaFile;
+	const char *prefixFile; /* client networks, optional */
+	const char *compileFile; /* compile the topology there and exit */
+	const char *zonesFile; /* names answered for, optional */
 
 	const char *ip;
 	const char *port;
 	int socket;
 
+	/* query threads, each with its own socket on ip:port */
+	size_t workers;
+
+	/* LSA updates are accepted on ip:controlPort when it is given */
+	const char *controlPort;
+	int controlSocket;
+
+	/* server load reports are accepted on ip:loadPort when it is given */
+	const char *loadPort;
+	int loadSocket;
+
+	/* proxy throughput reports are accepted on ip:feedbackPort when it is
+	   given */
+	const char *feedbackPort;
+	int feedbackSocket;
+
 	enum load_balance_t lbType;
 
-#define MAX_SERVERS 100
-	char *servers[MAX_SERVERS];
-	size_t serversCount;
+	struct server_t *servers; /* registry in servers file order */
+	size_t serversCount, serversCap;
+	struct hashtable_t serverIndex; /* server ip -> index in servers */
+	struct server_load_t *loads; /* latest load report of every server */
+	struct proxy_feedback_t *feedback; /* NULL without feedback port */
+
+	/* servers are checked every healthInterval milliseconds when it is
+	   given, down after healthFall failed checks and up after healthRise
+	   passed ones */
+	unsigned long healthInterval;
+	unsigned healthFall, healthRise;
+	struct server_health_t *health; /* NULL without checks */
+	int healthPipe[2]; /* a byte is written to healthPipe[1] whenever a
+			      server goes up or down */
+
+	/* queries of every client are limited to rateLimit per second in
+	   bursts of rateBurst when it is given */
+	unsigned long rateLimit, rateBurst;
+	struct rate_slot_t *rateSlots; /* NULL without rate limiting */
+	struct dns_templates_t templates;
+	struct zone_t *zones; /* in zones file order */
+	size_t zonesCount, zonesCap;
+	struct hashtable_t zoneIndex; /* wire format name -> index in zones */
+
+	struct graph_t graph;
+	struct lsa_t *lsas; /* latest LSA of every vertex in graph */
+	size_t lsasCap;
+	struct nearest_t nearest;
+	struct nearest_scratch_t scratch;
+
+	/* the tables of the distinct pools of part of the servers that zones
+	   rank in the graph, and the members of those pools */
+	struct nearest_t *poolNearest;
+	const uint8_t **poolMembers;
+	size_t poolNearestCount;
+	uint8_t *compiledMembers; /* of the pool tables of a compiled
+				     topology, until zones take them */
+	struct prefix_t *prefixes; /* client networks in prefix file order */
+	size_t prefixesCount, prefixesCap;
+	struct prefix_table_t *prefixTable; /* the latest one built */
+	size_t prefixVertices; /* of the graph prefixTable was checked at */
+	size_t prefixAttached; /* networks whose vertex is in prefixTable */
 
-	Node *graphNodes;
+	/* graph, servers and nearest above are only touched while building;
+	   queries read the published snapshot */
+	_Atomic(struct snapshot_t *) snapshot;
+	atomic_ulong epoch;
+	struct snapshot_reader_t *readers;
+	size_t readersCount;
 };
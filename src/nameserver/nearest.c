@@ -0,0 +1,1052 @@
+/*
+  Functions to compute and read the nearest-server table
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "nearest.h"
+#include "graph.h"
+#include "../common/log.h"
+
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define K DNS_MAX_ANSWERS
+#define DEFAULT_CAP 64
+
+/* bit-parallel BFS of graphs whose links all cost 1 */
+#define CHUNK 64 /* servers searched at once, one bit each */
+#define BFS_MIN_VERTICES 4096 /* vertices worth a thread */
+#define BFS_MAX_THREADS 64
+
+/* vertex state while repairing */
+#define CHANGED 1 /* an end of a changed link */
+#define AFFECTED 2 /* its closest servers are recomputed */
+#define DIRTY 4 /* its closest servers changed since the last snapshot */
+
+/**
+   Tell whether (dist, server) ranks before the label at i of vertex.
+*/
+static int ranksBefore(const struct nearest_t *nearest, uint32_t vertex,
+		       size_t i, uint32_t server, uint32_t dist)
+{
+	size_t at = (size_t) vertex * K + i;
+
+	return dist < nearest->dists[at] ||
+		(dist == nearest->dists[at] && server < nearest->servers[at]);
+}
+
+/**
+   Tell whether the server at dist would rank among the closest servers of
+   vertex, see offerLabel.
+*/
+static int improves(const struct nearest_t *nearest, uint32_t vertex,
+		    uint32_t server, uint32_t dist)
+{
+	size_t i, count = nearest->counts[vertex];
+
+	for (i = 0; i < count; i++)
+		if (nearest->servers[(size_t) vertex * K + i] == server)
+			return dist < nearest->dists[(size_t) vertex * K + i];
+
+	return count < K || ranksBefore(nearest, vertex, K - 1, server, dist);
+}
+
+/**
+   Offer the server at dist to vertex.  It replaces a farther label of the
+   same server, or the farthest label if the vertex already has
+   DNS_MAX_ANSWERS servers ranked after it.  The labels stay ranked.
+
+   @return 1 if the labels of vertex changed, 0 otherwise
+*/
+static int offerLabel(struct nearest_t *nearest, uint32_t vertex,
+		      uint32_t server, uint32_t dist)
+{
+	uint32_t *servers = nearest->servers + (size_t) vertex * K;
+	uint32_t *dists = nearest->dists + (size_t) vertex * K;
+	size_t i, count = nearest->counts[vertex];
+
+	if (!improves(nearest, vertex, server, dist))
+		return 0;
+
+	for (i = 0; i < count && servers[i] != server; i++)
+		;
+
+	if (i < count) {
+		/* drop the farther label of the server */
+		memmove(servers + i, servers + i + 1,
+			(count - i - 1) * sizeof(*servers));
+		memmove(dists + i, dists + i + 1,
+			(count - i - 1) * sizeof(*dists));
+		count--;
+	} else if (count == K) {
+		count--;
+	}
+
+	for (i = count; i > 0 &&
+		     ranksBefore(nearest, vertex, i - 1, server, dist); i--) {
+		servers[i] = servers[i - 1];
+		dists[i] = dists[i - 1];
+	}
+
+	servers[i] = server;
+	dists[i] = dist;
+	nearest->counts[vertex] = count + 1;
+
+	return 1;
+}
+
+/**
+   Tell whether vertex has the server at exactly dist.
+*/
+static int hasLabel(const struct nearest_t *nearest, uint32_t vertex,
+		    uint32_t server, uint32_t dist)
+{
+	size_t i;
+
+	for (i = 0; i < nearest->counts[vertex]; i++)
+		if (nearest->servers[(size_t) vertex * K + i] == server)
+			return nearest->dists[(size_t) vertex * K + i] == dist;
+
+	return 0;
+}
+
+/**
+   Tell whether server is ranked in a table of the servers in members, NULL
+   standing for all of them: it is on the graph, and up as far as the tables
+   know.
+*/
+static int isSource(const struct dns_config_t *config, const uint8_t *members,
+		    size_t server)
+{
+	return config->servers[server].vertex != -1 &&
+		(!members || members[server]) &&
+		(!config->health || config->health[server].ranked);
+}
+
+/**
+   Tell whether every label of vertex in nearest, the table of the servers in
+   members, is still reached through a neighbor that is not affected, or is a
+   server on the vertex itself that is still ranked.
+*/
+static int supported(const struct dns_config_t *config,
+		     const struct nearest_t *nearest, const uint8_t *members,
+		     const uint8_t *state, uint32_t vertex)
+{
+	const uint32_t *neighbors, *weights;
+	uint32_t server, dist;
+	size_t i, e, count;
+
+	count = getNeighbors(&(config->graph), vertex, &neighbors, &weights);
+
+	for (i = 0; i < nearest->counts[vertex]; i++) {
+		server = nearest->servers[(size_t) vertex * K + i];
+		dist = nearest->dists[(size_t) vertex * K + i];
+
+		if (!dist) {
+			if (config->servers[server].vertex != vertex ||
+			    !isSource(config, members, server))
+				return 0;
+			continue;
+		}
+
+		for (e = 0; e < count; e++)
+			if (!(state[neighbors[e]] & AFFECTED) &&
+			    weights[e] <= dist &&
+			    hasLabel(nearest, neighbors[e], server,
+				     dist - weights[e]))
+				break;
+
+		if (e == count)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* A min-heap of labels by cost and then by server order */
+struct heap_t {
+	struct nearest_label_t *labels;
+	size_t count, cap;
+};
+
+static int labelBefore(const struct nearest_label_t *a,
+		       const struct nearest_label_t *b)
+{
+	return a->dist < b->dist ||
+		(a->dist == b->dist && a->server < b->server);
+}
+
+static int heapPush(struct heap_t *heap, uint32_t vertex, uint32_t server,
+		    uint32_t dist)
+{
+	struct nearest_label_t *labels, tmp;
+	size_t i, parent, cap;
+
+	if (heap->count == heap->cap) {
+		cap = heap->cap ? heap->cap * 2 : DEFAULT_CAP;
+		if (!(labels = realloc(heap->labels, cap * sizeof(*labels))))
+			return EXIT_FAILURE;
+		heap->labels = labels;
+		heap->cap = cap;
+	}
+
+	i = heap->count++;
+	heap->labels[i].vertex = vertex;
+	heap->labels[i].server = server;
+	heap->labels[i].dist = dist;
+
+	for (; i > 0; i = parent) {
+		parent = (i - 1) / 2;
+		if (!labelBefore(&(heap->labels[i]), &(heap->labels[parent])))
+			break;
+
+		tmp = heap->labels[i];
+		heap->labels[i] = heap->labels[parent];
+		heap->labels[parent] = tmp;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static struct nearest_label_t heapPop(struct heap_t *heap)
+{
+	struct nearest_label_t top = heap->labels[0], tmp;
+	size_t i, child;
+
+	heap->labels[0] = heap->labels[--heap->count];
+
+	for (i = 0; (child = 2 * i + 1) < heap->count; i = child) {
+		if (child + 1 < heap->count &&
+		    labelBefore(&(heap->labels[child + 1]),
+				&(heap->labels[child])))
+			child++;
+
+		if (!labelBefore(&(heap->labels[child]), &(heap->labels[i])))
+			break;
+
+		tmp = heap->labels[i];
+		heap->labels[i] = heap->labels[child];
+		heap->labels[child] = tmp;
+	}
+
+	return top;
+}
+
+/**
+   Push every label of vertex over its link of cost weight, onto vertex
+   target.
+*/
+static int pushLabels(struct heap_t *heap, const struct nearest_t *nearest,
+		      uint32_t vertex, uint32_t target, uint32_t weight)
+{
+	size_t i, at;
+
+	for (i = 0; i < nearest->counts[vertex]; i++) {
+		at = (size_t) vertex * K + i;
+		if (improves(nearest, target, nearest->servers[at],
+			     nearest->dists[at] + weight) &&
+		    heapPush(heap, target, nearest->servers[at],
+			     nearest->dists[at] + weight))
+			return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+   Note that the closest servers of vertex changed, for the next snapshot.
+
+   @return 0 on success, 1 otherwise
+*/
+static int markDirty(struct nearest_scratch_t *scratch, uint32_t vertex);
+
+/**
+   Copy the closest servers of vertex from the table src to dst.
+*/
+static void copyVertex(struct nearest_t *dst, const struct nearest_t *src,
+		       size_t vertex);
+
+/**
+   Settle the labels of heap closest first.  Every label a vertex takes is
+   passed on to its neighbors over their links, and the heap is emptied.
+   The vertices that take labels are marked dirty in scratch, unless it is
+   NULL.
+
+   @return 0 on success, 1 otherwise
+*/
+static int settle(struct heap_t *heap, struct nearest_t *nearest,
+		  const struct graph_t *graph,
+		  struct nearest_scratch_t *scratch)
+{
+	const uint32_t *neighbors, *weights;
+	struct nearest_label_t curr;
+	size_t degree, e;
+
+	while (heap->count) {
+		curr = heapPop(heap);
+		if (!offerLabel(nearest, curr.vertex, curr.server, curr.dist))
+			continue;
+
+		if (scratch && markDirty(scratch, curr.vertex))
+			return EXIT_FAILURE;
+
+		degree = getNeighbors(graph, curr.vertex, &neighbors, &weights);
+		for (e = 0; e < degree; e++)
+			if (improves(nearest, neighbors[e], curr.server,
+				     curr.dist + weights[e]) &&
+			    heapPush(heap, neighbors[e], curr.server,
+				     curr.dist + weights[e]))
+				return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+   Append vertex v to the growable array *arr.
+
+   @return 0 on success, 1 otherwise
+*/
+static int pushVertex(uint32_t **arr, size_t *count, size_t *cap, uint32_t v)
+{
+	uint32_t *tmp;
+	size_t newCap;
+
+	if (*count == *cap) {
+		newCap = *cap ? *cap * 2 : DEFAULT_CAP;
+		if (!(tmp = realloc(*arr, newCap * sizeof(**arr))))
+			return EXIT_FAILURE;
+		*arr = tmp;
+		*cap = newCap;
+	}
+
+	(*arr)[(*count)++] = v;
+	return EXIT_SUCCESS;
+}
+
+/**
+   Grow the table of nearest to vertices entries, new vertices having no
+   servers.
+
+   @return 0 on success, 1 otherwise
+*/
+static int growNearest(struct nearest_t *nearest, size_t vertices)
+{
+	uint32_t *servers, *dists;
+	uint8_t *counts;
+
+	if (vertices <= nearest->vertices)
+		return EXIT_SUCCESS;
+
+	if (!(servers = realloc(nearest->servers,
+				vertices * K * sizeof(*servers))))
+		return EXIT_FAILURE;
+	nearest->servers = servers;
+
+	if (!(dists = realloc(nearest->dists, vertices * K * sizeof(*dists))))
+		return EXIT_FAILURE;
+	nearest->dists = dists;
+
+	if (!(counts = realloc(nearest->counts, vertices * sizeof(*counts))))
+		return EXIT_FAILURE;
+	nearest->counts = counts;
+
+	memset(counts + nearest->vertices, 0, vertices - nearest->vertices);
+	nearest->vertices = vertices;
+	return EXIT_SUCCESS;
+}
+
+/* The bit-parallel BFS of a chunk of servers, bit b of the sets of a vertex
+   standing for server first + b */
+struct bfs_t {
+	const struct graph_t *graph;
+	struct nearest_t *nearest;
+	uint64_t *seen; /* servers that reached the vertex */
+	uint64_t *frontier[2]; /* servers it passes on, by level parity */
+	uint32_t first;
+	uint32_t dist; /* of the level being searched */
+	pthread_barrier_t level; /* met at the start and end of every level */
+	pthread_mutex_t gate; /* held until the barrier is set up */
+	int done; /* there are no levels left */
+};
+
+/* The vertices of one thread of the BFS */
+struct bfs_range_t {
+	struct bfs_t *bfs;
+	size_t lo, hi;
+	int active; /* whether any of them passes servers on */
+	pthread_t thread;
+};
+
+/**
+   Tell whether every link of graph costs 1.
+*/
+static int unitCosts(const struct graph_t *graph)
+{
+	const uint32_t *neighbors, *weights;
+	size_t v, e, count;
+
+	for (v = 0; v < graph->vertexCount; v++) {
+		count = getNeighbors(graph, v, &neighbors, &weights);
+		for (e = 0; e < count; e++)
+			if (weights[e] != 1)
+				return 0;
+	}
+
+	return 1;
+}
+
+/**
+   Offer the servers in reached, at dist, to vertex in server order.
+
+   @return the servers that became labels of vertex
+*/
+static uint64_t keepClosest(struct bfs_t *bfs, uint32_t vertex,
+			    uint64_t reached, uint32_t dist)
+{
+	uint64_t kept = 0;
+	unsigned b;
+
+	/* once a server at dist does not rank, the later ones can not */
+	while (reached) {
+		b = __builtin_ctzll(reached);
+		if (!offerLabel(bfs->nearest, vertex, bfs->first + b, dist))
+			break;
+
+		kept |= (uint64_t) 1 << b;
+		reached &= reached - 1;
+	}
+
+	return kept;
+}
+
+/**
+   Search the current level of the BFS over the vertices of a range: a vertex
+   is reached by the servers its neighbors passed on at the previous level.
+   Only the servers that rank among its closest are passed on in turn.
+*/
+static void searchLevel(struct bfs_range_t *range)
+{
+	struct bfs_t *bfs = range->bfs;
+	const uint64_t *prev = bfs->frontier[(bfs->dist - 1) & 1];
+	uint64_t *curr = bfs->frontier[bfs->dist & 1];
+	const uint32_t *neighbors;
+	uint64_t reached;
+	size_t v, e, degree;
+
+	range->active = 0;
+	for (v = range->lo; v < range->hi; v++) {
+		reached = 0;
+		degree = getNeighbors(bfs->graph, v, &neighbors, NULL);
+		for (e = 0; e < degree; e++)
+			reached |= prev[neighbors[e]];
+
+		reached &= ~bfs->seen[v];
+		bfs->seen[v] |= reached;
+		curr[v] = reached ? keepClosest(bfs, v, reached, bfs->dist) : 0;
+		range->active |= curr[v] != 0;
+	}
+}
+
+/**
+   Search every level of the BFS over the vertices of a range, in step with
+   the other threads, until there are none left.
+*/
+static void *bfsWorker(void *arg)
+{
+	struct bfs_range_t *range = arg;
+	struct bfs_t *bfs = range->bfs;
+
+	pthread_mutex_lock(&(bfs->gate));
+	pthread_mutex_unlock(&(bfs->gate));
+	if (bfs->done)
+		return NULL;
+
+	for (;;) {
+		pthread_barrier_wait(&(bfs->level));
+		if (bfs->done)
+			return NULL;
+
+		searchLevel(range);
+		pthread_barrier_wait(&(bfs->level));
+	}
+}
+
+/**
+   Fill nearest, allocated and empty, with a bit-parallel BFS from every
+   chunk of CHUNK servers in members in turn.  The levels are searched on
+   threads that each own a range of the vertices, started once and meeting
+   at a barrier around every level, and labels of earlier chunks prune the
+   later ones.
+
+   @return 0 on success, 1 otherwise
+*/
+static int bfsNearest(struct dns_config_t *config, struct nearest_t *nearest,
+		      const uint8_t *members)
+{
+	const struct graph_t *graph = &(config->graph);
+	size_t vertices = graph->vertexCount;
+	struct bfs_range_t *ranges;
+	struct bfs_t bfs;
+	size_t threads, started, i, v;
+	long cpus;
+	int active;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = cpus > 0 ? (size_t) cpus : 1;
+	threads = min(threads, BFS_MAX_THREADS);
+	threads = min(threads, vertices / BFS_MIN_VERTICES + 1);
+
+	bfs.graph = graph;
+	bfs.nearest = nearest;
+	bfs.seen = calloc(vertices, sizeof(uint64_t));
+	bfs.frontier[0] = calloc(vertices, sizeof(uint64_t));
+	bfs.frontier[1] = calloc(vertices, sizeof(uint64_t));
+	ranges = calloc(threads, sizeof(*ranges));
+	if (!bfs.seen || !bfs.frontier[0] || !bfs.frontier[1] || !ranges) {
+		log(DEFAULT_LOG, "failed to calloc BFS.\n");
+		free(bfs.seen);
+		free(bfs.frontier[0]);
+		free(bfs.frontier[1]);
+		free(ranges);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < threads; i++) {
+		ranges[i].bfs = &bfs;
+		ranges[i].lo = vertices / threads * i;
+		ranges[i].hi = i == threads - 1 ? vertices :
+			vertices / threads * (i + 1);
+	}
+
+	/* the threads wait at the gate until the barrier knows how many of
+	   them started.  Without a barrier they stop and the BFS runs here */
+	bfs.done = 0;
+	pthread_mutex_init(&(bfs.gate), NULL);
+	pthread_mutex_lock(&(bfs.gate));
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&(ranges[started].thread), NULL, bfsWorker,
+				   &(ranges[started])))
+			break;
+
+	if (started > 1 && pthread_barrier_init(&(bfs.level), NULL, started)) {
+		bfs.done = 1;
+		pthread_mutex_unlock(&(bfs.gate));
+		for (i = 1; i < started; i++)
+			pthread_join(ranges[i].thread, NULL);
+		started = 1;
+	} else {
+		pthread_mutex_unlock(&(bfs.gate));
+	}
+
+	for (bfs.first = 0; bfs.first < config->serversCount;
+	     bfs.first += CHUNK) {
+		memset(bfs.seen, 0, vertices * sizeof(uint64_t));
+		memset(bfs.frontier[0], 0, vertices * sizeof(uint64_t));
+
+		for (i = bfs.first;
+		     i < config->serversCount && i < bfs.first + CHUNK; i++)
+			if (isSource(config, members, i))
+				bfs.seen[config->servers[i].vertex] |=
+					(uint64_t) 1 << (i - bfs.first);
+
+		active = 0;
+		for (v = 0; v < vertices; v++) {
+			if (bfs.seen[v])
+				bfs.frontier[0][v] = keepClosest(&bfs, v,
+								 bfs.seen[v],
+								 0);
+			active |= bfs.frontier[0][v] != 0;
+		}
+
+		/* a range whose thread did not start is searched here */
+		for (bfs.dist = 1; active; bfs.dist++) {
+			if (started > 1)
+				pthread_barrier_wait(&(bfs.level));
+
+			for (i = started; i < threads; i++)
+				searchLevel(&(ranges[i]));
+			searchLevel(&(ranges[0]));
+
+			if (started > 1)
+				pthread_barrier_wait(&(bfs.level));
+
+			for (i = 0, active = 0; i < threads; i++)
+				active |= ranges[i].active;
+		}
+	}
+
+	if (started > 1) {
+		bfs.done = 1;
+		pthread_barrier_wait(&(bfs.level));
+		for (i = 1; i < started; i++)
+			pthread_join(ranges[i].thread, NULL);
+		pthread_barrier_destroy(&(bfs.level));
+	}
+	pthread_mutex_destroy(&(bfs.gate));
+
+	log(DEFAULT_LOG, "BFS of %zu servers on %zu threads\n",
+	    config->serversCount, started);
+
+	free(bfs.seen);
+	free(bfs.frontier[0]);
+	free(bfs.frontier[1]);
+	free(ranges);
+	return EXIT_SUCCESS;
+}
+
+/**
+   Fill nearest with the closest servers in members of every vertex, see
+   dns_BuildNearest.
+
+   @return 0 on success, 1 otherwise
+*/
+static int buildTable(struct dns_config_t *config, struct nearest_t *nearest,
+		      const uint8_t *members)
+{
+	const struct graph_t *graph = &(config->graph);
+	struct heap_t heap;
+	size_t count, i;
+	int ret;
+
+	memset(&heap, 0, sizeof(heap));
+
+	count = graph->vertexCount;
+	nearest->vertices = count;
+	nearest->servers = calloc(count * K + 1, sizeof(uint32_t));
+	nearest->dists = calloc(count * K + 1, sizeof(uint32_t));
+	nearest->counts = calloc(count + 1, sizeof(uint8_t));
+
+	if (!nearest->servers || !nearest->dists || !nearest->counts) {
+		log(DEFAULT_LOG, "failed to calloc nearest table.\n");
+		freeNearestTable(nearest);
+		return EXIT_FAILURE;
+	}
+
+	/* with unit costs a level of the BFS is a level of the Dijkstra */
+	if (unitCosts(graph)) {
+		if (bfsNearest(config, nearest, members)) {
+			freeNearestTable(nearest);
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	/* labels leave the heap by cost and then by server order, so a server
+	   reaching a vertex first is one of its closest, and each vertex is
+	   settled by the first K distinct servers to reach it */
+	ret = EXIT_SUCCESS;
+	for (i = 0; i < config->serversCount && !ret; i++)
+		if (isSource(config, members, i))
+			ret = heapPush(&heap, config->servers[i].vertex, i, 0);
+
+	if (ret || settle(&heap, nearest, graph, NULL)) {
+		log(DEFAULT_LOG, "failed to build nearest table.\n");
+		free(heap.labels);
+		freeNearestTable(nearest);
+		return EXIT_FAILURE;
+	}
+
+	free(heap.labels);
+	return EXIT_SUCCESS;
+}
+
+int dns_BuildNearest(struct dns_config_t *config)
+{
+	freeNearest(config);
+
+	if (buildTable(config, &(config->nearest), NULL)) {
+		freeNearest(config);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int dns_BuildPoolNearest(struct dns_config_t *config)
+{
+	struct nearest_t *tables, *compiled;
+	const uint8_t **members, **compiledMembers;
+	struct zone_t *zone;
+	size_t compiledCount, i, j, k;
+	int ret;
+
+	/* the tables a compiled topology came with are taken by the pools
+	   they were compiled for, the other pools are built */
+	compiled = config->poolNearest;
+	compiledMembers = config->poolMembers;
+	compiledCount = config->poolNearestCount;
+	config->poolNearest = NULL;
+	config->poolMembers = NULL;
+	config->poolNearestCount = 0;
+
+	ret = EXIT_SUCCESS;
+	for (i = 0; i < config->zonesCount && !ret; i++) {
+		zone = &(config->zones[i]);
+		zone->ranking = 0;
+		if (!usesGraph(zone->lbType) || !zone->members)
+			continue;
+
+		/* the zones of the same pool share its table */
+		for (j = 0; j < config->poolNearestCount; j++)
+			if (!memcmp(config->poolMembers[j], zone->members,
+				    config->serversCount))
+				break;
+
+		if (j == config->poolNearestCount) {
+			tables = realloc(config->poolNearest,
+					 (j + 1) * sizeof(*tables));
+			if (tables)
+				config->poolNearest = tables;
+			members = realloc(config->poolMembers,
+					  (j + 1) * sizeof(*members));
+			if (members)
+				config->poolMembers = members;
+
+			if (!tables || !members) {
+				log(DEFAULT_LOG, "failed to grow pool "
+				    "tables.\n");
+				ret = EXIT_FAILURE;
+				break;
+			}
+
+			for (k = 0; k < compiledCount; k++)
+				if (compiled[k].servers &&
+				    !memcmp(compiledMembers[k], zone->members,
+					    config->serversCount))
+					break;
+
+			if (k < compiledCount) {
+				tables[j] = compiled[k];
+				memset(&(compiled[k]), 0, sizeof(compiled[k]));
+				log(DEFAULT_LOG, "pool table %zu was compiled\n",
+				    j);
+			} else {
+				memset(&(tables[j]), 0, sizeof(tables[j]));
+				if (buildTable(config, &(tables[j]),
+					       zone->members)) {
+					ret = EXIT_FAILURE;
+					break;
+				}
+			}
+
+			members[j] = zone->members;
+			config->poolNearestCount++;
+		}
+
+		zone->ranking = j + 1;
+	}
+
+	for (k = 0; k < compiledCount; k++)
+		freeNearestTable(&(compiled[k]));
+	free(compiled);
+	free(compiledMembers);
+	free(config->compiledMembers);
+	config->compiledMembers = NULL;
+	return ret;
+}
+
+/**
+   Repair nearest, the table of the servers in members, see
+   dns_RepairNearest.
+
+   @return 0 on success, 1 otherwise
+*/
+static int repairTable(struct dns_config_t *config, struct nearest_t *nearest,
+		       const uint8_t *members, const uint32_t *changed,
+		       size_t count)
+{
+	struct nearest_scratch_t *scratch = &(config->scratch);
+	const struct graph_t *graph = &(config->graph);
+	const uint32_t *neighbors, *weights;
+	struct heap_t heap;
+	size_t stackCount, affectedCount, degree, i, e, cap;
+	uint32_t v;
+	uint8_t *state;
+	long vertex;
+	int ret;
+
+	if (growNearest(nearest, graph->vertexCount)) {
+		log(DEFAULT_LOG, "failed to grow nearest table.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the buffers of the previous repairs are reused, the state of every
+	   vertex being clear but for DIRTY */
+	cap = scratch->stateCap;
+	if (cap < graph->vertexCount) {
+		while (cap < graph->vertexCount)
+			cap = cap ? cap * 2 : DEFAULT_CAP;
+		if (!(state = realloc(scratch->state, cap))) {
+			log(DEFAULT_LOG, "failed to grow repair state.\n");
+			return EXIT_FAILURE;
+		}
+		memset(state + scratch->stateCap, 0, cap - scratch->stateCap);
+		scratch->state = state;
+		scratch->stateCap = cap;
+	}
+	state = scratch->state;
+
+	heap.labels = scratch->heap;
+	heap.cap = scratch->heapCap;
+	heap.count = 0;
+	stackCount = affectedCount = 0;
+	ret = EXIT_FAILURE;
+
+	/* a vertex is affected when one of its servers is no longer reached
+	   through a neighbor that is not affected, starting from the ends of
+	   the changed links.  Its neighbors are checked again once it is */
+	for (i = 0; i < count; i++) {
+		state[changed[i]] |= CHANGED;
+		if (pushVertex(&(scratch->stack), &stackCount,
+			       &(scratch->stackCap), changed[i]))
+			goto done;
+	}
+
+	while (stackCount) {
+		v = scratch->stack[--stackCount];
+		if ((state[v] & AFFECTED) ||
+		    supported(config, nearest, members, state, v))
+			continue;
+
+		state[v] |= AFFECTED;
+		if (pushVertex(&(scratch->affected), &affectedCount,
+			       &(scratch->affectedCap), v) ||
+		    markDirty(scratch, v))
+			goto done;
+
+		degree = getNeighbors(graph, v, &neighbors, NULL);
+		for (e = 0; e < degree; e++)
+			if (!(state[neighbors[e]] & AFFECTED) &&
+			    pushVertex(&(scratch->stack), &stackCount,
+				       &(scratch->stackCap), neighbors[e]))
+				goto done;
+	}
+
+	log(DEFAULT_LOG, "repairing %zu of %zu vertices\n", affectedCount,
+	    graph->vertexCount);
+
+	for (i = 0; i < affectedCount; i++)
+		nearest->counts[scratch->affected[i]] = 0;
+
+	/* seed the affected vertices with their own servers and the servers
+	   of the neighbors that kept theirs, and carry the servers of the
+	   changed vertices over the links that were added or got cheaper */
+	for (i = 0; i < config->serversCount; i++) {
+		vertex = config->servers[i].vertex;
+		if (isSource(config, members, i) &&
+		    (size_t) vertex < graph->vertexCount &&
+		    (state[vertex] & (CHANGED | AFFECTED)) &&
+		    heapPush(&heap, vertex, i, 0))
+			goto done;
+	}
+
+	for (i = 0; i < affectedCount; i++) {
+		v = scratch->affected[i];
+		degree = getNeighbors(graph, v, &neighbors, &weights);
+		for (e = 0; e < degree; e++)
+			if (!(state[neighbors[e]] & AFFECTED) &&
+			    pushLabels(&heap, nearest, neighbors[e], v,
+				       weights[e]))
+				goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (state[changed[i]] & AFFECTED)
+			continue;
+
+		degree = getNeighbors(graph, changed[i], &neighbors, &weights);
+		for (e = 0; e < degree; e++)
+			if (pushLabels(&heap, nearest, changed[i], neighbors[e],
+				       weights[e]))
+				goto done;
+	}
+
+	if (!settle(&heap, nearest, graph, scratch))
+		ret = EXIT_SUCCESS;
+
+done:
+	if (ret)
+		log(DEFAULT_LOG, "failed to repair nearest table.\n");
+
+	/* leave the state clear for the next repair */
+	for (i = 0; i < count; i++)
+		state[changed[i]] &= ~(CHANGED | AFFECTED);
+	for (i = 0; i < affectedCount; i++)
+		state[scratch->affected[i]] &= ~(CHANGED | AFFECTED);
+
+	scratch->heap = heap.labels;
+	scratch->heapCap = heap.cap;
+	return ret;
+}
+
+int dns_RepairNearest(struct dns_config_t *config, const uint32_t *changed,
+		      size_t count)
+{
+	size_t i;
+
+	if (repairTable(config, &(config->nearest), NULL, changed, count))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < config->poolNearestCount; i++)
+		if (repairTable(config, &(config->poolNearest[i]),
+				config->poolMembers[i], changed, count))
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+int dns_RankServer(struct dns_config_t *config, size_t server)
+{
+	long vertex = config->servers[server].vertex;
+	uint32_t changed;
+	size_t i;
+
+	if (vertex == -1)
+		return EXIT_SUCCESS;
+
+	/* a server that went down is a label nothing supports any more, one
+	   that came up is seeded at its vertex */
+	changed = vertex;
+	if (repairTable(config, &(config->nearest), NULL, &changed, 1))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < config->poolNearestCount; i++)
+		if (config->poolMembers[i][server] &&
+		    repairTable(config, &(config->poolNearest[i]),
+				config->poolMembers[i], &changed, 1))
+			return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+int syncNearest(struct nearest_t *dst, const struct nearest_t *src,
+		const struct nearest_scratch_t *scratch)
+{
+	size_t i, first, v;
+
+	if (!dst->servers)
+		return copyNearest(dst, src);
+
+	first = dst->vertices;
+	if (growNearest(dst, src->vertices)) {
+		log(DEFAULT_LOG, "failed to grow nearest table.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the vertices added since are dirty too */
+	for (v = first; v < src->vertices; v++)
+		copyVertex(dst, src, v);
+
+	for (i = 0; i < scratch->dirtyCount; i++)
+		if (scratch->dirty[i] < first)
+			copyVertex(dst, src, scratch->dirty[i]);
+
+	return EXIT_SUCCESS;
+}
+
+void clearDirty(struct nearest_scratch_t *scratch)
+{
+	size_t i;
+
+	for (i = 0; i < scratch->dirtyCount; i++)
+		scratch->state[scratch->dirty[i]] &= ~DIRTY;
+	scratch->dirtyCount = 0;
+}
+
+int copyNearest(struct nearest_t *dst, const struct nearest_t *src)
+{
+	size_t count = src->vertices;
+
+	dst->vertices = count;
+	dst->servers = malloc((count * K + 1) * sizeof(uint32_t));
+	dst->dists = malloc((count * K + 1) * sizeof(uint32_t));
+	dst->counts = malloc((count + 1) * sizeof(uint8_t));
+	if (!dst->servers || !dst->dists || !dst->counts) {
+		log(DEFAULT_LOG, "failed to copy nearest table.\n");
+		freeNearestTable(dst);
+		return EXIT_FAILURE;
+	}
+
+	memcpy(dst->servers, src->servers, count * K * sizeof(uint32_t));
+	memcpy(dst->dists, src->dists, count * K * sizeof(uint32_t));
+	memcpy(dst->counts, src->counts, count * sizeof(uint8_t));
+
+	return EXIT_SUCCESS;
+}
+
+void freeNearest(struct dns_config_t *config)
+{
+	struct nearest_scratch_t *scratch = &(config->scratch);
+	size_t i;
+
+	freeNearestTable(&(config->nearest));
+
+	for (i = 0; i < config->poolNearestCount; i++)
+		freeNearestTable(&(config->poolNearest[i]));
+	free(config->poolNearest);
+	free(config->poolMembers);
+	free(config->compiledMembers);
+	config->poolNearest = NULL;
+	config->poolMembers = NULL;
+	config->compiledMembers = NULL;
+	config->poolNearestCount = 0;
+
+	free(scratch->state);
+	free(scratch->stack);
+	free(scratch->affected);
+	free(scratch->heap);
+	free(scratch->row);
+	free(scratch->weights);
+	free(scratch->changed);
+	free(scratch->dirty);
+	memset(scratch, 0, sizeof(*scratch));
+}
+
+void freeNearestTable(struct nearest_t *nearest)
+{
+	free(nearest->servers);
+	free(nearest->dists);
+	free(nearest->counts);
+	memset(nearest, 0, sizeof(*nearest));
+}
+
+size_t nearestServers(const struct nearest_t *nearest, size_t vertex,
+		      size_t *servers, uint32_t *dists, size_t n)
+{
+	size_t i;
+
+	if (vertex >= nearest->vertices)
+		return 0;
+
+	n = min(n, nearest->counts[vertex]);
+	for (i = 0; i < n; i++) {
+		servers[i] = nearest->servers[vertex * K + i];
+		if (dists)
+			dists[i] = nearest->dists[vertex * K + i];
+	}
+
+	return n;
+}
+
+static int markDirty(struct nearest_scratch_t *scratch, uint32_t vertex)
+{
+	if (scratch->state[vertex] & DIRTY)
+		return EXIT_SUCCESS;
+
+	scratch->state[vertex] |= DIRTY;
+	return pushVertex(&(scratch->dirty), &(scratch->dirtyCount),
+			  &(scratch->dirtyCap), vertex);
+}
+
+static void copyVertex(struct nearest_t *dst, const struct nearest_t *src,
+		       size_t vertex)
+{
+	memcpy(dst->servers + vertex * K, src->servers + vertex * K,
+	       K * sizeof(uint32_t));
+	memcpy(dst->dists + vertex * K, src->dists + vertex * K,
+	       K * sizeof(uint32_t));
+	dst->counts[vertex] = src->counts[vertex];
+}
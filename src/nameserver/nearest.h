@@ -0,0 +1,106 @@
+#pragma once
+/*
+  Precomputed nearest-server table for geographic load balancing.
+
+  The ranked closest servers of every vertex, by total link cost, are computed
+  once with a multi-source Dijkstra from all servers, and a query is a hash
+  lookup of the client plus a table read.  When LSAs change links at runtime,
+  the table is repaired around the changed links instead of being computed
+  again, reusing the buffers of the previous repairs, and the vertices it
+  changes are tracked so that a snapshot copies only those.
+
+  A zone whose pool has only part of the servers has a table of its own,
+  shared with the zones of the same pool, so that its clients get the
+  closest servers of the pool however far the other servers are.  Servers
+  that are down are not ranked, see health.h.
+
+  When every link costs 1 the table is instead built with a BFS that carries
+  64 servers per vertex as the bits of a word, its levels searched on several
+  threads.
+*/
+
+#include "nameserver.h"
+
+/**
+   Fill config->nearest with the DNS_MAX_ANSWERS closest servers of every
+   vertex of config's graph.  Servers at the same cost are ranked by their
+   order in the servers file.
+
+   @param config the dns configuration with the servers and the graph
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_BuildNearest(struct dns_config_t *config);
+
+/**
+   Fill config->poolNearest with a table of the closest servers of every
+   vertex among the servers of each distinct pool of part of the servers that
+   a zone ranks with GEO or LOAD, and point the zones at their tables.  The
+   graph has to be built already.  The tables loaded from a compiled topology
+   are kept for the pools with the same servers, and dropped for the others.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_BuildPoolNearest(struct dns_config_t *config);
+
+/**
+   Repair config->nearest and the tables of the pools after the links of
+   the count vertices in changed were updated in config's graph.  Only the
+   vertices whose closest servers may have been reached through a removed or
+   costlier link are recomputed, and servers that got closer through an
+   added or cheaper link are propagated from its ends.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_RepairNearest(struct dns_config_t *config, const uint32_t *changed,
+		      size_t count);
+
+/**
+   Repair the tables of config that rank server after it went up or down,
+   as config->health[server].ranked tells.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_RankServer(struct dns_config_t *config, size_t server);
+
+/**
+   Initialize dst as a copy of the nearest-server table src.
+
+   @return 0 on success, 1 otherwise
+*/
+int copyNearest(struct nearest_t *dst, const struct nearest_t *src);
+
+/**
+   Bring dst, a copy of the table src from an earlier snapshot, up to date
+   with it by copying only the vertices marked dirty in scratch since, and
+   the vertices added since.  An empty dst is copied in full.
+
+   @return 0 on success, 1 otherwise
+*/
+int syncNearest(struct nearest_t *dst, const struct nearest_t *src,
+		const struct nearest_scratch_t *scratch);
+
+/**
+   Start tracking the vertices whose closest servers change from scratch
+   over.
+*/
+void clearDirty(struct nearest_scratch_t *scratch);
+
+/**
+   Free the nearest-server tables of config and its repair buffers.
+*/
+void freeNearest(struct dns_config_t *config);
+
+/**
+   Free the nearest-server table nearest.
+*/
+void freeNearestTable(struct nearest_t *nearest);
+
+/**
+   Store the indices of up to n of the closest servers to vertex in servers,
+   closest first, and their path costs in dists unless it is NULL.
+
+   @return the number of servers stored
+*/
+size_t nearestServers(const struct nearest_t *nearest, size_t vertex,
+		      size_t *servers, uint32_t *dists, size_t n);
@@ -0,0 +1,339 @@
+/*
+  Functions to map client addresses to vertices by longest prefix match
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "prefix.h"
+#include "graph.h"
+#include "../common/log.h"
+
+#define ADDR_BITS 32
+#define NO_VERTEX UINT32_MAX
+#define DEFAULT_CAP 16
+
+/**
+   Split the network "<address>/<length>" of an entry of the prefix file.
+
+   @return 0 on success, 1 if it is malformed
+*/
+static int parseNetwork(char *tok, uint32_t *addr, uint8_t *len);
+
+/**
+   Append the node of prefix addr/len, attached to vertex, to table.
+
+   @return the node, 0 on failure since the root can not be appended
+*/
+static uint32_t newNode(struct prefix_table_t *table, uint32_t addr,
+			uint8_t len, uint32_t vertex);
+
+/**
+   Attach the addresses of prefix addr/len to vertex in table.  A prefix
+   already in table is taken over.
+
+   @return 0 on success, 1 otherwise
+*/
+static int insertPrefix(struct prefix_table_t *table, uint32_t addr,
+			uint8_t len, uint32_t vertex);
+
+/**
+   Return the mask of the first len bits of an address.
+*/
+static uint32_t prefixMask(unsigned len);
+
+/**
+   Return the bit of the address addr past its first len bits.
+*/
+static unsigned addrBit(uint32_t addr, unsigned len);
+
+int dns_ParsePrefixes(struct dns_config_t *config)
+{
+	FILE *file;
+	char *line = NULL, *network, *vertex, *save;
+	size_t lineLen, cap;
+	struct prefix_t *prefixes, *prefix;
+
+	if (!config->prefixFile)
+		return EXIT_SUCCESS;
+
+	if (!(file = fopen(config->prefixFile, "r"))) {
+		perror("fopen");
+		log(DEFAULT_LOG, "fopen prefix file failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	while (getline(&line, &lineLen, file) != -1) {
+		network = strtok_r(line, " \t\r\n", &save);
+		if (!network)
+			continue;
+
+		vertex = strtok_r(NULL, " \t\r\n", &save);
+		if (config->prefixesCount == config->prefixesCap) {
+			cap = config->prefixesCap ? config->prefixesCap * 2 :
+				DEFAULT_CAP;
+			prefixes = realloc(config->prefixes,
+					   cap * sizeof(*prefixes));
+			if (!prefixes) {
+				log(DEFAULT_LOG, "failed to grow prefixes.\n");
+				goto fail;
+			}
+			config->prefixes = prefixes;
+			config->prefixesCap = cap;
+		}
+
+		prefix = &(config->prefixes[config->prefixesCount]);
+		if (!vertex || parseNetwork(network, &(prefix->addr),
+					    &(prefix->len))) {
+			log(DEFAULT_LOG, "improper prefix format line.\n");
+			goto fail;
+		}
+
+		if (!(prefix->attachment = strdup(vertex))) {
+			log(DEFAULT_LOG, "failed to strdup prefix vertex.\n");
+			goto fail;
+		}
+
+		log(DEFAULT_LOG, "prefix %s/%u attaches to %s\n", network,
+		    prefix->len, prefix->attachment);
+		config->prefixesCount++;
+	}
+
+	free(line);
+	fclose(file);
+	return EXIT_SUCCESS;
+
+fail:
+	free(line);
+	fclose(file);
+	return EXIT_FAILURE;
+}
+
+int dns_BuildPrefixes(struct dns_config_t *config)
+{
+	const struct graph_t *graph = &(config->graph);
+	struct prefix_table_t *table;
+	struct prefix_t *prefix;
+	size_t i, attached;
+	long v;
+
+	/* vertices that are clients themselves are found by their ids, the
+	   table only changes when the vertex of a network joins the graph */
+	if (config->prefixVertices == graph->vertexCount)
+		return EXIT_SUCCESS;
+
+	for (i = attached = 0; i < config->prefixesCount; i++)
+		if (findVertex(graph, config->prefixes[i].attachment) != -1)
+			attached++;
+
+	config->prefixVertices = graph->vertexCount;
+	if (!attached || attached == config->prefixAttached)
+		return EXIT_SUCCESS;
+
+	if (!(table = calloc(1, sizeof(*table)))) {
+		log(DEFAULT_LOG, "failed to calloc prefix table.\n");
+		goto fail;
+	}
+	table->refs = 1;
+
+	/* the root has to come first so that a child of 0 means none */
+	if (newNode(table, 0, 0, NO_VERTEX) || !table->nodes)
+		goto fail;
+
+	for (i = 0; i < config->prefixesCount; i++) {
+		prefix = &(config->prefixes[i]);
+		if ((v = findVertex(graph, prefix->attachment)) == -1)
+			continue;
+
+		if (insertPrefix(table, prefix->addr, prefix->len, v))
+			goto fail;
+	}
+
+	log(DEFAULT_LOG, "prefix table of %zu networks has %zu nodes\n",
+	    attached, table->count);
+
+	releasePrefixTable(config->prefixTable);
+	config->prefixTable = table;
+	config->prefixAttached = attached;
+	return EXIT_SUCCESS;
+
+fail:
+	log(DEFAULT_LOG, "failed to build prefix table.\n");
+	releasePrefixTable(table);
+	config->prefixVertices = 0;
+	return EXIT_FAILURE;
+}
+
+long prefixLookup(const struct prefix_table_t *table,
+		  const struct in_addr *addr)
+{
+	const struct prefix_node_t *node;
+	uint32_t key, vertex, next;
+
+	if (!table || !table->count)
+		return -1;
+
+	/* follow the bits of the address down the nodes it matches, the last
+	   prefix on the way being the longest */
+	key = ntohl(addr->s_addr);
+	vertex = NO_VERTEX;
+	for (next = 0, node = table->nodes;; node = &(table->nodes[next])) {
+		if ((key ^ node->addr) & prefixMask(node->len))
+			break;
+
+		if (node->vertex != NO_VERTEX)
+			vertex = node->vertex;
+
+		if (node->len == ADDR_BITS ||
+		    !(next = node->child[addrBit(key, node->len)]))
+			break;
+	}
+
+	return vertex == NO_VERTEX ? -1 : (long)vertex;
+}
+
+struct prefix_table_t *holdPrefixTable(struct prefix_table_t *table)
+{
+	if (table)
+		table->refs++;
+
+	return table;
+}
+
+void releasePrefixTable(struct prefix_table_t *table)
+{
+	if (!table || --(table->refs))
+		return;
+
+	free(table->nodes);
+	free(table);
+}
+
+void freePrefixes(struct dns_config_t *config)
+{
+	size_t i;
+
+	for (i = 0; i < config->prefixesCount; i++)
+		free(config->prefixes[i].attachment);
+
+	free(config->prefixes);
+	config->prefixes = NULL;
+	config->prefixesCount = config->prefixesCap = 0;
+
+	releasePrefixTable(config->prefixTable);
+	config->prefixTable = NULL;
+	config->prefixVertices = config->prefixAttached = 0;
+}
+
+static int parseNetwork(char *tok, uint32_t *addr, uint8_t *len)
+{
+	struct in_addr network;
+	char *sep, *end;
+	unsigned long n;
+
+	if (!(sep = strchr(tok, '/')))
+		return EXIT_FAILURE;
+
+	*sep = '\0';
+	errno = 0;
+	n = strtoul(sep + 1, &end, 10);
+	if (errno || *end || end == sep + 1 || n > 32 ||
+	    inet_pton(AF_INET, tok, &network) != 1)
+		return EXIT_FAILURE;
+
+	/* the host bits of the address do not matter */
+	*len = n;
+	*addr = n ? ntohl(network.s_addr) & (UINT32_MAX << (32 - n)) : 0;
+	return EXIT_SUCCESS;
+}
+
+static uint32_t newNode(struct prefix_table_t *table, uint32_t addr,
+			uint8_t len, uint32_t vertex)
+{
+	struct prefix_node_t *nodes, *node;
+	size_t cap;
+
+	if (table->count == table->cap) {
+		cap = table->cap ? table->cap * 2 : DEFAULT_CAP;
+		nodes = realloc(table->nodes, cap * sizeof(*nodes));
+		if (!nodes) {
+			log(DEFAULT_LOG, "failed to grow prefix table.\n");
+			return 0;
+		}
+		table->nodes = nodes;
+		table->cap = cap;
+	}
+
+	node = &(table->nodes[table->count]);
+	node->addr = addr;
+	node->len = len;
+	node->vertex = vertex;
+	node->child[0] = node->child[1] = 0;
+	return table->count++;
+}
+
+static int insertPrefix(struct prefix_table_t *table, uint32_t addr,
+			uint8_t len, uint32_t vertex)
+{
+	const struct prefix_node_t *below;
+	uint32_t node, child, split, leaf, diff;
+	unsigned bit, common;
+
+	/* walk down the nodes of the prefixes addr/len is in, each one
+	   matching addr over its length */
+	node = 0;
+	while (table->nodes[node].len < len) {
+		bit = addrBit(addr, table->nodes[node].len);
+		if (!(child = table->nodes[node].child[bit])) {
+			if (!(leaf = newNode(table, addr, len, vertex)))
+				return EXIT_FAILURE;
+			table->nodes[node].child[bit] = leaf;
+			return EXIT_SUCCESS;
+		}
+
+		/* the bits addr shares with the child */
+		below = &(table->nodes[child]);
+		diff = (addr ^ below->addr) & prefixMask(below->len);
+		common = diff ? (unsigned) __builtin_clz(diff) : below->len;
+		if (common > len)
+			common = len;
+
+		if (common == below->len) {
+			node = child;
+			continue;
+		}
+
+		/* addr/len or the bits it shares branch off above the child,
+		   newNode may move the nodes */
+		split = newNode(table, addr & prefixMask(common), common,
+				common == len ? vertex : NO_VERTEX);
+		if (!split)
+			return EXIT_FAILURE;
+		below = &(table->nodes[child]);
+		table->nodes[split].child[addrBit(below->addr, common)] = child;
+		table->nodes[node].child[bit] = split;
+		if (common == len)
+			return EXIT_SUCCESS;
+
+		if (!(leaf = newNode(table, addr, len, vertex)))
+			return EXIT_FAILURE;
+		table->nodes[split].child[addrBit(addr, common)] = leaf;
+		return EXIT_SUCCESS;
+	}
+
+	table->nodes[node].vertex = vertex;
+	return EXIT_SUCCESS;
+}
+
+static uint32_t prefixMask(unsigned len)
+{
+	return len ? UINT32_MAX << (ADDR_BITS - len) : 0;
+}
+
+static unsigned addrBit(uint32_t addr, unsigned len)
+{
+	return (addr >> (ADDR_BITS - 1 - len)) & 1;
+}
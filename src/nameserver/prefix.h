@@ -0,0 +1,60 @@
+#pragma once
+/*
+  Mapping of clients to the vertices they attach to in the network graph.
+
+  Clients are rarely routers of the LSA file themselves, so the optional
+  prefix file lists client networks, one "<address>/<length> <vertex>" per
+  line.  A client that is a vertex of the graph is attached to that vertex,
+  found by its id, and any other IPv4 client to the vertex of the longest
+  prefix that matches its address.
+
+  The table is a path-compressed binary trie, with at most two nodes per
+  network.  It is rebuilt when the vertex of a network joins the graph, and is
+  shared by the snapshots until then.
+*/
+
+#include <netinet/in.h>
+
+#include "nameserver.h"
+
+/**
+   Parse the client networks of config's prefix file, if there is one.  A
+   network whose vertex is not in the graph yet is kept for when it joins.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_ParsePrefixes(struct dns_config_t *config);
+
+/**
+   Build config's prefix table from its client networks whose vertices are in
+   its graph, unless the latest one was built from the same networks.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_BuildPrefixes(struct dns_config_t *config);
+
+/**
+   Find the vertex the client with the IPv4 address addr attaches to.
+
+   @return the vertex, -1 if no prefix matches addr
+*/
+long prefixLookup(const struct prefix_table_t *table,
+		  const struct in_addr *addr);
+
+/**
+   Take a reference on table, which may be NULL.
+
+   @return table
+*/
+struct prefix_table_t *holdPrefixTable(struct prefix_table_t *table);
+
+/**
+   Drop a reference on table, which may be NULL, and free it with the last
+   one.
+*/
+void releasePrefixTable(struct prefix_table_t *table);
+
+/**
+   Free the client networks of config and release its prefix table.
+*/
+void freePrefixes(struct dns_config_t *config);
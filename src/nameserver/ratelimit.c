@@ -0,0 +1,153 @@
+/*
+  Functions to limit the query rate of every client
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <netinet/in.h>
+
+#include "ratelimit.h"
+#include "../common/hashtable.h"
+#include "../common/log.h"
+
+#define TOKEN 1024 /* fixed point units of a token */
+#define MAX_RATE 1000000 /* queries per second a client may be allowed */
+
+/**
+   Parse the number at the start of str into *n, from 1 to MAX_RATE, and
+   point *end past it.
+
+   @return 0 on success, 1 otherwise
+*/
+static int parseRate(const char *str, char **end, unsigned long *n);
+
+/**
+   Hash the binary address of client.
+
+   @return 1 and set *key on success, 0 if the address family is unknown
+*/
+static int clientKey(const struct sockaddr *client, uint32_t *key);
+
+int dns_ParseRateLimit(struct dns_config_t *config, const char *arg)
+{
+	unsigned long rate, burst;
+	char *end;
+
+	if (parseRate(arg, &end, &rate))
+		return EXIT_FAILURE;
+
+	burst = rate;
+	if (*end == ',' && parseRate(end + 1, &end, &burst))
+		return EXIT_FAILURE;
+
+	if (*end)
+		return EXIT_FAILURE;
+
+	config->rateLimit = rate;
+	config->rateBurst = burst;
+	return EXIT_SUCCESS;
+}
+
+int rateInit(struct dns_config_t *config)
+{
+	size_t i;
+
+	config->rateSlots = aligned_alloc(sizeof(struct rate_slot_t),
+					  RATE_SLOTS *
+					  sizeof(struct rate_slot_t));
+	if (!config->rateSlots) {
+		log(DEFAULT_LOG, "failed to alloc rate limit table.\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(config->rateSlots, 0, RATE_SLOTS * sizeof(struct rate_slot_t));
+	for (i = 0; i < RATE_SLOTS; i++)
+		atomic_flag_clear(&(config->rateSlots[i].lock));
+
+	return EXIT_SUCCESS;
+}
+
+int allowQuery(struct dns_config_t *config, const struct sockaddr *client,
+	       mytime_t now)
+{
+	struct rate_slot_t *slot;
+	struct rate_bucket_t *bucket;
+	uint64_t tokens, burst;
+	mytime_t elapsed;
+	uint32_t key;
+	size_t i;
+	int allowed;
+
+	if (!config->rateSlots || !clientKey(client, &key))
+		return 1;
+
+	slot = &(config->rateSlots[key & (RATE_SLOTS - 1)]);
+	while (atomic_flag_test_and_set_explicit(&(slot->lock),
+						 memory_order_acquire))
+		;
+
+	/* the client, or the least recently seen one it takes over */
+	bucket = &(slot->buckets[0]);
+	for (i = 0; i < RATE_WAYS; i++) {
+		if (slot->buckets[i].time && slot->buckets[i].key == key) {
+			bucket = &(slot->buckets[i]);
+			break;
+		}
+		if (slot->buckets[i].time < bucket->time)
+			bucket = &(slot->buckets[i]);
+	}
+
+	burst = (uint64_t) config->rateBurst * TOKEN;
+	if (!bucket->time || bucket->key != key) {
+		bucket->key = key;
+		tokens = burst;
+	} else {
+		/* past a full refill the elapsed time no longer matters */
+		elapsed = now > bucket->time ? now - bucket->time : 0;
+		if (elapsed > (mytime_t) 1000000 * config->rateBurst /
+		    config->rateLimit)
+			elapsed = (mytime_t) 1000000 * config->rateBurst /
+				config->rateLimit;
+		tokens = bucket->tokens +
+			elapsed * config->rateLimit * TOKEN / 1000000;
+		if (tokens > burst)
+			tokens = burst;
+	}
+
+	allowed = tokens >= TOKEN;
+	bucket->tokens = allowed ? tokens - TOKEN : tokens;
+	bucket->time = now ? now : 1;
+
+	atomic_flag_clear_explicit(&(slot->lock), memory_order_release);
+	return allowed;
+}
+
+void freeRateLimit(struct dns_config_t *config)
+{
+	free(config->rateSlots);
+	config->rateSlots = NULL;
+}
+
+static int parseRate(const char *str, char **end, unsigned long *n)
+{
+	errno = 0;
+	*n = strtoul(str, end, 10);
+	return errno || *end == str || !*n || *n > MAX_RATE;
+}
+
+static int clientKey(const struct sockaddr *client, uint32_t *key)
+{
+	const struct sockaddr_in *v4 = (const struct sockaddr_in *) client;
+	const struct sockaddr_in6 *v6 = (const struct sockaddr_in6 *) client;
+
+	if (client->sa_family == AF_INET)
+		*key = ht_hash(&(v4->sin_addr), sizeof(v4->sin_addr));
+	else if (client->sa_family == AF_INET6)
+		*key = ht_hash(&(v6->sin6_addr), sizeof(v6->sin6_addr));
+	else
+		return 0;
+
+	return 1;
+}
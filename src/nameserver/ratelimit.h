@@ -0,0 +1,49 @@
+#pragma once
+/*
+  Per-client query rate limiting.
+
+  With -q <rate>[,<burst>] every client address gets a token bucket of burst
+  queries refilled at rate queries per second, burst being rate by default.
+  A query without a token left is dropped before it is even parsed.
+
+  The buckets live in a fixed table of RATE_SLOTS cache lines shared by the
+  query threads, each line holding RATE_WAYS clients under its own spin lock.
+  A client is looked up by a hash of its binary address, and takes over the
+  least recently seen client of its line when it is not there, so a flood of
+  spoofed sources can only push out clients sharing its lines.
+*/
+
+#include <sys/socket.h>
+
+#include "nameserver.h"
+#include "../common/mytime.h"
+
+#define RATE_SLOTS 4096 /* cache lines of the table, a power of 2 */
+
+/**
+   Parse the rate limit option "<rate>[,<burst>]" into config.
+
+   @return 0 on success, 1 if it is malformed
+*/
+int dns_ParseRateLimit(struct dns_config_t *config, const char *arg);
+
+/**
+   Set up the empty rate limit table of config.
+
+   @return 0 on success, 1 otherwise
+*/
+int rateInit(struct dns_config_t *config);
+
+/**
+   Take a token from the bucket of client at time now.  Every query is
+   allowed without rate limiting.
+
+   @return 1 if the query of client is allowed, 0 if it is over the limit
+*/
+int allowQuery(struct dns_config_t *config, const struct sockaddr *client,
+	       mytime_t now);
+
+/**
+   Free the rate limit table of config.
+*/
+void freeRateLimit(struct dns_config_t *config);
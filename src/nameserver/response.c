@@ -0,0 +1,132 @@
+/*
+  Functions to build and copy precomputed DNS responses
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "response.h"
+#include "../common/mydnsparse.h"
+#include "../common/log.h"
+
+#define ANCOUNT_OFFSET 6
+#define QUESTION_TAIL 4 /* QTYPE and QCLASS after the question name */
+#define NAME_POINTER (0xc000 | DNS_HEADER_LEN) /* to the question name */
+#define RECORD_LEN (DNS_ANSWER_LEN - DOMAIN_NAME_LEN) /* TYPE to RDATA */
+
+/**
+   Overwrite the message ID of the image in buf with the one of request.
+*/
+static void patchId(uint8_t *buf, const struct dns_t *request)
+{
+	uint16_t id = htons(request->message_id);
+	memcpy(buf, &id, 2);
+}
+
+int dns_BuildTemplates(struct dns_config_t *config)
+{
+	struct dns_templates_t *t = &(config->templates);
+	struct dns_t message;
+	uint8_t image[DNS_RESPONSE_LEN(1)];
+	uint16_t pointer = htons(NAME_POINTER);
+	size_t i;
+
+	freeTemplates(config);
+
+	t->headerLen = DNS_HEADER_LEN;
+	t->answerLen = sizeof(pointer) + RECORD_LEN;
+	t->nxdomainLen = DNS_HEADER_LEN;
+
+	/* the header, the answers and the name error share one allocation */
+	if (!(t->header = calloc(t->headerLen + config->serversCount *
+				 t->answerLen + t->nxdomainLen,
+				 sizeof(uint8_t)))) {
+		log(DEFAULT_LOG, "failed to calloc response templates.\n");
+		return EXIT_FAILURE;
+	}
+	t->answers = t->header + t->headerLen;
+	t->nxdomain = t->answers + config->serversCount * t->answerLen;
+
+	/* a single answer response of every server gives the header and the
+	   answer record, its name replaced by a pointer to the question */
+	for (i = 0; i < config->serversCount; i++) {
+		generate_dns_message(&message, 0, RESPONSE,
+				     &(config->servers[i].addr), 1, 0);
+		if (serialize_dns(&message, image, sizeof(image)) !=
+		    (ssize_t) sizeof(image)) {
+			log(DEFAULT_LOG, "failed to build template for %s\n",
+			    config->servers[i].ip);
+			freeTemplates(config);
+			return EXIT_FAILURE;
+		}
+
+		memcpy(t->header, image, t->headerLen);
+		memcpy(t->answers + i * t->answerLen, &pointer,
+		       sizeof(pointer));
+		memcpy(t->answers + i * t->answerLen + sizeof(pointer),
+		       image + sizeof(image) - RECORD_LEN, RECORD_LEN);
+	}
+
+	generate_dns_message(&message, 0, RESPONSE, NULL, 0, 1);
+	if (serialize_dns(&message, t->nxdomain, t->nxdomainLen) !=
+	    (ssize_t) t->nxdomainLen) {
+		log(DEFAULT_LOG, "failed to build name error template.\n");
+		freeTemplates(config);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void freeTemplates(struct dns_config_t *config)
+{
+	free(config->templates.header);
+	memset(&(config->templates), 0, sizeof(config->templates));
+}
+
+ssize_t dns_FillReply(const struct dns_templates_t *templates,
+		      const struct dns_t *request, const size_t *servers,
+		      size_t count, uint8_t *buf, size_t size)
+{
+	uint16_t ancount;
+	size_t i, question, len;
+
+	question = request->query_name_len + QUESTION_TAIL;
+	if (!count || count > DNS_MAX_ANSWERS || !request->query_name ||
+	    size < templates->headerLen + question +
+	    count * templates->answerLen)
+		return -1;
+
+	memcpy(buf, templates->header, templates->headerLen);
+	patchId(buf, request);
+
+	ancount = htons(count);
+	memcpy(buf + ANCOUNT_OFFSET, &ancount, 2);
+
+	/* echo the question exactly as it was asked, the answers point to
+	   its name */
+	memcpy(buf + templates->headerLen, request->query_name, question);
+	len = templates->headerLen + question;
+
+	for (i = 0; i < count; i++) {
+		memcpy(buf + len, templates->answers +
+		       servers[i] * templates->answerLen, templates->answerLen);
+		len += templates->answerLen;
+	}
+
+	return len;
+}
+
+ssize_t dns_FillNXDomain(const struct dns_templates_t *templates,
+			 const struct dns_t *request, uint8_t *buf,
+			 size_t size)
+{
+	if (size < templates->nxdomainLen)
+		return -1;
+
+	memcpy(buf, templates->nxdomain, templates->nxdomainLen);
+	patchId(buf, request);
+
+	return templates->nxdomainLen;
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*
+  Precomputed DNS responses.  Every reply the nameserver sends is the
+  response header built by dns_BuildTemplates with the message ID and answer
+  count patched in, the question copied from the query, and the answer record
+  of every server appended.  Answer records name the question with a
+  compression pointer, so they hold for any zone.
+*/
+
+#include <sys/types.h>
+
+#include "nameserver.h"
+
+/**
+   Build the response header, the answer record of every server in config,
+   and the name error image.  Any previous templates are freed.
+
+   @param config the dns configuration with the parsed servers
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_BuildTemplates(struct dns_config_t *config);
+
+/**
+   Free the response templates of config.
+*/
+void freeTemplates(struct dns_config_t *config);
+
+/**
+   Write the response to request into buf, answering with the servers whose
+   indices are in servers, preferred one first.
+
+   @param templates the images built by dns_BuildTemplates
+   @param request the deserialized query being answered, with a question
+   @param servers indices of the servers to answer with
+   @param count number of indices in servers, at most DNS_MAX_ANSWERS
+   @param buf where the response is written
+   @param size size of buf
+
+   @return the length of the response, -1 if buf is too small
+*/
+ssize_t dns_FillReply(const struct dns_templates_t *templates,
+		      const struct dns_t *request, const size_t *servers,
+		      size_t count, uint8_t *buf, size_t size);
+
+/**
+   Write the name error response to request into buf.
+
+   @return the length of the response, -1 if buf is too small
+*/
+ssize_t dns_FillNXDomain(const struct dns_templates_t *templates,
+			 const struct dns_t *request, uint8_t *buf,
+			 size_t size);
@@ -0,0 +1,107 @@
+/*
+  Functions to manage the registry of video servers
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "servers.h"
+#include "../common/log.h"
+
+#define DEFAULT_SERVERS 16
+
+long registerServer(struct dns_config_t *config, const char *ip, size_t len)
+{
+	struct server_t *servers, *server;
+	size_t cap;
+	void **slot;
+	int created;
+
+	if (!config->serverIndex.entries &&
+	    ht_init(&(config->serverIndex), DEFAULT_SERVERS)) {
+		log(DEFAULT_LOG, "failed to init server index.\n");
+		return -1;
+	}
+
+	if (!(slot = ht_insert(&(config->serverIndex), ip, len, &created))) {
+		log(DEFAULT_LOG, "failed to index server.\n");
+		return -1;
+	}
+
+	if (!created)
+		return (uintptr_t) *slot;
+
+	if (config->serversCount == config->serversCap) {
+		cap = config->serversCap ? config->serversCap * 2 :
+			DEFAULT_SERVERS;
+		if (!(servers = realloc(config->servers,
+					cap * sizeof(*servers)))) {
+			log(DEFAULT_LOG, "failed to grow servers.\n");
+			return -1;
+		}
+
+		config->servers = servers;
+		config->serversCap = cap;
+	}
+
+	server = &(config->servers[config->serversCount]);
+	memset(server, 0, sizeof(*server));
+	server->vertex = -1;
+	server->weight = 1;
+
+	if (!(server->ip = strndup(ip, len))) {
+		perror("strndup");
+		return -1;
+	}
+
+	if (!inet_aton(server->ip, &(server->addr))) {
+		log(DEFAULT_LOG, "invalid server ip %s\n", server->ip);
+		free(server->ip);
+		return -1;
+	}
+
+	/* from the ip alone, so a server keeps its clients whatever the
+	   other servers are */
+	server->key = ht_hash(ip, len);
+
+	*slot = (void *) (uintptr_t) config->serversCount;
+	return config->serversCount++;
+}
+
+long findServer(const struct dns_config_t *config, const char *ip)
+{
+	void **slot;
+
+	if (!(slot = ht_find(&(config->serverIndex), ip, strlen(ip))))
+		return -1;
+
+	return (uintptr_t) *slot;
+}
+
+void linkServers(struct dns_config_t *config)
+{
+	size_t i;
+
+	for (i = 0; i < config->serversCount; i++) {
+		config->servers[i].vertex = findVertex(&(config->graph),
+						       config->servers[i].ip);
+		if (config->servers[i].vertex == -1)
+			log(DEFAULT_LOG, "server %s not in graph\n",
+			    config->servers[i].ip);
+	}
+}
+
+void freeServers(struct dns_config_t *config)
+{
+	size_t i;
+
+	for (i = 0; i < config->serversCount; i++)
+		free(config->servers[i].ip);
+
+	free(config->servers);
+	ht_free(&(config->serverIndex));
+	config->servers = NULL;
+	config->serversCount = config->serversCap = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+/*
+  Registry of the video servers the nameserver hands out.  Servers are kept
+  in a growable array in servers file order, indexed by ip, and each one is
+  linked to its vertex in the network graph once the graph is constructed.
+
+  A line of the servers file is "<ip> [<weight>]", the weight being the share
+  of the weighted round-robin rotation the server gets relative to the
+  others.
+*/
+
+#define MAX_WEIGHT 10000
+
+#include "nameserver.h"
+
+/**
+   Add the server with ip of len bytes to config's registry, unless it is
+   already registered.
+
+   @return the index of the server, or -1 on failure
+*/
+long registerServer(struct dns_config_t *config, const char *ip, size_t len);
+
+/**
+   Find the server with ip in config's registry.
+
+   @return the index of the server, or -1 if it is not registered
+*/
+long findServer(const struct dns_config_t *config, const char *ip);
+
+/**
+   Link every registered server to its vertex in config's graph.  Servers
+   that are not in the graph are linked to -1.
+*/
+void linkServers(struct dns_config_t *config);
+
+/**
+   free all of the servers stored in config's registry
+*/
+void freeServers(struct dns_config_t *config);
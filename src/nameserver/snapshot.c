@@ -0,0 +1,179 @@
+/*
+  Functions to publish and read topology snapshots
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "snapshot.h"
+#include "graph.h"
+#include "nearest.h"
+#include "prefix.h"
+#include "../common/log.h"
+
+#define GRACE_POLL 50000 /* nanoseconds between checks of the readers */
+
+/**
+   Free the snapshot snap and everything it holds.
+*/
+static void freeSnapshot(struct snapshot_t *snap);
+
+/**
+   Bring dst, the table of a replaced snapshot or an empty one, up to date
+   with the table src of the new snapshot.
+
+   @return 0 on success, 1 otherwise
+*/
+static int catchUp(struct nearest_t *dst, const struct nearest_t *src,
+		   const struct nearest_scratch_t *scratch);
+
+int snapshotInit(struct dns_config_t *config, size_t readers)
+{
+	size_t i;
+
+	if (!(config->readers = calloc(readers, sizeof(*(config->readers))))) {
+		log(DEFAULT_LOG, "failed to calloc snapshot readers.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < readers; i++)
+		atomic_init(&(config->readers[i].epoch), 0);
+
+	config->readersCount = readers;
+	atomic_init(&(config->epoch), 1);
+	atomic_init(&(config->snapshot), NULL);
+
+	return EXIT_SUCCESS;
+}
+
+int dns_PublishSnapshot(struct dns_config_t *config)
+{
+	struct snapshot_t *snap, *old;
+	struct timespec poll = { 0, GRACE_POLL };
+	struct nearest_t *tables = NULL;
+	unsigned long epoch, seen;
+	size_t i;
+	int first, ret;
+
+	if (!(snap = calloc(1, sizeof(*snap)))) {
+		log(DEFAULT_LOG, "failed to calloc snapshot.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* the pool tables of the first snapshot are copied into new ones,
+	   later the replaced snapshot hands its tables back */
+	first = !atomic_load(&(config->snapshot));
+	if (first)
+		tables = calloc(config->poolNearestCount + 1, sizeof(*tables));
+
+	snap->servers = malloc((config->serversCount + 1) *
+			       sizeof(*(snap->servers)));
+	if (!snap->servers || (first && !tables) ||
+	    dns_BuildPrefixes(config) ||
+	    shareGraph(&(snap->graph), &(config->graph))) {
+		log(DEFAULT_LOG, "failed to copy snapshot.\n");
+		freeSnapshot(snap);
+		free(tables);
+		return EXIT_FAILURE;
+	}
+
+	/* the tables repaired since the last snapshot are handed over as
+	   they are, the control thread takes the tables of the snapshot it
+	   replaces */
+	snap->nearest = config->nearest;
+	memset(&(config->nearest), 0, sizeof(config->nearest));
+	snap->poolNearest = config->poolNearest;
+	snap->poolNearestCount = config->poolNearestCount;
+	config->poolNearest = tables;
+
+	memcpy(snap->servers, config->servers,
+	       config->serversCount * sizeof(*(snap->servers)));
+	snap->serversCount = config->serversCount;
+	snap->prefixes = holdPrefixTable(config->prefixTable);
+
+	/* readers entering from the new epoch on can only see snap */
+	epoch = atomic_load(&(config->epoch)) + 1;
+	snap->version = epoch;
+	old = atomic_exchange(&(config->snapshot), snap);
+	atomic_store(&(config->epoch), epoch);
+
+	if (old) {
+		/* grace period: wait out the readers that entered an older
+		   epoch */
+		for (i = 0; i < config->readersCount; i++) {
+			while ((seen = atomic_load(&(config->readers[i].epoch)))
+			       && seen < epoch)
+				nanosleep(&poll, NULL);
+		}
+
+		log(DEFAULT_LOG, "snapshot %lu replaced %lu\n", epoch,
+		    old->version);
+		config->nearest = old->nearest;
+		memset(&(old->nearest), 0, sizeof(old->nearest));
+		config->poolNearest = old->poolNearest;
+		old->poolNearest = NULL;
+		old->poolNearestCount = 0;
+		freeSnapshot(old);
+	}
+
+	ret = catchUp(&(config->nearest), &(snap->nearest),
+		      &(config->scratch));
+	for (i = 0; i < config->poolNearestCount; i++)
+		ret |= catchUp(&(config->poolNearest[i]),
+			       &(snap->poolNearest[i]), &(config->scratch));
+
+	clearDirty(&(config->scratch));
+	return ret;
+}
+
+const struct snapshot_t *snapshotEnter(struct dns_config_t *config,
+				       size_t reader)
+{
+	atomic_store(&(config->readers[reader].epoch),
+		     atomic_load(&(config->epoch)));
+
+	return atomic_load(&(config->snapshot));
+}
+
+void snapshotLeave(struct dns_config_t *config, size_t reader)
+{
+	atomic_store(&(config->readers[reader].epoch), 0);
+}
+
+void freeSnapshots(struct dns_config_t *config)
+{
+	freeSnapshot(atomic_exchange(&(config->snapshot), NULL));
+	free(config->readers);
+	config->readers = NULL;
+	config->readersCount = 0;
+}
+
+static void freeSnapshot(struct snapshot_t *snap)
+{
+	size_t i;
+
+	if (!snap)
+		return;
+
+	freeGraph(&(snap->graph));
+	freeNearestTable(&(snap->nearest));
+	for (i = 0; i < snap->poolNearestCount; i++)
+		freeNearestTable(&(snap->poolNearest[i]));
+	free(snap->poolNearest);
+	free(snap->servers);
+	releasePrefixTable(snap->prefixes);
+	free(snap);
+}
+
+static int catchUp(struct nearest_t *dst, const struct nearest_t *src,
+		   const struct nearest_scratch_t *scratch)
+{
+	/* the old table differs from src by the vertices repaired since the
+	   last snapshot */
+	if (!syncNearest(dst, src, scratch))
+		return EXIT_SUCCESS;
+
+	freeNearestTable(dst);
+	return copyNearest(dst, src);
+}
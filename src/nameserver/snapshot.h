@@ -0,0 +1,48 @@
+#pragma once
+/*
+  Read-copy-update of the topology.
+
+  The thread that applies LSAs owns the graph, the servers and the
+  nearest-server table in the dns configuration.  Once it is done with a
+  batch of updates it copies them into a new snapshot and publishes it with an
+  atomic pointer swap, so a query never waits on a rebuild.  The snapshot it
+  replaced is freed after a grace period: once every query thread has either
+  left it or entered the new one.
+*/
+
+#include "nameserver.h"
+
+/**
+   Set up readers query threads to read config's snapshots.
+
+   @return 0 on success, 1 otherwise
+*/
+int snapshotInit(struct dns_config_t *config, size_t readers);
+
+/**
+   Copy config's graph, servers and nearest-server table into a new snapshot,
+   publish it, and free the previous one once no query thread can hold it.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_PublishSnapshot(struct dns_config_t *config);
+
+/**
+   Enter the current snapshot as query thread reader.  The snapshot stays
+   valid until snapshotLeave.
+
+   @return the snapshot, NULL if none was published
+*/
+const struct snapshot_t *snapshotEnter(struct dns_config_t *config,
+				       size_t reader);
+
+/**
+   Leave the snapshot query thread reader entered.
+*/
+void snapshotLeave(struct dns_config_t *config, size_t reader);
+
+/**
+   Free the published snapshot and the readers.  No query thread may be
+   reading.
+*/
+void freeSnapshots(struct dns_config_t *config);
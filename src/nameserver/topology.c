@@ -0,0 +1,791 @@
+/*
+  Functions to compile the topology into a file and to load it back
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "topology.h"
+#include "graph.h"
+#include "nearest.h"
+#include "servers.h"
+#include "lsa.h"
+#include "../common/log.h"
+
+#define TOPOLOGY_MAGIC "VIDTOPO" /* 8 bytes with the terminator */
+#define TOPOLOGY_VERSION 2
+#define BYTE_ORDER_MARK 0x01020304
+#define SECTION_ALIGN 8
+#define NO_LSA UINT32_MAX /* LSA count of a vertex that advertised none */
+#define K DNS_MAX_ANSWERS
+
+/**
+   The header of a compiled topology.  It is followed by these sections, each
+   one padded to SECTION_ALIGN bytes:
+
+   names          namesLen chars
+   nameOffsets    vertexCount size_t
+   id entries     idsCapacity struct ht_entry_t
+   id keys        idsKeysLen chars
+   offsets        rows + 1 uint32_t
+   targets        edgeCount uint32_t
+   weights        edgeCount uint32_t
+   server ips     serverNamesLen chars, every ip terminated
+   nearest        vertexCount * K uint32_t servers, as many uint32_t dists,
+                  then vertexCount uint8_t counts
+   LSAs           vertexCount int32_t seqs, vertexCount uint32_t counts, then
+                  linkCount struct lsa_link_t
+   pool members   poolCount * serversCount uint8_t, 1 for a server in the
+                  pool
+   pool nearest   the tables of the pools one after the other, laid out as
+                  nearest
+*/
+struct topology_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t wordSize; /* sizeof(size_t) */
+	uint32_t entrySize; /* sizeof(struct ht_entry_t) */
+	uint32_t answers;
+	uint32_t pad;
+	uint64_t vertexCount;
+	uint64_t namesLen;
+	uint64_t idsCapacity, idsCount, idsKeysLen;
+	uint64_t rows, edgeCount;
+	uint64_t serversCount, serverNamesLen;
+	uint64_t linkCount;
+	uint64_t poolCount;
+};
+
+/* A mapped compiled topology, read one section after the other */
+struct image_t {
+	const uint8_t *data;
+	size_t size;
+	size_t at;
+};
+
+/* The sections of a compiled topology, pointing into its image */
+struct sections_t {
+	const char *names;
+	const size_t *nameOffsets;
+	const struct ht_entry_t *entries;
+	const char *keys;
+	const uint32_t *offsets, *targets, *weights;
+	const char *serverNames;
+	const uint32_t *servers, *dists;
+	const uint8_t *counts;
+	const int32_t *seqs;
+	const uint32_t *linkCounts;
+	const struct lsa_link_t *links;
+	const uint8_t *poolMembers;
+	const uint32_t *poolServers, *poolDists;
+	const uint8_t *poolCounts;
+};
+
+/**
+   Write len bytes of data to file, padded to SECTION_ALIGN.
+
+   @return 0 on success, 1 otherwise
+*/
+static int writeSection(FILE *file, const void *data, size_t len);
+
+/**
+   Pad the section of len bytes just written to file to SECTION_ALIGN.
+
+   @return 0 on success, 1 otherwise
+*/
+static int writePadding(FILE *file, size_t len);
+
+/**
+   Write the body of config's compiled topology, as described by header, to
+   file.
+
+   @return 0 on success, 1 otherwise
+*/
+static int writeTopology(FILE *file, const struct dns_config_t *config,
+			 const struct topology_header_t *header);
+
+/**
+   Write the tables of config's pools, laid out as its nearest-server table,
+   to file.
+
+   @return 0 on success, 1 otherwise
+*/
+static int writePools(FILE *file, const struct dns_config_t *config);
+
+/**
+   Check that the tables of the pools in a compiled topology only rank the
+   members of their pools.
+
+   @return 0 on success, 1 if they do not
+*/
+static int checkPools(const struct topology_header_t *header,
+		      const struct sections_t *sections);
+
+/**
+   Copy the checked tables of the pools of a compiled topology into config,
+   for dns_BuildPoolNearest to take those of the pools of its zones.
+
+   @return 0 on success, 1 otherwise
+*/
+static int copyPools(struct dns_config_t *config,
+		     const struct topology_header_t *header,
+		     const struct sections_t *sections);
+
+/**
+   Take the next section of count elements of size bytes from image.
+
+   @return the section, NULL if image is too short for it
+*/
+static const void *takeSection(struct image_t *image, uint64_t count,
+			       size_t size);
+
+/**
+   Find the sections of the compiled topology image and check that they are
+   consistent with header and with config's servers.
+
+   @return 0 on success, 1 if the topology can not be loaded
+*/
+static int checkTopology(const struct dns_config_t *config,
+			 const struct topology_header_t *header,
+			 struct image_t *image, struct sections_t *sections);
+
+/**
+   Copy the checked sections of a compiled topology into config.
+
+   @return 0 on success, 1 otherwise
+*/
+static int copyTopology(struct dns_config_t *config,
+			const struct topology_header_t *header,
+			const struct sections_t *sections);
+
+int isCompiledTopology(const char *path)
+{
+	char magic[sizeof(TOPOLOGY_MAGIC)];
+	FILE *file;
+	int compiled;
+
+	if (!(file = fopen(path, "r")))
+		return 0;
+
+	compiled = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+		!memcmp(magic, TOPOLOGY_MAGIC, sizeof(magic));
+
+	fclose(file);
+	return compiled;
+}
+
+int dns_CompileTopology(const struct dns_config_t *config, const char *path)
+{
+	const struct graph_t *graph = &(config->graph);
+	struct topology_header_t header;
+	FILE *file;
+	char *tmp;
+	size_t v, i;
+	int ret;
+
+	if (graph->pendingCount || graph->overlayCount ||
+	    config->nearest.vertices != graph->vertexCount) {
+		log(DEFAULT_LOG, "topology is not built, can not compile.\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TOPOLOGY_MAGIC, sizeof(header.magic));
+	header.version = TOPOLOGY_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.wordSize = sizeof(size_t);
+	header.entrySize = sizeof(struct ht_entry_t);
+	header.answers = K;
+	header.vertexCount = graph->vertexCount;
+	header.namesLen = graph->namesLen;
+	header.idsCapacity = graph->ids.capacity;
+	header.idsCount = graph->ids.count;
+	header.idsKeysLen = graph->ids.keysLen;
+	header.rows = graph->rows;
+	header.edgeCount = graph->edgeCount;
+	header.serversCount = config->serversCount;
+	for (i = 0; i < config->serversCount; i++)
+		header.serverNamesLen += strlen(config->servers[i].ip) + 1;
+	for (v = 0; v < graph->vertexCount && v < config->lsasCap; v++)
+		header.linkCount += config->lsas[v].count;
+	header.poolCount = config->poolNearestCount;
+
+	/* write next to path and rename, so that path is never half written */
+	if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+		log(DEFAULT_LOG, "failed to malloc topology path.\n");
+		return EXIT_FAILURE;
+	}
+	sprintf(tmp, "%s.tmp", path);
+
+	if (!(file = fopen(tmp, "w"))) {
+		perror("fopen");
+		log(DEFAULT_LOG, "fopen compiled topology failed.\n");
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	ret = writeSection(file, &header, sizeof(header)) ||
+		writeTopology(file, config, &header);
+	if (fclose(file) || ret) {
+		log(DEFAULT_LOG, "failed to write compiled topology.\n");
+		unlink(tmp);
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	if (rename(tmp, path)) {
+		perror("rename");
+		unlink(tmp);
+		free(tmp);
+		return EXIT_FAILURE;
+	}
+
+	log(DEFAULT_LOG, "compiled %zu vertices and %zu edges into %s\n",
+	    graph->vertexCount, graph->edgeCount, path);
+	free(tmp);
+	return EXIT_SUCCESS;
+}
+
+int dns_LoadTopology(struct dns_config_t *config, const char *path)
+{
+	struct topology_header_t header;
+	struct sections_t sections;
+	struct image_t image;
+	struct stat st;
+	void *map;
+	int fd, ret;
+
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		perror("open");
+		log(DEFAULT_LOG, "open compiled topology failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &st) || (size_t) st.st_size < sizeof(header)) {
+		log(DEFAULT_LOG, "compiled topology is truncated.\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+
+	image.data = map;
+	image.size = st.st_size;
+	image.at = 0;
+	memcpy(&header, takeSection(&image, 1, sizeof(header)),
+	       sizeof(header));
+
+	ret = checkTopology(config, &header, &image, &sections) ||
+		copyTopology(config, &header, &sections) ||
+		copyPools(config, &header, &sections);
+	munmap(map, st.st_size);
+
+	if (ret) {
+		log(DEFAULT_LOG, "failed to load compiled topology %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	linkServers(config);
+	log(DEFAULT_LOG, "loaded %zu vertices and %zu edges from %s\n",
+	    config->graph.vertexCount, config->graph.edgeCount, path);
+	return EXIT_SUCCESS;
+}
+
+static int writeSection(FILE *file, const void *data, size_t len)
+{
+	if (len && fwrite(data, 1, len, file) != len)
+		return EXIT_FAILURE;
+
+	return writePadding(file, len);
+}
+
+static int writePadding(FILE *file, size_t len)
+{
+	static const uint8_t zeros[SECTION_ALIGN];
+	size_t pad = (SECTION_ALIGN - len % SECTION_ALIGN) % SECTION_ALIGN;
+
+	if (pad && fwrite(zeros, 1, pad, file) != pad)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
+
+static int writeTopology(FILE *file, const struct dns_config_t *config,
+			 const struct topology_header_t *header)
+{
+	const struct graph_t *graph = &(config->graph);
+	const struct nearest_t *nearest = &(config->nearest);
+	const struct lsa_t *lsa;
+	const char *ip;
+	size_t v, i;
+	int32_t seq;
+	uint32_t count;
+
+	if (writeSection(file, graph->names, graph->namesLen) ||
+	    writeSection(file, graph->nameOffsets,
+			 graph->vertexCount * sizeof(size_t)) ||
+	    writeSection(file, graph->ids.entries,
+			 graph->ids.capacity * sizeof(struct ht_entry_t)) ||
+	    writeSection(file, graph->ids.keys, graph->ids.keysLen) ||
+	    writeSection(file, graph->offsets,
+			 (graph->rows + 1) * sizeof(uint32_t)) ||
+	    writeSection(file, graph->targets,
+			 graph->edgeCount * sizeof(uint32_t)) ||
+	    writeSection(file, graph->weights,
+			 graph->edgeCount * sizeof(uint32_t)))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < config->serversCount; i++) {
+		ip = config->servers[i].ip;
+		if (fwrite(ip, 1, strlen(ip) + 1, file) != strlen(ip) + 1)
+			return EXIT_FAILURE;
+	}
+	if (writePadding(file, header->serverNamesLen))
+		return EXIT_FAILURE;
+
+	if (writeSection(file, nearest->servers,
+			 nearest->vertices * K * sizeof(uint32_t)) ||
+	    writeSection(file, nearest->dists,
+			 nearest->vertices * K * sizeof(uint32_t)) ||
+	    writeSection(file, nearest->counts, nearest->vertices))
+		return EXIT_FAILURE;
+
+	for (v = 0; v < graph->vertexCount; v++) {
+		seq = v < config->lsasCap ? config->lsas[v].seqNum : 0;
+		if (fwrite(&seq, sizeof(seq), 1, file) != 1)
+			return EXIT_FAILURE;
+	}
+	if (writePadding(file, graph->vertexCount * sizeof(seq)))
+		return EXIT_FAILURE;
+
+	for (v = 0; v < graph->vertexCount; v++) {
+		lsa = v < config->lsasCap ? &(config->lsas[v]) : NULL;
+		count = lsa && lsa->present ? lsa->count : NO_LSA;
+		if (fwrite(&count, sizeof(count), 1, file) != 1)
+			return EXIT_FAILURE;
+	}
+	if (writePadding(file, graph->vertexCount * sizeof(count)))
+		return EXIT_FAILURE;
+
+	for (v = 0; v < graph->vertexCount && v < config->lsasCap; v++) {
+		lsa = &(config->lsas[v]);
+		if (lsa->count && fwrite(lsa->links, sizeof(*(lsa->links)),
+					 lsa->count, file) != lsa->count)
+			return EXIT_FAILURE;
+	}
+
+	if (writePadding(file, header->linkCount * sizeof(struct lsa_link_t)))
+		return EXIT_FAILURE;
+
+	return writePools(file, config);
+}
+
+static int writePools(FILE *file, const struct dns_config_t *config)
+{
+	const struct nearest_t *tables = config->poolNearest;
+	size_t count = config->poolNearestCount;
+	size_t vertices = config->graph.vertexCount;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (fwrite(config->poolMembers[i], 1, config->serversCount,
+			   file) != config->serversCount)
+			return EXIT_FAILURE;
+	if (writePadding(file, count * config->serversCount))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < count; i++)
+		if (fwrite(tables[i].servers, sizeof(uint32_t), vertices * K,
+			   file) != vertices * K)
+			return EXIT_FAILURE;
+	if (writePadding(file, count * vertices * K * sizeof(uint32_t)))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < count; i++)
+		if (fwrite(tables[i].dists, sizeof(uint32_t), vertices * K,
+			   file) != vertices * K)
+			return EXIT_FAILURE;
+	if (writePadding(file, count * vertices * K * sizeof(uint32_t)))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < count; i++)
+		if (fwrite(tables[i].counts, 1, vertices, file) != vertices)
+			return EXIT_FAILURE;
+
+	return writePadding(file, count * vertices);
+}
+
+static const void *takeSection(struct image_t *image, uint64_t count,
+			       size_t size)
+{
+	const void *section;
+	size_t len;
+
+	if (count > (image->size - image->at) / size)
+		return NULL;
+
+	len = count * size;
+	section = image->data + image->at;
+
+	/* the last section may come without its padding */
+	image->at += len + (SECTION_ALIGN - len % SECTION_ALIGN) %
+		SECTION_ALIGN;
+	if (image->at > image->size)
+		image->at = image->size;
+
+	return section;
+}
+
+static int checkTopology(const struct dns_config_t *config,
+			 const struct topology_header_t *header,
+			 struct image_t *image, struct sections_t *sections)
+{
+	const struct ht_entry_t *entry;
+	const char *ip, *end;
+	uint64_t v, i, links;
+
+	if (memcmp(header->magic, TOPOLOGY_MAGIC, sizeof(header->magic)) ||
+	    header->version != TOPOLOGY_VERSION ||
+	    header->byteOrder != BYTE_ORDER_MARK ||
+	    header->wordSize != sizeof(size_t) ||
+	    header->entrySize != sizeof(struct ht_entry_t) ||
+	    header->answers != K) {
+		log(DEFAULT_LOG, "topology compiled for another machine.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (header->serversCount != config->serversCount) {
+		log(DEFAULT_LOG, "topology compiled for other servers.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!header->vertexCount || header->vertexCount >= UINT32_MAX ||
+	    header->rows > header->vertexCount ||
+	    header->edgeCount >= UINT32_MAX ||
+	    header->idsCount != header->vertexCount ||
+	    header->idsCapacity <= header->idsCount ||
+	    (header->idsCapacity & (header->idsCapacity - 1)) ||
+	    header->poolCount > image->size / header->vertexCount)
+		goto corrupt;
+
+	sections->names = takeSection(image, header->namesLen, 1);
+	sections->nameOffsets = takeSection(image, header->vertexCount,
+					    sizeof(size_t));
+	sections->entries = takeSection(image, header->idsCapacity,
+					sizeof(struct ht_entry_t));
+	sections->keys = takeSection(image, header->idsKeysLen, 1);
+	sections->offsets = takeSection(image, header->rows + 1,
+					sizeof(uint32_t));
+	sections->targets = takeSection(image, header->edgeCount,
+					sizeof(uint32_t));
+	sections->weights = takeSection(image, header->edgeCount,
+					sizeof(uint32_t));
+	sections->serverNames = takeSection(image, header->serverNamesLen, 1);
+	sections->servers = takeSection(image, header->vertexCount * K,
+					sizeof(uint32_t));
+	sections->dists = takeSection(image, header->vertexCount * K,
+				      sizeof(uint32_t));
+	sections->counts = takeSection(image, header->vertexCount, 1);
+	sections->seqs = takeSection(image, header->vertexCount,
+				     sizeof(int32_t));
+	sections->linkCounts = takeSection(image, header->vertexCount,
+					   sizeof(uint32_t));
+	sections->links = takeSection(image, header->linkCount,
+				      sizeof(struct lsa_link_t));
+	sections->poolMembers = takeSection(image, header->poolCount *
+					    header->serversCount, 1);
+	sections->poolServers = takeSection(image, header->poolCount *
+					    header->vertexCount * K,
+					    sizeof(uint32_t));
+	sections->poolDists = takeSection(image, header->poolCount *
+					  header->vertexCount * K,
+					  sizeof(uint32_t));
+	sections->poolCounts = takeSection(image, header->poolCount *
+					   header->vertexCount, 1);
+	if (!sections->names || !sections->nameOffsets ||
+	    !sections->entries || !sections->keys || !sections->offsets ||
+	    !sections->targets || !sections->weights ||
+	    !sections->serverNames || !sections->servers ||
+	    !sections->dists || !sections->counts || !sections->seqs ||
+	    !sections->linkCounts || !sections->links ||
+	    !sections->poolMembers || !sections->poolServers ||
+	    !sections->poolDists || !sections->poolCounts)
+		goto corrupt;
+
+	/* the servers have to be the ones the nearest-server table ranks */
+	ip = sections->serverNames;
+	end = ip + header->serverNamesLen;
+	for (i = 0; i < config->serversCount; i++) {
+		if (!memchr(ip, '\0', end - ip) ||
+		    strcmp(ip, config->servers[i].ip)) {
+			log(DEFAULT_LOG, "topology compiled for other "
+			    "servers.\n");
+			return EXIT_FAILURE;
+		}
+		ip += strlen(ip) + 1;
+	}
+
+	/* and every index has to stay in bounds, the image is not trusted */
+	if (!header->namesLen || sections->names[header->namesLen - 1])
+		goto corrupt;
+
+	for (v = 0; v < header->vertexCount; v++)
+		if (sections->nameOffsets[v] >= header->namesLen)
+			goto corrupt;
+
+	for (i = 0; i < header->idsCapacity; i++) {
+		entry = &(sections->entries[i]);
+		if (entry->keyLen &&
+		    (entry->keyOff > header->idsKeysLen ||
+		     entry->keyLen > header->idsKeysLen - entry->keyOff ||
+		     (uintptr_t) entry->value >= header->vertexCount))
+			goto corrupt;
+	}
+
+	if (sections->offsets[0] ||
+	    sections->offsets[header->rows] != header->edgeCount)
+		goto corrupt;
+
+	/* rows are merged as sorted lists of distinct neighbors */
+	for (v = 0; v < header->rows; v++) {
+		if (sections->offsets[v] > sections->offsets[v + 1])
+			goto corrupt;
+
+		for (i = sections->offsets[v] + 1;
+		     i < sections->offsets[v + 1]; i++)
+			if (sections->targets[i - 1] >= sections->targets[i])
+				goto corrupt;
+	}
+
+	/* and links cost what parseNeighbor accepts */
+	for (i = 0; i < header->edgeCount; i++)
+		if (sections->targets[i] >= header->vertexCount ||
+		    !sections->weights[i] ||
+		    sections->weights[i] > MAX_LINK_COST)
+			goto corrupt;
+
+	for (v = 0; v < header->vertexCount; v++) {
+		if (sections->counts[v] > K)
+			goto corrupt;
+
+		for (i = 0; i < sections->counts[v]; i++)
+			if (sections->servers[v * K + i] >=
+			    header->serversCount)
+				goto corrupt;
+	}
+
+	for (v = 0, links = 0; v < header->vertexCount; v++)
+		if (sections->linkCounts[v] != NO_LSA)
+			links += sections->linkCounts[v];
+
+	if (links != header->linkCount)
+		goto corrupt;
+
+	for (i = 0; i < header->linkCount; i++)
+		if (sections->links[i].vertex >= header->vertexCount ||
+		    !sections->links[i].cost ||
+		    sections->links[i].cost > MAX_LINK_COST)
+			goto corrupt;
+
+	/* and the links of an LSA are searched, sorted and distinct as
+	   dns_StoreTokens keeps them */
+	for (v = 0, links = 0; v < header->vertexCount; v++) {
+		if (sections->linkCounts[v] == NO_LSA)
+			continue;
+
+		for (i = links + 1; i < links + sections->linkCounts[v]; i++)
+			if (sections->links[i - 1].vertex >=
+			    sections->links[i].vertex)
+				goto corrupt;
+		links += sections->linkCounts[v];
+	}
+
+	if (checkPools(header, sections))
+		goto corrupt;
+
+	return EXIT_SUCCESS;
+
+corrupt:
+	log(DEFAULT_LOG, "compiled topology is corrupt.\n");
+	return EXIT_FAILURE;
+}
+
+static int copyTopology(struct dns_config_t *config,
+			const struct topology_header_t *header,
+			const struct sections_t *sections)
+{
+	struct graph_t *graph = &(config->graph);
+	struct nearest_t *nearest = &(config->nearest);
+	const struct lsa_link_t *links;
+	struct lsa_t *lsa;
+	size_t vertices = header->vertexCount;
+	size_t edges = header->edgeCount;
+	size_t v, count;
+
+	memset(graph, 0, sizeof(*graph));
+	graph->ids.entries = malloc(header->idsCapacity *
+				    sizeof(struct ht_entry_t));
+	graph->ids.keys = malloc(header->idsKeysLen + 1);
+	graph->names = malloc(header->namesLen);
+	graph->nameOffsets = malloc(vertices * sizeof(size_t));
+	graph->offsets = malloc((header->rows + 1) * sizeof(uint32_t));
+	graph->targets = malloc((edges + 1) * sizeof(uint32_t));
+	graph->weights = malloc((edges + 1) * sizeof(uint32_t));
+	nearest->servers = malloc(vertices * K * sizeof(uint32_t));
+	nearest->dists = malloc(vertices * K * sizeof(uint32_t));
+	nearest->counts = malloc(vertices);
+	config->lsas = calloc(vertices, sizeof(*(config->lsas)));
+	if (!graph->ids.entries || !graph->ids.keys || !graph->names ||
+	    !graph->nameOffsets || !graph->offsets || !graph->targets ||
+	    !graph->weights || !nearest->servers || !nearest->dists ||
+	    !nearest->counts || !config->lsas)
+		goto fail;
+
+	memcpy(graph->ids.entries, sections->entries,
+	       header->idsCapacity * sizeof(struct ht_entry_t));
+	memcpy(graph->ids.keys, sections->keys, header->idsKeysLen);
+	graph->ids.capacity = header->idsCapacity;
+	graph->ids.count = header->idsCount;
+	graph->ids.keysLen = graph->ids.keysCap = header->idsKeysLen;
+
+	memcpy(graph->names, sections->names, header->namesLen);
+	memcpy(graph->nameOffsets, sections->nameOffsets,
+	       vertices * sizeof(size_t));
+	memcpy(graph->offsets, sections->offsets,
+	       (header->rows + 1) * sizeof(uint32_t));
+	memcpy(graph->targets, sections->targets, edges * sizeof(uint32_t));
+	memcpy(graph->weights, sections->weights, edges * sizeof(uint32_t));
+	graph->vertexCount = graph->vertexCap = vertices;
+	graph->namesLen = graph->namesCap = header->namesLen;
+	graph->edgeCount = edges;
+	graph->rows = header->rows;
+
+	memcpy(nearest->servers, sections->servers,
+	       vertices * K * sizeof(uint32_t));
+	memcpy(nearest->dists, sections->dists,
+	       vertices * K * sizeof(uint32_t));
+	memcpy(nearest->counts, sections->counts, vertices);
+	nearest->vertices = vertices;
+
+	config->lsasCap = vertices;
+	links = sections->links;
+	for (v = 0; v < vertices; v++) {
+		if ((count = sections->linkCounts[v]) == NO_LSA)
+			continue;
+
+		lsa = &(config->lsas[v]);
+		lsa->present = 1;
+		lsa->seqNum = sections->seqs[v];
+		lsa->count = count;
+		if (count && !(lsa->links = malloc(count * sizeof(*links))))
+			goto fail;
+
+		if (count)
+			memcpy(lsa->links, links, count * sizeof(*links));
+		links += count;
+	}
+
+	return EXIT_SUCCESS;
+
+fail:
+	log(DEFAULT_LOG, "failed to malloc topology.\n");
+	freeLSAs(config);
+	freeNearest(config);
+	freeGraph(graph);
+	return EXIT_FAILURE;
+}
+
+static int checkPools(const struct topology_header_t *header,
+		      const struct sections_t *sections)
+{
+	const uint8_t *members;
+	uint64_t pool, v, i, at, server;
+
+	for (i = 0; i < header->poolCount * header->serversCount; i++)
+		if (sections->poolMembers[i] > 1)
+			return EXIT_FAILURE;
+
+	for (pool = 0; pool < header->poolCount; pool++) {
+		members = sections->poolMembers + pool * header->serversCount;
+		for (v = 0; v < header->vertexCount; v++) {
+			at = pool * header->vertexCount + v;
+			if (sections->poolCounts[at] > K)
+				return EXIT_FAILURE;
+
+			for (i = 0; i < sections->poolCounts[at]; i++) {
+				server = sections->poolServers[at * K + i];
+				if (server >= header->serversCount ||
+				    !members[server])
+					return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int copyPools(struct dns_config_t *config,
+		     const struct topology_header_t *header,
+		     const struct sections_t *sections)
+{
+	struct nearest_t *table;
+	size_t vertices = header->vertexCount;
+	size_t servers = header->serversCount;
+	size_t pool;
+
+	if (!header->poolCount)
+		return EXIT_SUCCESS;
+
+	config->poolNearest = calloc(header->poolCount,
+				     sizeof(*(config->poolNearest)));
+	config->poolMembers = malloc(header->poolCount *
+				     sizeof(*(config->poolMembers)));
+	config->compiledMembers = malloc(header->poolCount * servers);
+	if (!config->poolNearest || !config->poolMembers ||
+	    !config->compiledMembers)
+		goto fail;
+
+	memcpy(config->compiledMembers, sections->poolMembers,
+	       header->poolCount * servers);
+	for (pool = 0; pool < header->poolCount; pool++) {
+		config->poolMembers[pool] = config->compiledMembers +
+			pool * servers;
+		config->poolNearestCount++;
+
+		table = &(config->poolNearest[pool]);
+		table->servers = malloc(vertices * K * sizeof(uint32_t));
+		table->dists = malloc(vertices * K * sizeof(uint32_t));
+		table->counts = malloc(vertices);
+		if (!table->servers || !table->dists || !table->counts)
+			goto fail;
+
+		memcpy(table->servers, sections->poolServers +
+		       pool * vertices * K, vertices * K * sizeof(uint32_t));
+		memcpy(table->dists, sections->poolDists +
+		       pool * vertices * K, vertices * K * sizeof(uint32_t));
+		memcpy(table->counts, sections->poolCounts + pool * vertices,
+		       vertices);
+		table->vertices = vertices;
+	}
+
+	return EXIT_SUCCESS;
+
+fail:
+	log(DEFAULT_LOG, "failed to malloc pool tables.\n");
+	freeLSAs(config);
+	freeNearest(config);
+	freeGraph(&(config->graph));
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,43 @@
+#pragma once
+/*
+  Compiled topology files.
+
+  Parsing a large LSA file and computing the nearest-server table from it
+  takes long, so the nameserver can compile them once with -o into a binary
+  image of its state: the interned vertex ids, the CSR adjacency, the LSAs,
+  the servers, the nearest-server table and the tables of the pools of the
+  zones.  A compiled topology can be given in place of the LSA file, it is
+  mapped and copied in without any parsing.  Only the pools of the zones file
+  it is loaded with that are not in the image get their tables computed.
+
+  The image is only meant for the machine that compiled it, it is rejected on
+  a different byte order or word size, and for a different servers file.
+*/
+
+#include "nameserver.h"
+
+/**
+   Tell whether the file at path is a compiled topology rather than an LSA
+   file.
+
+   @return 1 if it is, 0 otherwise
+*/
+int isCompiledTopology(const char *path);
+
+/**
+   Write config's graph, LSAs, servers, nearest-server table and pool tables
+   to a compiled topology at path.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_CompileTopology(const struct dns_config_t *config, const char *path);
+
+/**
+   Load config's graph, LSAs, nearest-server table and pool tables from the
+   compiled topology at path, and link config's servers to the graph.  The
+   servers must be the ones the topology was compiled with, in the same
+   order.  The pool tables wait in config for dns_BuildPoolNearest.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_LoadTopology(struct dns_config_t *config, const char *path);
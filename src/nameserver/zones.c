@@ -0,0 +1,425 @@
+/*
+  Functions to map query names to the zones that answer them
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "zones.h"
+#include "servers.h"
+#include "../common/mydnsparse.h"
+#include "../common/log.h"
+
+#define DEFAULT_ZONES 8
+#define MAX_ROTATION 65536 /* picks in a cycle of the weighted rotation */
+
+/* The load balancing policies of the zones file */
+static const struct {
+	const char *name;
+	enum load_balance_t lbType;
+} policies[] = {
+	{ "rr", RR },
+	{ "geo", GEO },
+	{ "load", LOAD },
+	{ "hash", HASH },
+	{ "wrr", WRR },
+};
+
+/**
+   Add the zone of the dotted name with lbType to config, or find it if it
+   is there already.
+
+   @return the zone, NULL on failure
+*/
+static struct zone_t *addZone(struct dns_config_t *config, const char *name,
+			      enum load_balance_t lbType);
+
+/**
+   Parse the comma separated ips of a zones file line into the pool of zone,
+   registering the servers that are not yet.
+
+   @return 0 on success, 1 otherwise
+*/
+static int parsePool(struct dns_config_t *config, struct zone_t *zone,
+		     char *ips);
+
+/**
+   Give zone a pool of the first count servers of config, unless it has one,
+   drop the servers it has twice and mark the ones it has.
+
+   @return 0 on success, 1 otherwise
+*/
+static int finishPool(const struct dns_config_t *config, struct zone_t *zone,
+		      size_t count);
+
+/**
+   Build the rotation of zone, the order smooth weighted round-robin picks
+   the positions of its pool in over a whole cycle, so that a pick is a
+   lookup of the next index into it.
+
+   @return 0 on success, 1 otherwise
+*/
+static int buildRotation(const struct dns_config_t *config,
+			 struct zone_t *zone);
+
+/**
+   Write the dotted name in the labels format into labels, of size
+   MAX_DOMAIN_NAME_LEN.
+
+   @return the length of the labels, 0 if name is malformed
+*/
+static size_t toLabels(const char *name, uint8_t *labels);
+
+/**
+   Return the greatest common divisor of a and b.
+*/
+static uint32_t gcd(uint32_t a, uint32_t b);
+
+int dns_ParseZones(struct dns_config_t *config)
+{
+	FILE *file = NULL;
+	char *line = NULL, *name, *policy, *ips, *save;
+	size_t lineSize, base, i;
+	struct zone_t *zone;
+
+	/* a pool of all servers is the ones of the servers file */
+	base = config->serversCount;
+
+	if (config->zonesFile && !(file = fopen(config->zonesFile, "r"))) {
+		perror("fopen");
+		log(DEFAULT_LOG, "fopen zones file failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	while (file && getline(&line, &lineSize, file) != -1) {
+		if (!(name = strtok_r(line, " \t\r\n", &save)))
+			continue;
+
+		policy = strtok_r(NULL, " \t\r\n", &save);
+		ips = strtok_r(NULL, " \t\r\n", &save);
+		for (i = 0; policy && i < sizeof(policies) / sizeof(*policies);
+		     i++)
+			if (!strcmp(policy, policies[i].name))
+				break;
+
+		if (!policy || i == sizeof(policies) / sizeof(*policies) ||
+		    !(zone = addZone(config, name, policies[i].lbType)) ||
+		    (ips && parsePool(config, zone, ips))) {
+			log(DEFAULT_LOG, "improper zone line.\n");
+			goto fail;
+		}
+	}
+
+	/* the file may answer for VID_DOMAIN itself */
+	if (!findZone(config, NULL) &&
+	    !addZone(config, VID_DOMAIN, config->lbType))
+		goto fail;
+
+	for (i = 0; i < config->zonesCount; i++) {
+		zone = &(config->zones[i]);
+		if (finishPool(config, zone, base) ||
+		    (zone->lbType == WRR && buildRotation(config, zone)))
+			goto fail;
+
+		log(DEFAULT_LOG, "zone %s of %zu servers\n", zone->name,
+		    zone->poolCount);
+	}
+
+	free(line);
+	if (file)
+		fclose(file);
+	return EXIT_SUCCESS;
+
+fail:
+	free(line);
+	if (file)
+		fclose(file);
+	freeZones(config);
+	return EXIT_FAILURE;
+}
+
+struct zone_t *findZone(const struct dns_config_t *config,
+			const struct dns_t *request)
+{
+	static const uint8_t vid[] = VID_DOMAIN_LABELS;
+	void **slot;
+
+	/* no request stands for VID_DOMAIN */
+	if (!request)
+		slot = ht_find(&(config->zoneIndex), vid, sizeof(vid));
+	else if (request->query_name)
+		slot = ht_find(&(config->zoneIndex), request->query_name,
+			       request->query_name_len);
+	else
+		slot = NULL;
+
+	return slot ? &(config->zones[(uintptr_t) *slot]) : NULL;
+}
+
+int zonesUseGraph(const struct dns_config_t *config)
+{
+	size_t i;
+
+	for (i = 0; i < config->zonesCount; i++)
+		if (usesGraph(config->zones[i].lbType))
+			return 1;
+
+	return 0;
+}
+
+void freeZones(struct dns_config_t *config)
+{
+	size_t i;
+
+	for (i = 0; i < config->zonesCount; i++) {
+		free(config->zones[i].name);
+		free(config->zones[i].pool);
+		free(config->zones[i].members);
+		free(config->zones[i].rotation);
+	}
+
+	free(config->zones);
+	ht_free(&(config->zoneIndex));
+	config->zones = NULL;
+	config->zonesCount = config->zonesCap = 0;
+}
+
+static struct zone_t *addZone(struct dns_config_t *config, const char *name,
+			      enum load_balance_t lbType)
+{
+	uint8_t labels[MAX_DOMAIN_NAME_LEN];
+	struct zone_t *zones, *zone;
+	size_t len, cap;
+	void **slot;
+	int created;
+
+	if (!(len = toLabels(name, labels))) {
+		log(DEFAULT_LOG, "invalid zone name %s\n", name);
+		return NULL;
+	}
+
+	if (!config->zoneIndex.entries &&
+	    ht_init(&(config->zoneIndex), DEFAULT_ZONES)) {
+		log(DEFAULT_LOG, "failed to init zone index.\n");
+		return NULL;
+	}
+
+	if (!(slot = ht_insert(&(config->zoneIndex), labels, len, &created))) {
+		log(DEFAULT_LOG, "failed to index zone.\n");
+		return NULL;
+	}
+
+	/* a later line for the zone replaces it */
+	if (!created) {
+		zone = &(config->zones[(uintptr_t) *slot]);
+		zone->lbType = lbType;
+		free(zone->pool);
+		zone->pool = NULL;
+		zone->poolCount = zone->poolCap = 0;
+		return zone;
+	}
+
+	if (config->zonesCount == config->zonesCap) {
+		cap = config->zonesCap ? config->zonesCap * 2 : DEFAULT_ZONES;
+		if (!(zones = realloc(config->zones, cap * sizeof(*zones)))) {
+			log(DEFAULT_LOG, "failed to grow zones.\n");
+			return NULL;
+		}
+
+		config->zones = zones;
+		config->zonesCap = cap;
+	}
+
+	zone = &(config->zones[config->zonesCount]);
+	memset(zone, 0, sizeof(*zone));
+	zone->lbType = lbType;
+	atomic_init(&(zone->next), 0);
+
+	/* the dotted name without a trailing dot, for the activity log */
+	if (!(zone->name = strndup(name, strlen(name) -
+				   (name[strlen(name) - 1] == '.')))) {
+		perror("strndup");
+		return NULL;
+	}
+
+	*slot = (void *) (uintptr_t) config->zonesCount;
+	config->zonesCount++;
+	return zone;
+}
+
+static int parsePool(struct dns_config_t *config, struct zone_t *zone,
+		     char *ips)
+{
+	char *ip, *save;
+	uint32_t *pool;
+	size_t cap;
+	long server;
+
+	for (ip = strtok_r(ips, ",", &save); ip;
+	     ip = strtok_r(NULL, ",", &save)) {
+		if ((server = registerServer(config, ip, strlen(ip))) == -1)
+			return EXIT_FAILURE;
+
+		if (zone->poolCount == zone->poolCap) {
+			cap = zone->poolCap ? zone->poolCap * 2 : DEFAULT_ZONES;
+			if (!(pool = realloc(zone->pool, cap * sizeof(*pool)))) {
+				log(DEFAULT_LOG, "failed to grow zone pool.\n");
+				return EXIT_FAILURE;
+			}
+
+			zone->pool = pool;
+			zone->poolCap = cap;
+		}
+
+		zone->pool[zone->poolCount++] = server;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int finishPool(const struct dns_config_t *config, struct zone_t *zone,
+		      size_t count)
+{
+	size_t i, kept;
+
+	if (!zone->pool) {
+		if (!(zone->pool = calloc(count + 1, sizeof(*(zone->pool))))) {
+			log(DEFAULT_LOG, "failed to calloc zone pool.\n");
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < count; i++)
+			zone->pool[i] = i;
+		zone->poolCount = zone->poolCap = count;
+	}
+
+	if (!(zone->members = calloc(config->serversCount + 1,
+				     sizeof(*(zone->members))))) {
+		log(DEFAULT_LOG, "failed to calloc zone members.\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0, kept = 0; i < zone->poolCount; i++) {
+		if (zone->members[zone->pool[i]])
+			continue;
+
+		zone->members[zone->pool[i]] = 1;
+		zone->pool[kept++] = zone->pool[i];
+	}
+	zone->poolCount = kept;
+
+	/* a pool of every server needs no filtering */
+	if (zone->poolCount == config->serversCount) {
+		free(zone->members);
+		zone->members = NULL;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int buildRotation(const struct dns_config_t *config,
+			 struct zone_t *zone)
+{
+	uint32_t *weights, weight, divisor;
+	int64_t *current, total;
+	uint64_t sum;
+	size_t i, pick, count;
+
+	count = zone->poolCount;
+	if (!count)
+		return EXIT_SUCCESS;
+
+	for (i = 0, divisor = 0, sum = 0; i < count; i++) {
+		weight = config->servers[zone->pool[i]].weight;
+		divisor = gcd(divisor, weight);
+		sum += weight;
+	}
+
+	weights = calloc(count, sizeof(*weights));
+	current = calloc(count, sizeof(*current));
+	if (!weights || !current) {
+		log(DEFAULT_LOG, "failed to calloc weights.\n");
+		free(weights);
+		free(current);
+		return EXIT_FAILURE;
+	}
+
+	/* a cycle is as short as the ratios of the weights allow, and scaled
+	   down to MAX_ROTATION picks if it is still too long */
+	for (i = 0, total = 0; i < count; i++) {
+		weight = config->servers[zone->pool[i]].weight;
+		weights[i] = weight / divisor;
+		if (sum / divisor > MAX_ROTATION)
+			weights[i] = (uint64_t) weight * MAX_ROTATION / sum;
+		if (!weights[i])
+			weights[i] = 1;
+		total += weights[i];
+	}
+
+	free(zone->rotation);
+	if (!(zone->rotation = calloc(total, sizeof(*(zone->rotation))))) {
+		log(DEFAULT_LOG, "failed to calloc rotation.\n");
+		free(weights);
+		free(current);
+		return EXIT_FAILURE;
+	}
+
+	/* every server gains its weight and the heaviest one is picked and
+	   loses the total, the first one in the pool among equals */
+	for (zone->rotationCount = 0; zone->rotationCount < (size_t) total;
+	     zone->rotationCount++) {
+		for (i = 0, pick = 0; i < count; i++) {
+			current[i] += weights[i];
+			if (current[i] > current[pick])
+				pick = i;
+		}
+
+		current[pick] -= total;
+		zone->rotation[zone->rotationCount] = pick;
+	}
+
+	log(DEFAULT_LOG, "weighted rotation of %zu picks\n",
+	    zone->rotationCount);
+
+	free(weights);
+	free(current);
+	return EXIT_SUCCESS;
+}
+
+static size_t toLabels(const char *name, uint8_t *labels)
+{
+	size_t len, label;
+
+	for (len = 0; *name; name += label + (name[label] == '.')) {
+		label = strcspn(name, ".");
+
+		/* the name fits with its terminating zero label */
+		if (!label || label > MAX_LABEL_LEN ||
+		    len + 1 + label + 1 > MAX_DOMAIN_NAME_LEN)
+			return 0;
+
+		labels[len++] = label;
+		memcpy(labels + len, name, label);
+		len += label;
+	}
+
+	if (!len)
+		return 0;
+
+	labels[len++] = 0;
+	return len;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	uint32_t t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
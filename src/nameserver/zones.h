@@ -0,0 +1,46 @@
+#pragma once
+/*
+  Name table of the zones the nameserver answers for.
+
+  Every zone is a name with its own pool of servers and load balancing
+  policy.  The zones file given with -z has lines
+
+    <name> <rr | geo | load | hash | wrr> [<ip>[,<ip>...]]
+
+  a zone without ips pooling all the servers of the servers file, and ips
+  that are not in it being registered as servers too.  VID_DOMAIN is a zone
+  of all the servers with the policy of the command line, unless the zones
+  file has a line for it.
+
+  Names are kept in the wire labels format in a hash table, so finding the
+  zone of a query is a single lookup of its question name as it came in.
+*/
+
+#include "nameserver.h"
+
+/**
+   Parse config's zones file, if any, and set up the zones with the
+   rotations of their pools.  Every server has to be registered already, the
+   zones file only adds the ones of its pools.
+
+   @return 0 on success, 1 otherwise
+*/
+int dns_ParseZones(struct dns_config_t *config);
+
+/**
+   Find the zone request asks for.
+
+   @return the zone, NULL if the nameserver does not answer for the name
+*/
+struct zone_t *findZone(const struct dns_config_t *config,
+			const struct dns_t *request);
+
+/**
+   Tell whether any zone of config ranks its servers in the network graph.
+*/
+int zonesUseGraph(const struct dns_config_t *config);
+
+/**
+   Free the zones of config.
+*/
+void freeZones(struct dns_config_t *config);
@@ -1,15 +1,61 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <errno.h>
 
 #include "proxy.h"
 #include "config.h"
+#include "stats.h"
 #include "../common/log.h"
 
 #define BACKLOG 20
 #define APACHE_PORT "8080"
+#define OPT_STRING "f:b:xm:t:"
 
 int parseConfig(struct config_t *config, int argc, char **argv)
 {
+	int opt;
+
+	config->feedbackPort = NULL;
+	config->asyncLog = 0;
+	config->binaryLog = 0;
+	config->statsFile = NULL;
+	config->statsInterval = STATS_INTERVAL;
+	while ((opt = getopt(argc, argv, OPT_STRING)) != -1) {
+		switch (opt) {
+		case 'f':
+			config->feedbackPort = optarg;
+			break;
+		case 'b':
+			if (logParseRotate(optarg, &(config->logRotate))) {
+				log(DEFAULT_LOG, "parse log rotation failed.\n");
+				return EXIT_FAILURE;
+			}
+			config->asyncLog = 1;
+			break;
+		case 'x':
+			config->binaryLog = 1;
+			break;
+		case 'm':
+			config->statsFile = optarg;
+			break;
+		case 't':
+			errno = 0;
+			config->statsInterval = strtoul(optarg, NULL, 10);
+			if (errno || !config->statsInterval) {
+				log(DEFAULT_LOG,
+				    "parse stats interval failed.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		default: /* '?' */
+			break;
+		}
+	}
+
+	/* the positional arguments follow the options */
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	if (argc < 7) {
                 log(DEFAULT_LOG, "not enough arguments.\n");
                 return EXIT_FAILURE;
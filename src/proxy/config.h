@@ -3,26 +3,30 @@
   Header for handling the configuration for the proxy
 */
 
-/* log format string (all on one line):
-
-   <time> current time in seconds since epoch
-   <duration> number of seconds it took to download from svr to proxy
-   <tput> throughput for current chunk in Kbps
-   <avg-tput> current EWMA throughput estimate in Kbps
-   <bitrate> bitrate proxy requested for this chunk in Kbps
-   <server-ip> the IP address of the server
-   <chunkname> the name of the file proxy requested from the server
-   (modified file name)
-*/
-#define LOG_FMT "%lu %f %d %d %d %s %s\n"
-
 #include <stdio.h>
 
+#include "../common/asynclog.h"
+#include "../common/actlog.h" /* LOG_FMT */
+
 #define VID_DOMAIN "video.cs.cmu.edu"
 
 struct config_t {
 	FILE *logFile;
 
+        /* the log is written from a background thread when asyncLog is
+           set, and rotated by logRotate */
+        int asyncLog;
+        struct log_rotate_t logRotate;
+
+        /* fragments are logged as binary records when binaryLog is set, see
+           actlog.h */
+        int binaryLog;
+
+        /* hot path stats are snapshot to statsFile every statsInterval
+           seconds, see stats.h, statsFile being NULL if none */
+        const char *statsFile;
+        unsigned long statsInterval;
+
         char *logFilename,
                 *hostname,
                 *proxyPortChar; /* String representation of the proxy port */
@@ -38,7 +42,8 @@ struct config_t {
                 *dnsIP,
                 *wwwIP,
                 *dnsPort,
-                *apachePort;
+                *apachePort,
+                *feedbackPort; /* throughput reports port, NULL if none */
 
         int maxFd, /* the largest file descriptor for the connections */
 		listener; /* listening file descriptor */
@@ -48,7 +53,16 @@ struct config_t {
   Parse the arguments into a global config struct.
 
   Command line arguments are:
-  /proxy <log> <alpha> <listen-port> <fake-ip> <dns-ip> <dns-port> [<www-ip>]
+  /proxy [-f <feedback-port>] [-b <rotate-mb>[,<rotate-seconds>]] [-x]
+         [-m <stats-log>] [-t <stats-seconds>]
+         <log> <alpha> <listen-port> <fake-ip> <dns-ip> <dns-port> [<www-ip>]
+
+  With -f, the throughput measured from every video server is reported to
+  the DNS server on its feedback port, see mydns.h.  With -b, the log is
+  written asynchronously, see asynclog.h.  With -x, it is a binary activity
+  log, see actlog.h.  With -m, latency histograms and counters of the hot path
+  are written to the stats log every -t seconds, STATS_INTERVAL by default,
+  see stats.h
 
   Returns EXIT_SUCESS if successful, EXIT_FAILURE otherwise
 */
@@ -7,13 +7,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "mydns.h"
 #include "../common/mydnsparse.h"
 #include "../common/log.h"
+#include "../common/mytime.h"
+
+#define FEEDBACK_BUF_SIZE 1024
 
 static struct dnsConfig dns_config;
 
+/* throughput of the video servers, and the socket they are reported on */
+static struct path_tput paths[FEEDBACK_SERVERS];
+static size_t paths_count;
+static mytime_t last_report;
+static int feedback_sock = -1;
+
 int init_mydns(const char *dns_ip, unsigned int dns_port)
 {
 	if (!dns_ip)
@@ -25,6 +35,144 @@ int init_mydns(const char *dns_ip, unsigned int dns_port)
 	return 0;
 }
 
+int init_feedback(unsigned int feedback_port)
+{
+	if (!dns_config.ip || !feedback_port)
+		return -1;
+
+	dns_config.feedback_port = feedback_port;
+	return 0;
+}
+
+/**
+ * Find the throughput entry of a video server, taking over one that was
+ * reported already when all of them are used.
+ *
+ * @param  server_ip  The IP address of the video server.
+ *
+ * @return the entry, NULL if every entry waits to be reported
+ */
+static struct path_tput *find_path(const char *server_ip)
+{
+	size_t i;
+
+	for (i = 0; i < paths_count; i++)
+		if (!strcmp(paths[i].ip, server_ip))
+			return &paths[i];
+
+	if (paths_count < FEEDBACK_SERVERS)
+		i = paths_count++;
+	else
+		for (i = 0; i < FEEDBACK_SERVERS && paths[i].fresh; i++)
+			;
+
+	if (i == FEEDBACK_SERVERS)
+		return NULL;
+
+	snprintf(paths[i].ip, sizeof(paths[i].ip), "%s", server_ip);
+	paths[i].tput = 0;
+	paths[i].fresh = 0;
+	return &paths[i];
+}
+
+/**
+ * Send the throughput of the servers measured since the last report to the
+ * feedback port of the dns server, from the fake-ip of the proxy.
+ *
+ * @param  proxy_config  The proxy config that stores fake-ip of the proxy.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+static int send_feedback(struct config_t *proxy_config)
+{
+	struct sockaddr_in addr;
+	char buf[FEEDBACK_BUF_SIZE];
+	size_t i, len;
+	int n;
+
+	if (feedback_sock == -1) {
+		if ((feedback_sock = socket(AF_INET, SOCK_DGRAM,
+					    IPPROTO_IP)) == -1) {
+			log(DEFAULT_LOG, "feedback could not create socket\n");
+			return -1;
+		}
+
+		bzero(&addr, sizeof(addr));
+		addr.sin_family = AF_INET;
+		inet_aton(proxy_config->fakeIP,
+			  (struct in_addr *) &addr.sin_addr.s_addr);
+		addr.sin_port = htons((uint16_t)0);
+
+		/* from the fake-ip, so the reports match the queries */
+		if (bind(feedback_sock, (struct sockaddr *) &addr,
+			 sizeof(addr)) == -1) {
+			log(DEFAULT_LOG, "feedback could not bind socket\n");
+			close(feedback_sock);
+			feedback_sock = -1;
+			return -1;
+		}
+	}
+
+	for (i = 0, len = 0; i < paths_count; i++) {
+		if (!paths[i].fresh)
+			continue;
+
+		n = snprintf(buf + len, sizeof(buf) - len, "%s %lu\n",
+			     paths[i].ip, (unsigned long) paths[i].tput);
+		if (n < 0 || (size_t) n >= sizeof(buf) - len)
+			break;
+
+		len += n;
+		paths[i].fresh = 0;
+	}
+
+	if (!len)
+		return 0;
+
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	inet_aton(dns_config.ip, (struct in_addr *) &addr.sin_addr.s_addr);
+	addr.sin_port = htons((uint16_t)dns_config.feedback_port);
+
+	if ((ssize_t) len != sendto(feedback_sock, buf, len, 0,
+				    (struct sockaddr *) &addr,
+				    sizeof(addr))) {
+		log(DEFAULT_LOG, "sending feedback failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+void report_throughput(struct config_t *proxy_config, const char *server_ip,
+		       int tput)
+{
+	struct path_tput *path;
+	mytime_t now;
+
+	if (!dns_config.feedback_port || tput <= 0)
+		return;
+
+	if (!(path = find_path(server_ip)))
+		return;
+
+	/* the same moving average as the bitrate, starting at the first
+	   measure */
+	if (path->tput > 0)
+		path->tput = proxy_config->alpha * tput +
+			(1 - proxy_config->alpha) * path->tput;
+	else
+		path->tput = tput;
+	path->fresh = 1;
+
+	now = microtime(NULL);
+	if (now - last_report < FEEDBACK_INTERVAL)
+		return;
+
+	last_report = now;
+	send_feedback(proxy_config);
+}
+
 /**
  * Send a serialized dns request to the dns server.
  *
@@ -35,11 +183,12 @@ int init_mydns(const char *dns_ip, unsigned int dns_port)
  */
 static int send_to_dns_server(int sock, struct dns_t *dns_request)
 {
-	uint8_t *dns;
+	uint8_t dns[DNS_REQUEST_LEN];
+	ssize_t dns_len;
 	struct sockaddr_in dns_addr;
 
-	dns = serialize_dns(dns_request);
-	if (dns == NULL) {
+	dns_len = serialize_dns(dns_request, dns, sizeof(dns));
+	if (dns_len == -1) {
 		log(DEFAULT_LOG, "serializing dns request failed\n");
 		return -1;
 	}
@@ -51,14 +200,13 @@ static int send_to_dns_server(int sock, struct dns_t *dns_request)
 		  (struct in_addr *) &dns_addr.sin_addr.s_addr);
 	dns_addr.sin_port = htons((uint16_t)dns_config.port);
 
-	if (dns_request->len != sendto(sock, dns, dns_request->len, 0,
-			               (struct sockaddr *) &(dns_addr),
-			               sizeof(dns_addr))) {
+	if (dns_len != sendto(sock, dns, dns_len, 0,
+			      (struct sockaddr *) &(dns_addr),
+			      sizeof(dns_addr))) {
 		log(DEFAULT_LOG, "sending dns request failed\n");
 		return -1;
 	}
 
-	free(dns);
 	return 0;
 }
 
@@ -66,45 +214,47 @@ static int send_to_dns_server(int sock, struct dns_t *dns_request)
  * Received a deserialized dns response from the dns server.
  *
  * @param  sock  The proxy listening udp socket.
+ * @param  dns_response  The struct to fill in with the dns response data.
  *
- * @return the struct pointer that stores the dns response data, NULL if
- * unsuccessful
+ * @return 0 on success, -1 otherwise
  */
-static struct dns_t *recv_from_dns_server(int sock)
+static int recv_from_dns_server(int sock, struct dns_t *dns_response)
 {
 	struct sockaddr_in from;
 	socklen_t fromlen;
-	char buf[DNS_BUF_SIZE];
-	struct dns_t *dns_response;
-	int response_len;
+	uint8_t buf[DNS_BUF_SIZE];
+	ssize_t response_len;
 
 	fromlen = sizeof(from);
 	if ((response_len = recvfrom(sock, buf, DNS_BUF_SIZE, 0,
 				     (struct sockaddr *) &from,
 				     &fromlen)) <= 0) {
 		log(DEFAULT_LOG, "receiving dns response failed\n");
-		return NULL;
+		return -1;
 	}
 
-	dns_response = deserialize_dns((uint8_t *)buf);
-	if (dns_response == NULL) {
+	/* only the answers are used, and they are copied out of buf */
+	if (deserialize_dns(dns_response, buf, response_len)) {
 		log(DEFAULT_LOG, "deserializing dns response failed\n");
-		return NULL;
+		return -1;
 	}
+	dns_response->query_name = NULL;
 
-	return dns_response;
+	return 0;
 }
 
 /**
- * Received a deserialized dns response from the dns server.
+ * Build a single addrinfo for one answer of a dns response.
  *
- * @param  dns_response  The response struct from dns server.
- * @param  res The addrinfo pointer to fill in connection setup data.
+ * @param  response_ip  The ip address of the answer.
+ * @param  node  The hostname that was resolved.
+ * @param  service  The port number as a string.
+ *
+ * @return the allocated addrinfo, NULL if unsuccessful
  */
-static void addrinfo_from_response(struct dns_t *dns_response,
-				   struct addrinfo **res,
-				   const char *node,
-				   const char *service)
+static struct addrinfo *addrinfo_from_ip(struct in_addr response_ip,
+					 const char *node,
+					 const char *service)
 {
 	struct addrinfo *tmp;
 	struct sockaddr_in *server_addr;
@@ -112,30 +262,25 @@ static void addrinfo_from_response(struct dns_t *dns_response,
 
 	tmp = calloc(1, sizeof(struct addrinfo));
 
-	if (!tmp) {
-		*res = NULL;
-		return;
-	}
+	if (!tmp)
+		return NULL;
 
 	server_addr = calloc(1, sizeof(struct sockaddr_in));
 	if (!server_addr) {
 		free(tmp);
-		*res = NULL;
-		return;
+		return NULL;
 	}
 
 	cannonname = strdup(node);
 	if (!cannonname) {
 		free(tmp);
 		free(server_addr);
-		*res = NULL;
-		return;
+		return NULL;
 	}
 
 	/* fill in sockaddr_in */
 	server_addr->sin_family = AF_INET;
-	inet_aton(dns_response->response_ip,
-		  (struct in_addr *) &((server_addr->sin_addr).s_addr));
+	server_addr->sin_addr = response_ip;
 	server_addr->sin_port = htons((uint16_t)atoi(service)); /* "8080" */
 
 	/* fill in addrinfo */
@@ -147,7 +292,48 @@ static void addrinfo_from_response(struct dns_t *dns_response,
 	tmp->ai_canonname = cannonname; /* "video.cs.cmu.edu" */
 	tmp->ai_next = NULL;
 
-	*res = tmp;
+	return tmp;
+}
+
+/**
+ * Received a deserialized dns response from the dns server.
+ *
+ * @param  dns_response  The response struct from dns server.
+ * @param  res The addrinfo pointer to fill in connection setup data. There is
+ * one addrinfo per answer, chained through ai_next in the ranked order.
+ */
+static void addrinfo_from_response(struct dns_t *dns_response,
+				   struct addrinfo **res,
+				   const char *node,
+				   const char *service)
+{
+	struct addrinfo **tail;
+	size_t i;
+
+	*res = NULL;
+	tail = res;
+	for (i = 0; i < dns_response->answer_count; i++) {
+		if (!(*tail = addrinfo_from_ip(dns_response->answers[i],
+					       node, service))) {
+			freeresolve(*res);
+			*res = NULL;
+			return;
+		}
+
+		tail = &((*tail)->ai_next);
+	}
+}
+
+void freeresolve(struct addrinfo *res)
+{
+	struct addrinfo *next;
+
+	for (; res; res = next) {
+		next = res->ai_next;
+		free(res->ai_addr);
+		free(res->ai_canonname);
+		free(res);
+	}
 }
 
 int resolve(struct config_t *proxy_config, const char *node,
@@ -159,8 +345,8 @@ int resolve(struct config_t *proxy_config, const char *node,
 	struct timeval tv; /* timeouts for select */
 	int sock;
 	int nfds;
-	struct dns_t *dns_request;
-	struct dns_t *dns_response;
+	struct dns_t dns_request;
+	struct dns_t dns_response;
 
 	/* gcc compilation unused variable */
 	hints = hints;
@@ -187,53 +373,49 @@ int resolve(struct config_t *proxy_config, const char *node,
 	/* the listening udp socket binds to the fake-ip and an ephemeral port */
 	if (bind(sock, (struct sockaddr *) &myaddr, sizeof(myaddr)) == -1) {
 		log(DEFAULT_LOG, "resolve could not bind socket\n");
+		close(sock);
 		return -1;
 	}
 
 	/* use select to avoid recvfrom blocks forever */
+	FD_ZERO(&readfds);
 	FD_SET(sock, &readfds);
 
 	/* select has timeout of 5 seconds */
 	tv.tv_sec = 5;
         tv.tv_usec = 0;
 
-	/* generate a query for dns server */
-	if ((dns_request = generate_dns_message(0, QUERY, NULL, 0)) == NULL) {
-		log(DEFAULT_LOG, "resolve could not generate request\n");
-		return -1;
-	}
-
-	/* send the query to dns server */
-	if (send_to_dns_server(sock, dns_request) == -1) {
+	/* generate a query for dns server, and send it */
+	generate_dns_message(&dns_request, 0, QUERY, NULL, 0, 0);
+	if (send_to_dns_server(sock, &dns_request) == -1) {
 		log(DEFAULT_LOG, "resolve could not sendto\n");
+		close(sock);
 		return -1;
 	}
-	free_dns_message(dns_request);
-	dns_request = NULL;
 
 	nfds = select(sock+1, &readfds, NULL, NULL, &tv);
 
 	if (nfds > 0) {
-		if ((dns_response = recv_from_dns_server(sock)) == NULL) {
+		if (recv_from_dns_server(sock, &dns_response) == -1) {
 			log(DEFAULT_LOG, "resolve could not recvfrom\n");
+			close(sock);
 			return -1;
 		}
+		close(sock);
 
-		if (dns_response->invalid_request) {
+		if (dns_response.invalid_request) {
 			log(DEFAULT_LOG, "dns server has no answer\n");
 			return -1;
 		}
 
-		/* put the response ip address into addrinfo */
-		addrinfo_from_response(dns_response, res, node, service);
+		/* put the response ip addresses into addrinfo */
+		addrinfo_from_response(&dns_response, res, node, service);
 
-		free_dns_message(dns_response);
-		dns_response = NULL;
-		return 0;
+		return (*res) ? 0 : -1;
 	} else if (nfds == 0) {
 		log(DEFAULT_LOG, "resolve select times out\n");
-		return -1;
 	}
 
+	close(sock);
 	return -1;
 }
@@ -3,6 +3,8 @@
 #include "../proxy/config.h"
 
 #define DOMAIN "video.cs.cmu.edu"
+#define FEEDBACK_INTERVAL 1000000 /* microseconds between throughput reports */
+#define FEEDBACK_SERVERS 16 /* video servers a report covers at most */
 
 /**
  * Initialize your client DNS library with the IP address and port number of
@@ -27,15 +29,16 @@ int init_mydns(const char *dns_ip, unsigned int dns_port);
  * if (rc != 0) {
  *     // handle error
  * }
- * // connect to address in result
- * free(result);
+ * // connect to an address in result
+ * freeresolve(result);
  *
  * @param  proxy_config  The proxy config that stores fake-ip of the proxy.
  * @param  node  The hostname to resolve.
  * @param  service  The desired port number as a string.
  * @param  hints  Should be null. resolve() ignores this parameter.
- * @param  res  The result. resolve() should allocate a struct addrinfo, which
- * the caller is responsible for freeing.
+ * @param  res  The result. resolve() should allocate a list of struct
+ * addrinfo, one per answer with the preferred server first, which the caller
+ * is responsible for freeing with freeresolve().
  *
  * @return 0 on success, -1 otherwise
  */
@@ -44,8 +47,48 @@ int resolve(struct config_t *proxy_config, const char *node,
 	    const char *service, const struct addrinfo *hints,
 	    struct addrinfo **res);
 
+/**
+ * Free the list of struct addrinfo allocated by resolve().
+ *
+ * @param  res  The result list of resolve().
+ */
+void freeresolve(struct addrinfo *res);
+
+/**
+ * Report the throughput of every video server to the DNS server, so that it
+ * ranks them by the paths this proxy actually sees.  The reports are sent
+ * from the fake-ip of the proxy, the address it resolves from, as datagrams
+ * of "<server-ip> <kbps>" lines to the feedback port of the DNS server.
+ *
+ * @param  feedback_port  The feedback port of the DNS server.
+ *
+ * @return 0 on success, -1 otherwise
+ */
+int init_feedback(unsigned int feedback_port);
+
+/**
+ * Fold the throughput measured for a fragment into the moving average of
+ * the video server it came from, and send the averages of the servers that
+ * were measured since the last report, at most every FEEDBACK_INTERVAL.
+ * Does nothing without init_feedback().
+ *
+ * @param  proxy_config  The proxy config with the fake-ip and alpha.
+ * @param  server_ip  The IP address of the video server.
+ * @param  tput  The throughput of the fragment in Kbps.
+ */
+void report_throughput(struct config_t *proxy_config, const char *server_ip,
+		       int tput);
+
 /* Holds the configuration for dns */
 struct dnsConfig {
 	const char *ip;
 	unsigned int port;
+	unsigned int feedback_port; /* 0 without throughput reports */
+};
+
+/* The moving average throughput of a video server, in Kbps */
+struct path_tput {
+	char ip[INET6_ADDRSTRLEN];
+	double tput;
+	int fresh; /* measured since the last report */
 };
@@ -7,9 +7,38 @@
 #include "parse.h"
 #include "stream.h"
 #include "bitrate.h"
+#include "mydns.h"
 #include "../common/log.h"
 #include "proxy.h"
 #include "../common/mytime.h"
+#include "../common/actlog.h"
+#include "stats.h"
+
+/*
+  Log the fragment conn downloaded at throughput tput, the moving average
+  being avg_tput, as a binary activity record.
+*/
+static void log_chunk(struct config_t *config, struct connection_t *conn,
+                      int tput, int avg_tput)
+{
+        struct actlog_chunk_t record;
+        mytime_t duration;
+
+        duration = (conn->stream).t_final - (conn->stream).t_start;
+
+        memset(&record, 0, sizeof(record));
+        record.type = ACTLOG_CHUNK;
+        record.server = actlogIntern(config->logFile, conn->serverIP);
+        record.time = microtime(NULL);
+        record.duration = duration > UINT32_MAX ? UINT32_MAX : duration;
+        record.tput = tput;
+        record.avgTput = avg_tput;
+        record.bitrate = modified_bitrate;
+        record.seg = current_seg_num;
+        record.frag = current_frag_num;
+
+        actlogWrite(config->logFile, &record);
+}
 
 /*
   Returns the send_socket to let the proxy know who to send to.
@@ -327,10 +356,25 @@ static int parse_response(struct connection_t *conn,
                 assert(frag_size > 0);
 
                 /* calcualte the moveing average of the throughput */
+                statsCount(STATS_FRAGMENTS, 1);
+                statsRecord(STATS_TRANSFER, (conn->stream).t_final -
+                            (conn->stream).t_start);
+                statsRecord(STATS_COPIED, (conn->stream).copied);
+
                 new_throughput = calculate_throughput(conn, frag_size);
                 throughput = calculate_moving_average(config, new_throughput);
                 //fprintf(stderr, "set throughput to (%d)\n", throughput);
 
+                /* let the dns server rank the servers by this path */
+                report_throughput(config, conn->serverIP,
+                                  new_throughput/1000);
+
+                if (config->binaryLog) {
+                        log_chunk(config, conn, new_throughput/1000,
+                                  throughput/1000);
+                        return 1;
+                }
+
                 duration = ((conn->stream).t_final - (conn->stream).t_start)/1000000.0;
 
                 /* log format string (all on one line):
@@ -363,6 +407,7 @@ void parse_data(int recv_socket, struct connection_t *conn,
 {
         struct stream_buffer *buffer;
         int first_message_len;
+        mytime_t start;
 
         /* parse the request or response buffer */
         if (recv_socket == (conn->browser).socket) {
@@ -371,6 +416,7 @@ void parse_data(int recv_socket, struct connection_t *conn,
                 buffer = ((conn->stream).response_buffer);
         }
 
+        start = statsClock();
         if (!complete_header_received(buffer)) {
                 //log(DEFAULT_LOG, "incomplete header.\n");
                 /* the received data is not ready to be parsed yet */
@@ -410,8 +456,15 @@ void parse_data(int recv_socket, struct connection_t *conn,
                 microtime(&((conn->stream).t_final));
                 //fprintf(stderr, "received a complete response from socket %d.\n",
                 //    recv_socket);
+
+                /* moved to send_buf, then appended to the browser buffer */
+                (conn->stream).copied += 2 * buffer->send_len +
+                        buffer->recv_len;
+
                 /* received a http response */
                 if (parse_response(conn, buffer, config) == 0) {
+                        statsSince(STATS_PARSE, start);
+                        (conn->stream).copied = 0;
                         free(buffer->send_buf);
                         buffer->send_buf = NULL;
                         buffer->send_len = 0;
@@ -420,6 +473,10 @@ void parse_data(int recv_socket, struct connection_t *conn,
                 }
         }
 
+        statsSince(STATS_PARSE, start);
+        if (recv_socket != (conn->browser).socket)
+                (conn->stream).copied = 0;
+
         //fprintf(stderr, "Proxy: %s\n", buffer->send_buf);
         dump_to_proxy(get_send_socket(recv_socket, conn),
                       (uint8_t *) buffer->send_buf, buffer->send_len);
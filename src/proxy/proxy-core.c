@@ -13,9 +13,24 @@
 #include <errno.h>
 #include <netdb.h>
 
+#include <fcntl.h>
+#include <sys/select.h>
+
 #include "proxy-core.h"
 #include "../common/log.h"
+#include "../common/mytime.h"
 #include "mydns.h"
+#include "stats.h"
+
+#define RACE_WIDTH 3 /* most connect attempts in flight at once */
+#define RACE_STAGGER 50000 /* usec to wait before starting another attempt */
+#define RACE_TIMEOUT 5000000 /* usec before giving up on all attempts */
+
+/* A connect attempt to one of the candidate servers */
+struct attempt_t {
+        int socket;
+        struct addrinfo *addr;
+};
 
 /*
   Given a new browser connection, create an internal connection that eventually
@@ -54,6 +69,29 @@ static void fillInIP(struct addrinfo *src, char *dest, size_t n);
 
 static int connectionHaveContent(struct connection_t *c);
 
+/*
+  Start a non-blocking connect to the candidate addr, bound to the local
+  fake-ip, and record it in attempt.
+
+  return 1 if the connect completed immediately, 0 if it is in progress and
+  -1 if the attempt failed.
+*/
+static int startAttempt(struct config_t *config, struct addrinfo *addr,
+                        struct attempt_t *attempt);
+
+/*
+  Race connects to the candidates in the list res, happy eyeballs style: the
+  candidates are tried in order, a new attempt starts whenever RACE_STAGGER
+  passes without any attempt completing or as soon as one fails, and at most
+  RACE_WIDTH attempts are in flight.  The first connect to complete wins and
+  the others are abandoned.
+
+  return the connected (blocking) socket and point winner at its candidate,
+  or -1 if every candidate failed or RACE_TIMEOUT passed.
+*/
+static int raceConnect(struct config_t *config, struct addrinfo *res,
+                       struct addrinfo **winner);
+
 int closeSocket(int sock)
 {
         if (sock <= 0)
@@ -94,6 +132,7 @@ int createServerSock(struct config_t *config, char *ipBuf, size_t bufSize)
         struct addrinfo hints, *res, *tmp;
         int sockfd;
         const char *node = config->wwwIP ? config->wwwIP : config->hostname;
+        mytime_t start;
 
         log(DEFAULT_LOG, "Connection to video server: %s.\n", node);
 
@@ -102,71 +141,194 @@ int createServerSock(struct config_t *config, char *ipBuf, size_t bufSize)
         hints.ai_family = AF_UNSPEC;
         hints.ai_socktype = SOCK_STREAM;
 
-	if (config->wwwIP) {
-		if (getaddrinfo(node, config->apachePort, &hints, &res)) {
-			log(DEFAULT_LOG, "resolve failed.\n");
-			return -1;
-		}
-	} else {
-		if (resolve(config, node, config->apachePort, &hints, &res)) {
-			log(DEFAULT_LOG, "resolve failed.\n");
-			return -1;
-		}
-	}
+        start = statsClock();
+        if (config->wwwIP) {
+                if (getaddrinfo(node, config->apachePort, &hints, &res)) {
+                        log(DEFAULT_LOG, "resolve failed.\n");
+                        statsCount(STATS_RESOLVE_FAILS, 1);
+                        return -1;
+                }
+        } else {
+                if (resolve(config, node, config->apachePort, &hints, &res)) {
+                        log(DEFAULT_LOG, "resolve failed.\n");
+                        statsCount(STATS_RESOLVE_FAILS, 1);
+                        return -1;
+                }
+        }
+        statsSince(STATS_RESOLVE, start);
 
         /*
-          attempt to setup connection using every result from getaddrinfo,
-          until it succeeds the first time
+          race connects to the results in their ranked order and keep the
+          first one to complete
         */
-        for (tmp = res; tmp; tmp = tmp->ai_next) {
-                log(DEFAULT_LOG, "ai_family: (%d)\n",tmp->ai_family);
-                log(DEFAULT_LOG, "ai_socktype: (%d)\n",tmp->ai_socktype);
-                log(DEFAULT_LOG, "ai_protocol: (%d)\n",tmp->ai_protocol);
+        sockfd = raceConnect(config, res, &tmp);
+        if (sockfd != -1)
+                fillInIP(tmp, ipBuf, bufSize);
 
-                if ((sockfd = socket(tmp->ai_family, tmp->ai_socktype,
-                                     tmp->ai_protocol)) == -1) {
-                        perror("socket");
-                        continue;
-                }
+        if (config->wwwIP)
+                freeaddrinfo(res);
+        else
+                freeresolve(res);
 
-                if (bindLocalPort(sockfd, config)) {
-                        closeSocket(sockfd);
-                        continue;
+        if (sockfd == -1) {
+                log(DEFAULT_LOG, "resolve server failed.\n");
+                return -1;
+        }
+
+        return sockfd;
+}
+
+static int startAttempt(struct config_t *config, struct addrinfo *addr,
+                        struct attempt_t *attempt)
+{
+        int sockfd, flags;
+        char str[INET6_ADDRSTRLEN];
+
+        log(DEFAULT_LOG, "ai_family: (%d)\n", addr->ai_family);
+        log(DEFAULT_LOG, "ai_socktype: (%d)\n", addr->ai_socktype);
+        log(DEFAULT_LOG, "ai_protocol: (%d)\n", addr->ai_protocol);
+
+        if ((sockfd = socket(addr->ai_family, addr->ai_socktype,
+                             addr->ai_protocol)) == -1) {
+                perror("socket");
+                return -1;
+        }
+
+        if (bindLocalPort(sockfd, config)) {
+                closeSocket(sockfd);
+                return -1;
+        }
+
+        if ((flags = fcntl(sockfd, F_GETFL)) == -1 ||
+            fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+                perror("fcntl");
+                closeSocket(sockfd);
+                return -1;
+        }
+
+        fillInIP(addr, str, sizeof(str));
+        log(DEFAULT_LOG, "ai_addr: (%s)\n", str);
+
+        attempt->socket = sockfd;
+        attempt->addr = addr;
+
+        if (!connect(sockfd, addr->ai_addr, addr->ai_addrlen))
+                return 1;
+
+        if (errno != EINPROGRESS) {
+                perror("connect");
+                closeSocket(sockfd);
+                return -1;
+        }
+
+        return 0;
+}
+
+static int raceConnect(struct config_t *config, struct addrinfo *res,
+                       struct addrinfo **winner)
+{
+        struct attempt_t attempts[RACE_WIDTH];
+        int i, active, rc, err, maxFd, flags;
+        int won = -1;
+        socklen_t errLen;
+        mytime_t now, wait, deadline, nextStart;
+        struct timeval tv;
+        fd_set sendfds;
+
+        active = 0;
+        deadline = microtime(NULL) + RACE_TIMEOUT;
+        nextStart = 0; /* start the first attempt right away */
+
+        while (won == -1) {
+                now = microtime(NULL);
+                if (now >= deadline) {
+                        log(DEFAULT_LOG, "connect race timed out.\n");
+                        break;
                 }
 
-                log(DEFAULT_LOG, "sin_family: (%d)\n",
-		    ((struct sockaddr_in *)tmp->ai_addr)->sin_family);
-                log(DEFAULT_LOG, "sin_port: (%d)\n",
-		    ntohs(((struct sockaddr_in *)tmp->ai_addr)->sin_port));
+                /* start the next candidate if it is due and there's room */
+                if (res && active < RACE_WIDTH && now >= nextStart) {
+                        rc = startAttempt(config, res, &attempts[active]);
+                        res = res->ai_next;
 
-                char str[INET_ADDRSTRLEN];
-                inet_ntop(AF_INET,
-			  &(((struct sockaddr_in *)tmp->ai_addr)->sin_addr),
-			  str, INET_ADDRSTRLEN);
+                        if (rc == 1) {
+                                won = active++;
+                                break;
+                        }
 
-                log(DEFAULT_LOG, "ai_addr: (%s)\n", str);
+                        if (rc == 0) {
+                                active++;
+                                nextStart = now + RACE_STAGGER;
+                        }
 
-                if (connect(sockfd, tmp->ai_addr, tmp->ai_addrlen)) {
-                        perror("connect");
-                        closeSocket(sockfd);
                         continue;
-                } else {
-                        fillInIP(tmp, ipBuf, bufSize);
+                }
+
+                if (!active && !res)
+                        break; /* every candidate failed */
+
+                /* wait for an attempt to finish, or for the next to be due */
+                FD_ZERO(&sendfds);
+                maxFd = -1;
+                for (i = 0; i < active; i++) {
+                        FD_SET(attempts[i].socket, &sendfds);
+                        maxFd = max(attempts[i].socket, maxFd);
+                }
+
+                if (res && active < RACE_WIDTH)
+                        wait = min(nextStart, deadline) - now;
+                else
+                        wait = deadline - now;
+                tv.tv_sec = wait / 1000000;
+                tv.tv_usec = wait % 1000000;
+
+                if (select(maxFd + 1, NULL, &sendfds, NULL, &tv) == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("select");
                         break;
                 }
+
+                for (i = active - 1; i >= 0; i--) {
+                        if (!FD_ISSET(attempts[i].socket, &sendfds))
+                                continue;
+
+                        errLen = sizeof(err);
+                        if (getsockopt(attempts[i].socket, SOL_SOCKET,
+                                       SO_ERROR, &err, &errLen) == -1)
+                                err = errno;
+
+                        if (!err) {
+                                won = i;
+                                break;
+                        }
+
+                        log(DEFAULT_LOG, "connect failed: %s\n",
+                            strerror(err));
+                        closeSocket(attempts[i].socket);
+                        attempts[i] = attempts[--active];
+                        nextStart = 0; /* fail over right away */
+                }
         }
 
-	if (!(config->wwwIP)) /*free ai_addr since freeaddrinfo doesn't do it*/
-		free(res->ai_addr);
+        /* abandon the attempts that lost */
+        for (i = 0; i < active; i++)
+                if (i != won)
+                        closeSocket(attempts[i].socket);
 
-	freeaddrinfo(res);
+        if (won == -1)
+                return -1;
 
-        if (!tmp) {
-                log(DEFAULT_LOG, "resolve server failed.\n");
+        /* the rest of the proxy expects blocking sockets */
+        if ((flags = fcntl(attempts[won].socket, F_GETFL)) == -1 ||
+            fcntl(attempts[won].socket, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+                perror("fcntl");
+                closeSocket(attempts[won].socket);
                 return -1;
         }
 
-        return sockfd;
+        *winner = attempts[won].addr;
+        return attempts[won].socket;
 }
 
 struct connection_t *createNewConnection(int listener, struct config_t *config)
@@ -176,6 +338,7 @@ struct connection_t *createNewConnection(int listener, struct config_t *config)
         struct sockaddr_in cliAddr;
         struct connection_t *connection;
         char ip[INET6_ADDRSTRLEN];
+        mytime_t accepted;
 
         log(DEFAULT_LOG, "new connection.\n");
 
@@ -190,12 +353,16 @@ struct connection_t *createNewConnection(int listener, struct config_t *config)
                         return NULL;
                 }
         }
+        accepted = statsClock();
+        statsCount(STATS_ACCEPTS, 1);
 
         if ((serverSock = createServerSock(config, ip, sizeof(ip))) == -1) {
                 log(DEFAULT_LOG, "create server sock failed.\n");
+                statsCount(STATS_CONNECT_FAILS, 1);
                 closeSocket(clientSock);
                 return NULL;
         }
+        statsSince(STATS_CONNECT, accepted);
 
         if (!(connection = createConnection(clientSock, serverSock))) {
                 log(DEFAULT_LOG, "create connection failed.\n");
@@ -231,6 +398,15 @@ void receiveConnection(struct config_t *config, int socket)
                 if (!connectionHaveContent(connection))
                         removeConnection(connection);
         } else {
+                statsCount(STATS_BYTES_RECEIVED, bytesRecvd);
+
+                /* the first bytes answering the request sent upstream */
+                if (socket == connection->server.socket &&
+                    connection->stream.t_request) {
+                        statsSince(STATS_TTFB, connection->stream.t_request);
+                        connection->stream.t_request = 0;
+                }
+
                 dump_to_stream(socket, connection, chr, bytesRecvd, config);
         }
 }
@@ -259,6 +435,8 @@ void sendConnection(int socket)
         else
                 buf = &(connection->server.buf);
 
+        statsRecord(STATS_QUEUE, buf->contentLength);
+
         if ((bytesSent = send(socket, buf->buf, buf->contentLength, 0)) == -1) {
                 switch(errno) {
                 case ECONNRESET:
@@ -266,6 +444,7 @@ void sendConnection(int socket)
                 case EPIPE:
                         removeConnection(connection);
                 default:
+                        statsCount(STATS_SEND_ERRORS, 1);
                         fprintf(stderr, "fd %d ", socket);
                         perror("send");
                         break;
@@ -275,6 +454,12 @@ void sendConnection(int socket)
                     bytesSent,
                     buf->contentLength);
                 microtime(&((connection->stream).t_start));
+                statsCount(STATS_BYTES_SENT, bytesSent);
+
+                /* a request went upstream, wait for its first bytes */
+                if (socket == connection->server.socket &&
+                    !connection->stream.t_request)
+                        connection->stream.t_request = statsClock();
 
                 /* clear the buffer of the content that was sent */
                 bufferRemoveContent(buf, bytesSent);
@@ -56,3 +56,4 @@ int closeSocket(int sock);
 void monitorConnection(struct config_t *, struct connection_t *c);
 
 #define max(a,b) a < b ? b : a
+#define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -15,7 +15,9 @@
 #include "proxy-core.h"
 #include "mydns.h"
 #include "../common/log.h"
+#include "../common/actlog.h"
 #include "connection.h"
+#include "stats.h"
 
 /*
   Query the server for a manifest file.
@@ -42,6 +44,22 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (proxyConfig.asyncLog &&
+	    logAsync(proxyConfig.logFile, proxyConfig.logFilename,
+		     &(proxyConfig.logRotate)))
+		log(DEFAULT_LOG, "async log failed, logging synchronously.\n");
+
+	if (proxyConfig.binaryLog && actlogStart(proxyConfig.logFile)) {
+		log(DEFAULT_LOG, "start binary log failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (proxyConfig.statsFile &&
+	    statsStart(proxyConfig.statsFile, proxyConfig.statsInterval)) {
+		log(DEFAULT_LOG, "start stats failed.\n");
+		return EXIT_FAILURE;
+	}
+
 	errno = 0;
 	port = strtol(proxyConfig.dnsPort, NULL, 10);
 	if (errno) {
@@ -54,8 +72,19 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
+	if (proxyConfig.feedbackPort) {
+		errno = 0;
+		port = strtol(proxyConfig.feedbackPort, NULL, 10);
+		if (errno || init_feedback(port)) {
+			log(DEFAULT_LOG, "init feedback failed.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
         proxyStart(&proxyConfig);
+	statsStop();
         logClose(&(proxyConfig.logFile));
+	actlogFree();
 
 	return EXIT_SUCCESS;
 }
@@ -64,6 +93,8 @@ void proxyStart(struct config_t *config)
 {
         int readyFds;
         fd_set recvfds, sendfds;
+        struct timeval tv, *timeout;
+        mytime_t wait;
 
 	log(DEFAULT_LOG, "Proxy Starting...\n");
 
@@ -81,8 +112,16 @@ void proxyStart(struct config_t *config)
                 setFdSets(config, &recvfds, &sendfds);
                 readyFds = 0;
 
+                /* wake up for the next stats snapshot, if any */
+                timeout = NULL;
+                if ((wait = statsWait())) {
+                        tv.tv_sec = wait / 1000000;
+                        tv.tv_usec = wait % 1000000;
+                        timeout = &tv;
+                }
+
                 if ((readyFds = select(config->maxFd + 1, &recvfds, &sendfds,
-                                       NULL, NULL)) == -1) {
+                                       NULL, timeout)) == -1) {
                         if (errno == EINTR)
                                 continue;
                         fprintf(stderr, "select error.\n");
@@ -90,6 +129,7 @@ void proxyStart(struct config_t *config)
                 }
 
                 handleReadyFds(config, &recvfds, &sendfds);
+                statsTick();
         }
 }
 
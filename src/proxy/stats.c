@@ -0,0 +1,239 @@
+/*
+  Latency histograms and counters of the proxy, see stats.h
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "../common/log.h"
+#include "../common/asynclog.h"
+
+/* A log-linear histogram over an interval */
+struct histogram_t {
+        uint64_t count, min, max;
+        uint64_t buckets[STATS_BUCKETS];
+};
+
+static const char *metricNames[STATS_METRICS] = {
+        "connect_us",
+        "resolve_us",
+        "parse_us",
+        "ttfb_us",
+        "transfer_us",
+        "queue_bytes",
+        "copied_bytes"
+};
+
+static const char *counterNames[STATS_COUNTERS] = {
+        "accepts",
+        "connect_fails",
+        "resolve_fails",
+        "fragments",
+        "bytes_received",
+        "bytes_sent",
+        "send_errors",
+        "log_drops"
+};
+
+/* the stats of the event loop, off until statsStart */
+static struct {
+        int on;
+        FILE *log;
+        mytime_t interval, due;
+        struct histogram_t histograms[STATS_METRICS];
+        uint64_t counters[STATS_COUNTERS];
+} stats;
+
+/*
+  return the bucket of value
+*/
+static size_t bucketOf(uint64_t value);
+
+/*
+  return the lowest value of bucket
+*/
+static uint64_t bucketValue(size_t bucket);
+
+/*
+  return the value below which percent of the values of histogram fall, within
+  the precision of its buckets
+*/
+static uint64_t percentile(const struct histogram_t *histogram,
+                           double percent);
+
+/*
+  Write the histograms and counters to the stats log at now, and start the
+  histograms over.
+*/
+static void snapshot(mytime_t now);
+
+int statsStart(const char *file, unsigned long seconds)
+{
+        if (!seconds || !(stats.log = logSetup(file)))
+                return EXIT_FAILURE;
+
+        memset(stats.histograms, 0, sizeof(stats.histograms));
+        memset(stats.counters, 0, sizeof(stats.counters));
+        stats.interval = seconds * 1000000;
+        stats.due = microtime(NULL) + stats.interval;
+        stats.on = 1;
+        return EXIT_SUCCESS;
+}
+
+mytime_t statsClock(void)
+{
+        return stats.on ? microtime(NULL) : 0;
+}
+
+void statsSince(enum stats_metric_t metric, mytime_t start)
+{
+        mytime_t now;
+
+        if (!stats.on || !start)
+                return;
+
+        now = microtime(NULL);
+        statsRecord(metric, now > start ? now - start : 0);
+}
+
+void statsRecord(enum stats_metric_t metric, uint64_t value)
+{
+        struct histogram_t *histogram;
+
+        if (!stats.on)
+                return;
+
+        histogram = &(stats.histograms[metric]);
+        if (!histogram->count || value < histogram->min)
+                histogram->min = value;
+        if (value > histogram->max)
+                histogram->max = value;
+        histogram->count++;
+        histogram->buckets[bucketOf(value)]++;
+}
+
+void statsCount(enum stats_counter_t counter, uint64_t n)
+{
+        if (stats.on)
+                stats.counters[counter] += n;
+}
+
+mytime_t statsWait(void)
+{
+        mytime_t now;
+
+        if (!stats.on)
+                return 0;
+
+        now = microtime(NULL);
+        return stats.due > now ? stats.due - now : 1;
+}
+
+void statsTick(void)
+{
+        mytime_t now;
+
+        if (!stats.on)
+                return;
+
+        now = microtime(NULL);
+        if (now < stats.due)
+                return;
+
+        snapshot(now);
+
+        /* skip the snapshots missed while the loop was held up */
+        stats.due += stats.interval;
+        if (stats.due <= now)
+                stats.due = now + stats.interval;
+}
+
+void statsStop(void)
+{
+        if (!stats.on)
+                return;
+
+        snapshot(microtime(NULL));
+        logClose(&(stats.log));
+        stats.on = 0;
+}
+
+static size_t bucketOf(uint64_t value)
+{
+        int exponent;
+
+        if (value < 2 * STATS_SUB)
+                return value;
+
+        /* the power of two, then the top STATS_SUB_BITS bits below it */
+        exponent = 63 - __builtin_clzll(value);
+        return (exponent - STATS_SUB_BITS + 1) * STATS_SUB +
+                ((value >> (exponent - STATS_SUB_BITS)) & (STATS_SUB - 1));
+}
+
+static uint64_t bucketValue(size_t bucket)
+{
+        size_t power;
+
+        if (bucket < 2 * STATS_SUB)
+                return bucket;
+
+        power = bucket / STATS_SUB;
+        return (uint64_t) (STATS_SUB + bucket % STATS_SUB) << (power - 1);
+}
+
+static uint64_t percentile(const struct histogram_t *histogram,
+                           double percent)
+{
+        uint64_t rank, seen, value;
+        size_t i;
+
+        if (!histogram->count)
+                return 0;
+
+        rank = histogram->count * percent / 100.0;
+        if (rank < 1)
+                rank = 1;
+
+        seen = 0;
+        for (i = 0; i < STATS_BUCKETS; i++) {
+                seen += histogram->buckets[i];
+                if (seen >= rank)
+                        break;
+        }
+
+        /* a bucket spans values, keep to the ones actually seen */
+        value = bucketValue(i);
+        if (value < histogram->min)
+                return histogram->min;
+        if (value > histogram->max)
+                return histogram->max;
+        return value;
+}
+
+static void snapshot(mytime_t now)
+{
+        const struct histogram_t *histogram;
+        unsigned long seconds = now / 1000000;
+        int i;
+
+        for (i = 0; i < STATS_METRICS; i++) {
+                histogram = &(stats.histograms[i]);
+                log_activity(stats.log, STATS_FMT, seconds, metricNames[i],
+                             histogram->count, histogram->min,
+                             percentile(histogram, 50),
+                             percentile(histogram, 90),
+                             percentile(histogram, 99),
+                             percentile(histogram, 99.9),
+                             histogram->max);
+        }
+
+        /* counted by the log thread, not the event loop */
+        stats.counters[STATS_LOG_DROPS] = asyncLogDropped();
+        for (i = 0; i < STATS_COUNTERS; i++)
+                log_activity(stats.log, STATS_COUNTER_FMT, seconds,
+                             counterNames[i], stats.counters[i]);
+
+        memset(stats.histograms, 0, sizeof(stats.histograms));
+}
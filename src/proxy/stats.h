@@ -0,0 +1,108 @@
+#pragma once
+/*
+  Latency histograms and counters of the proxy hot path.
+
+  Every metric is a log-linear histogram in the style of HdrHistogram: values
+  below 2 * STATS_SUB are counted exactly, and every power of two above is cut
+  in STATS_SUB buckets, so a bucket is within 1 / STATS_SUB of the values in
+  it.  Recording a value is finding its bucket with a count of leading zeros
+  and incrementing it, nothing is allocated or locked.
+
+  The histograms belong to the thread that records them, which is the event
+  loop, the only thread of the proxy touching connections.  Snapshots are
+  taken from the event loop too: every interval, the count, minimum,
+  percentiles and maximum of each histogram over the interval are written to
+  the stats log, and the histograms are started over.  The counters count
+  since the proxy started.
+
+  A snapshot is one line per metric:
+
+  <time> <metric> <count> <min> <p50> <p90> <p99> <p999> <max>
+
+  and one line per counter:
+
+  <time> <counter> <value>
+
+  Times are in microseconds and sizes in bytes.  When the stats are off,
+  recording is a test of a flag and no clock is read.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "../common/mytime.h"
+
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS) /* buckets per power of two */
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB)
+#define STATS_INTERVAL 10 /* default seconds between snapshots */
+
+#define STATS_FMT "%lu %s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 \
+        " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n"
+#define STATS_COUNTER_FMT "%lu %s %" PRIu64 "\n"
+
+enum stats_metric_t {
+        STATS_CONNECT, /* from accepting a browser to connecting upstream */
+        STATS_RESOLVE, /* of the video server name */
+        STATS_PARSE, /* of a complete request or response */
+        STATS_TTFB, /* from a request sent to the first response bytes */
+        STATS_TRANSFER, /* of a video fragment */
+        STATS_QUEUE, /* bytes queued to a socket when it can be sent to */
+        STATS_COPIED, /* bytes copied by the proxy for a video fragment */
+        STATS_METRICS
+};
+
+enum stats_counter_t {
+        STATS_ACCEPTS,
+        STATS_CONNECT_FAILS,
+        STATS_RESOLVE_FAILS,
+        STATS_FRAGMENTS,
+        STATS_BYTES_RECEIVED,
+        STATS_BYTES_SENT,
+        STATS_SEND_ERRORS,
+        STATS_LOG_DROPS, /* lines the asynchronous log dropped */
+        STATS_COUNTERS
+};
+
+/*
+  Turn the stats on, writing a snapshot to the stats log file every seconds.
+
+  returns EXIT_SUCCESS if successful, EXIT_FAILURE otherwise
+*/
+int statsStart(const char *file, unsigned long seconds);
+
+/*
+  returns the time now to measure from, 0 if the stats are off
+*/
+mytime_t statsClock(void);
+
+/*
+  Record the time since start, taken by statsClock, in metric.
+*/
+void statsSince(enum stats_metric_t metric, mytime_t start);
+
+/*
+  Record value in metric.
+*/
+void statsRecord(enum stats_metric_t metric, uint64_t value);
+
+/*
+  Add n to counter.
+*/
+void statsCount(enum stats_counter_t counter, uint64_t n);
+
+/*
+  returns the microseconds until the next snapshot is due, 0 if the stats are
+  off
+*/
+mytime_t statsWait(void);
+
+/*
+  Write a snapshot to the stats log if it is due.
+*/
+void statsTick(void);
+
+/*
+  Write a last snapshot and close the stats log.
+*/
+void statsStop(void);
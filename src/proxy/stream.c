@@ -76,6 +76,8 @@ void dump_to_stream(int recv_socket, struct connection_t *conn,
         }
         /* move the new received data to the new recv buffer */
         memcpy(new_recv_buf + buffer->recv_len, proxy_buffer, bytes_received);
+        if (buffer == (conn->stream).response_buffer)
+                (conn->stream).copied += buffer->recv_len + bytes_received;
         buffer->recv_len += bytes_received;
         buffer->recv_buf = new_recv_buf;
 
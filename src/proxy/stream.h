@@ -14,6 +14,8 @@ struct connection_t;
 
 struct stream_t {
         mytime_t t_start, t_final; /* the start time and end time for a chunk */
+        mytime_t t_request; /* when a request went upstream, 0 once answered */
+        size_t copied; /* bytes copied for the response being received */
         struct stream_buffer *request_buffer; /* buffer to write and read requests */
         struct stream_buffer *response_buffer; /* buffer to write and read requests */
 };